@@ -8,6 +8,10 @@
 * Author: James Wu
 */
 
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
 #include "soa.hpp"
 #include "utilityfunctions.hpp"
 #include "pricingservice.hpp"
@@ -21,6 +25,9 @@ class GUIToPricingListener;
 
 // the GUI service with given product type T
 // used to stream the prices.
+// Prices are conflated: only the latest price of each product is kept, and a snapshot of every
+// product that changed is published once per throttle interval of the process clock: by a timer
+// thread on the real clock, and on a simulated clock by the first price received once the interval is over.
 // *emulate the other implemented classes
 template <typename T>
 class GUIService : Service<string, Price<T>> {
@@ -30,7 +37,7 @@ public:
 	~GUIService();
 
 	// fetch data with given product id
-	Price<T>& GetData(string _key);
+	Price<T>& GetData(const string& _key);
 
 	// call back function for the connector
 	void OnMessage(Price<T>& _data);
@@ -47,26 +54,40 @@ public:
 	// fetch the listener
 	ServiceListener<Price<T>>* GetListener();
 
-	// fetch the throttle
+	// fetch the throttle (in milliseconds)
 	int GetThrottle() const;
 
-	// set the throttle
+	// set the throttle (in milliseconds), effective from the next flush
 	void SetThrottle(int _throttle);
 
-	// fetch the current millisecond
-	int GetMillisec() const;
+	// publish the latest price of every product changed since the last flush
+	// called at every throttle interval; returns the number of prices published
+	int Flush();
 
-	// set the millisecond
-	void SetMillisec(int _millisec);
+	// fetch the number of prices received, and of those superseded before they could be published
+	long GetReceivedCount() const;
+	long GetConflatedCount() const;
 
 private:
+	// timer thread: flushes every throttle interval on the monotonic clock until stopped
+	void Run();
+
 	map<string, Price<T>> GUIs;
+	map<string, Price<T>> pending;		// latest price of the products changed since the last flush
 	vector<ServiceListener<Price<T>>*>listeners;
 	GUIConnector<T>* connector;
 	ServiceListener<Price<T>>* listener;
 
 	int throttle;
-	int millisec;
+	long received;
+	long conflated;
+	Clock* clock;
+	int64_t nextFlush;		// on a simulated clock, the time of the next flush
+
+	mutable mutex lock;
+	condition_variable wakeUp;
+	bool stopping;
+	thread timer;
 };
 
 template<typename T>
@@ -76,24 +97,65 @@ GUIService<T>::GUIService() {
 	connector = new GUIConnector<T>(this);
 	listener = new GUIToPricingListener<T>(this);
 	throttle = 300;
-	millisec = 0;
+	received = 0;
+	conflated = 0;
+	stopping = false;
+	clock = &CurrentClock();
+	nextFlush = clock->Steady() + (int64_t)throttle * 1000000;
+	if (clock->IsRealTime()) {
+		timer = thread(&GUIService<T>::Run, this);
+	}
 }
 
+// stop the timer and publish whatever is still pending
 template<typename T>
-GUIService<T>::~GUIService() {}
+GUIService<T>::~GUIService()
+{
+	{
+		lock_guard<mutex> _guard(lock);
+		stopping = true;
+	}
+	wakeUp.notify_all();
+	if (timer.joinable()) {
+		timer.join();
+	}
+	Flush();
+}
 
 template<typename T>
-Price<T>& GUIService<T>::GetData(string _key) {
-	return GUIs[_key];
+Price<T>& GUIService<T>::GetData(const string& _key) {
+	lock_guard<mutex> _guard(lock);
+	return GUIs.at(_key);
 }
 
 template<typename T>
 void GUIService<T>::OnMessage(Price<T>& _data)
 {
-	// pulish the data
-	string product_id = _data.GetProduct().GetProductId();
-	GUIs[product_id] = _data;
-	connector->Publish(_data);
+	// keep the latest price, the timer thread publishes it
+	const string& product_id = _data.GetProduct().GetProductId();
+	bool _flush = false;
+	{
+		lock_guard<mutex> _guard(lock);
+		GUIs.insert_or_assign(product_id, _data);
+		if (!pending.insert_or_assign(product_id, _data).second) {
+			conflated++;
+		}
+		received++;
+
+		// on a simulated clock there is no timer thread: the interval is checked here
+		int64_t _now = clock->IsRealTime() ? 0 : clock->Steady();
+		if (!clock->IsRealTime() && _now >= nextFlush)
+		{
+			nextFlush += (int64_t)throttle * 1000000;
+			if (nextFlush <= _now) {
+				nextFlush = _now + (int64_t)throttle * 1000000;
+			}
+			_flush = true;
+		}
+	}
+	if (_flush) {
+		Flush();
+	}
 }
 
 template<typename T>
@@ -123,24 +185,71 @@ ServiceListener<Price<T>>* GUIService<T>::GetListener()
 template<typename T>
 int GUIService<T>::GetThrottle() const
 {
+	lock_guard<mutex> _guard(lock);
 	return throttle;
 }
 
 template<typename T>
-int GUIService<T>::GetMillisec() const
+void GUIService<T>::SetThrottle(int _throttle)
 {
-	return millisec;
+	lock_guard<mutex> _guard(lock);
+	throttle = _throttle;
 }
 
 template<typename T>
-void GUIService<T>::SetThrottle(int _throttle)
+int GUIService<T>::Flush()
 {
-	throttle = _throttle;
+	// take the snapshot under the lock, write it outside so OnMessage never waits on the file
+	map<string, Price<T>> _snapshot;
+	{
+		lock_guard<mutex> _guard(lock);
+		_snapshot.swap(pending);
+	}
+	if (_snapshot.empty()) {
+		return 0;
+	}
+	string _timeStamp = GetTimeStamp();
+	for (auto& [_productId, _price] : _snapshot) {
+		connector->Publish(_price, _timeStamp);
+	}
+	connector->Flush();
+	return (int)_snapshot.size();
+}
+
+template<typename T>
+long GUIService<T>::GetReceivedCount() const
+{
+	lock_guard<mutex> _guard(lock);
+	return received;
+}
+
+template<typename T>
+long GUIService<T>::GetConflatedCount() const
+{
+	lock_guard<mutex> _guard(lock);
+	return conflated;
 }
+
 template<typename T>
-void GUIService<T>::SetMillisec(int _millisec)
+void GUIService<T>::Run()
 {
-	millisec = _millisec;
+	auto _next = chrono::steady_clock::now();
+	while (true)
+	{
+		{
+			unique_lock<mutex> _guard(lock);
+			_next += chrono::milliseconds(throttle);
+			// if a flush overran the interval, restart the cadence instead of bursting to catch up
+			auto _now = chrono::steady_clock::now();
+			if (_next < _now) {
+				_next = _now + chrono::milliseconds(throttle);
+			}
+			if (wakeUp.wait_until(_guard, _next, [this] { return stopping; })) {
+				return;
+			}
+		}
+		Flush();
+	}
 }
 
 template<typename T>
@@ -152,12 +261,19 @@ public:
 	// publish the data, save the records
 	void Publish(Price<T>& _data);
 
+	// publish the data stamped with the time of the snapshot it belongs to
+	void Publish(const Price<T>& _data, const string& _timeStamp);
+
+	// push the buffered records to gui.txt
+	void Flush();
+
 	// subscribe data from connector
 	// not needed, declared here for uniformity in design
 	void Subscribe(ifstream& _data);
 
 private:
 	GUIService<T>* service;
+	ofstream file;		// opened on the first publish and kept open
 };
 
 template<typename T>
@@ -169,28 +285,29 @@ GUIConnector<T>::GUIConnector(GUIService<T>* _service)
 template<typename T>
 void GUIConnector<T>::Publish(Price<T>& _data)
 {
-	int _throttle = service->GetThrottle();
-	int _millisec = service->GetMillisec();
-	int currentMillisec = GetMillisecond();		// fetch the system time in milliseconds
+	Publish(_data, GetTimeStamp());
+}
 
-	// update time
-	while (currentMillisec < _millisec) {
-		currentMillisec += 1000;
+template<typename T>
+void GUIConnector<T>::Publish(const Price<T>& _data, const string& _timeStamp)
+{
+	if (!file.is_open()) {
+		file.open("gui.txt", ios::app);
 	}
-	if (currentMillisec - _millisec >= _throttle)
-	{
-		service->SetMillisec(currentMillisec);
-		ofstream _file;
-		_file.open("gui.txt", ios::app);
 
-		// update the information into GUI to keep records.
-		_file << GetTimeStamp() << ",";
-		for (auto& s : _data.ToStrings())
-		{
-			_file << s << ",";
-		}
-		_file << "\n";
+	// update the information into GUI to keep records.
+	file << _timeStamp << ",";
+	for (auto& s : _data.ToStrings())
+	{
+		file << s << ",";
 	}
+	file << "\n";
+}
+
+template<typename T>
+void GUIConnector<T>::Flush()
+{
+	file.flush();
 }
 
 template<typename T>
@@ -9,14 +9,31 @@
   * @coauthor James Wu
   */
 #include <string>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
 #include "soa.hpp"
 #include "marketdataservice.hpp"
+#include "timerwheel.hpp"
 #include "utilityfunctions.hpp"
 
 enum OrderType { FOK, IOC, MARKET, LIMIT, STOP };
 
 enum Market { BROKERTEC, ESPEED, CME };
 
+const int MARKET_COUNT = 3;
+
+// name of a venue
+inline const char* MarketToString(Market _market)
+{
+	static const char* _names[MARKET_COUNT] = { "BROKERTEC", "ESPEED", "CME" };
+	return _names[_market];
+}
+
 /**
  * An execution order that can be placed on an exchange.
  * Type T is the product type.
@@ -29,7 +46,7 @@ public:
 
 	// ctor for an order
 	ExecutionOrder() = default;
-	ExecutionOrder(const T& _product, PricingSide _side, string _orderId, OrderType _orderType, double _price, double _visibleQuantity, double _hiddenQuantity, string _parentOrderId, bool _isChildOrder);
+	ExecutionOrder(const T& _product, PricingSide _side, TradingId _orderId, OrderType _orderType, double _price, double _visibleQuantity, double _hiddenQuantity, TradingId _parentOrderId, bool _isChildOrder, Market _market = BROKERTEC);
 
 	// Get the product
 	const T& GetProduct() const;
@@ -38,7 +55,7 @@ public:
 	PricingSide GetPricingSide() const;
 
 	// Get the order ID
-	const string& GetOrderId() const;
+	const TradingId& GetOrderId() const;
 
 	// Get the order type on this order
 	OrderType GetOrderType() const;
@@ -53,24 +70,28 @@ public:
 	long GetHiddenQuantity() const;
 
 	// Get the parent order ID
-	const string& GetParentOrderId() const;
+	const TradingId& GetParentOrderId() const;
 
 	// Is child order?
 	bool IsChildOrder() const;
 
+	// Get the venue the order is sent to
+	Market GetMarket() const;
+
 	// Store attributes as strings
 	vector<string> ToStrings() const;
 
 private:
 	T product;
 	PricingSide side;
-	string orderId;
+	TradingId orderId;
 	OrderType orderType;
 	double price;
 	long visibleQuantity;
 	double hiddenQuantity;
-	string parentOrderId;
+	TradingId parentOrderId;
 	bool isChildOrder;
+	Market market;
 
 };
 
@@ -80,17 +101,16 @@ private:
  * Type T is the product type.
  */
 template<typename T>
-ExecutionOrder<T>::ExecutionOrder(const T& _product, PricingSide _side, string _orderId, OrderType _orderType, double _price, double _visibleQuantity, double _hiddenQuantity, string _parentOrderId, bool _isChildOrder) :
-	product(_product)
+ExecutionOrder<T>::ExecutionOrder(const T& _product, PricingSide _side, TradingId _orderId, OrderType _orderType, double _price, double _visibleQuantity, double _hiddenQuantity, TradingId _parentOrderId, bool _isChildOrder, Market _market) :
+	product(_product), orderId(_orderId), parentOrderId(_parentOrderId)
 {
 	side = _side;
-	orderId = _orderId;
 	orderType = _orderType;
 	price = _price;
 	visibleQuantity = static_cast<long>(_visibleQuantity);
 	hiddenQuantity = static_cast<long>(_hiddenQuantity);
-	parentOrderId = _parentOrderId;
 	isChildOrder = _isChildOrder;
+	market = _market;
 }
 
 template<typename T>
@@ -106,7 +126,7 @@ PricingSide ExecutionOrder<T>::GetPricingSide() const
 }
 
 template<typename T>
-const string& ExecutionOrder<T>::GetOrderId() const
+const TradingId& ExecutionOrder<T>::GetOrderId() const
 {
 	return orderId;
 }
@@ -136,7 +156,7 @@ long ExecutionOrder<T>::GetHiddenQuantity() const
 }
 
 template<typename T>
-const string& ExecutionOrder<T>::GetParentOrderId() const
+const TradingId& ExecutionOrder<T>::GetParentOrderId() const
 {
 	return parentOrderId;
 }
@@ -147,13 +167,19 @@ bool ExecutionOrder<T>::IsChildOrder() const
 	return isChildOrder;
 }
 
+template<typename T>
+Market ExecutionOrder<T>::GetMarket() const
+{
+	return market;
+}
+
 template<typename T>
 vector<string> ExecutionOrder<T>::ToStrings() const
 {
 	string _product = product.GetProductId();
 	string _side;
 	_side = side == BID ? "BID" : "OFFER";
-	string _orderId = orderId;
+	string _orderId = orderId.ToString();
 	string _orderType;
 	if (orderType == FOK) {
 		_orderType = "FOK";
@@ -176,11 +202,12 @@ vector<string> ExecutionOrder<T>::ToStrings() const
 	_visibleQuantity = _visibleQuantity.substr(0, _visibleQuantity.find(".") + 1);
 	string _hiddenQuantity = to_string(hiddenQuantity);
 	_hiddenQuantity = _hiddenQuantity.substr(0, _hiddenQuantity.find(".") + 1);
-	string _parentOrderId = parentOrderId;
+	string _parentOrderId = parentOrderId.ToString();
 	string _isChildOrder = isChildOrder ? "YES" : "NO";
+	string _market = MarketToString(market);
 
 	vector<string> _strings{ _product,_side,_orderId,_orderType,_price,
-	_visibleQuantity, _hiddenQuantity,_parentOrderId,_isChildOrder };
+	_visibleQuantity, _hiddenQuantity,_parentOrderId,_isChildOrder,_market };
 	return _strings;
 }
 
@@ -192,39 +219,106 @@ class AlgoExecution
 public:
 	// ctor for an order
 	AlgoExecution() = default;
-	AlgoExecution(const T& _product, PricingSide _side, string _orderId, OrderType _orderType, double _price, long _visibleQuantity, long _hiddenQuantity, string _parentOrderId, bool _isChildOrder);
+	AlgoExecution(const T& _product, PricingSide _side, TradingId _orderId, OrderType _orderType, double _price, long _visibleQuantity, long _hiddenQuantity, TradingId _parentOrderId, bool _isChildOrder);
 
 	// Get the order
-	ExecutionOrder<T>* GetExecutionOrder() const;
+	ExecutionOrder<T>* GetExecutionOrder();
+	const ExecutionOrder<T>* GetExecutionOrder() const;
 
 private:
-	ExecutionOrder<T>* executionOrder;
+	ExecutionOrder<T> executionOrder;
 
 };
 
 // implementation of algo execution
 template<typename T>
-AlgoExecution<T>::AlgoExecution(const T& _product, PricingSide _side, string _orderId, OrderType _orderType, double _price, long _visibleQuantity, long _hiddenQuantity, string _parentOrderId, bool _isChildOrder)
+AlgoExecution<T>::AlgoExecution(const T& _product, PricingSide _side, TradingId _orderId, OrderType _orderType, double _price, long _visibleQuantity, long _hiddenQuantity, TradingId _parentOrderId, bool _isChildOrder) :
+	executionOrder(_product, _side, _orderId, _orderType, _price, _visibleQuantity, _hiddenQuantity, _parentOrderId, _isChildOrder)
 {
-	executionOrder = new ExecutionOrder<T>(_product, _side, _orderId, _orderType, _price, _visibleQuantity, _hiddenQuantity, _parentOrderId, _isChildOrder);
 }
 
 template<typename T>
-ExecutionOrder<T>* AlgoExecution<T>::GetExecutionOrder() const
+ExecutionOrder<T>* AlgoExecution<T>::GetExecutionOrder()
 {
-	return executionOrder;
+	return &executionOrder;
 }
 
+template<typename T>
+const ExecutionOrder<T>* AlgoExecution<T>::GetExecutionOrder() const
+{
+	return &executionOrder;
+}
+
+
+enum SliceType { SLICE_NONE, SLICE_TWAP, SLICE_ICEBERG };
+
+/**
+* How a parent order is sliced into child orders: not at all, evenly over a number of slices
+* (TWAP), or shown a display quantity at a time with the rest hidden (iceberg). The slices
+* are sent an interval apart.
+*/
+struct SliceSchedule
+{
+	SliceType type = SLICE_NONE;
+	int slices = 1;
+	long display = 0;
+	int64_t interval = 0;
+
+	// send the whole order at once
+	static SliceSchedule None();
+
+	// send the order in _slices equal slices, _interval apart
+	static SliceSchedule Twap(int _slices, chrono::nanoseconds _interval);
+
+	// show _display of the order at a time, refreshed every _interval
+	static SliceSchedule Iceberg(long _display, chrono::nanoseconds _interval);
+};
+
+SliceSchedule SliceSchedule::None()
+{
+	return SliceSchedule();
+}
+
+SliceSchedule SliceSchedule::Twap(int _slices, chrono::nanoseconds _interval)
+{
+	if (_slices <= 0) {
+		throw invalid_argument("TWAP slices must be positive");
+	}
+	SliceSchedule _schedule;
+	_schedule.type = SLICE_TWAP;
+	_schedule.slices = _slices;
+	_schedule.interval = _interval.count();
+	return _schedule;
+}
+
+SliceSchedule SliceSchedule::Iceberg(long _display, chrono::nanoseconds _interval)
+{
+	if (_display <= 0) {
+		throw invalid_argument("iceberg display quantity must be positive");
+	}
+	SliceSchedule _schedule;
+	_schedule.type = SLICE_ICEBERG;
+	_schedule.display = _display;
+	_schedule.interval = _interval.count();
+	return _schedule;
+}
 
 /**
 * Pre-declearations to avoid errors.
 */
 template<typename T>
 class AlgoExecutionToMarketDataListener;
+template<typename T>
+class AlgoExecutionConflator;
+template<typename T>
+class SliceScheduler;
 
 /**
 * Service for algo_executing orders.
 * Keyed on product identifier.
+* With a slice schedule set, each order is sent as the child orders of a SliceScheduler instead.
+* Its slices are sent as the timer service is polled: on every book, from a clock-driven loop calling
+* Poll(), and at the end of the feed by Drain(), which sends those left.
 * Type T is the product type.
 */
 template<typename T>
@@ -237,7 +331,7 @@ public:
 	~AlgoExecutionService();
 
 	// Get data on our service given a key
-	AlgoExecution<T>& GetData(string _key);
+	AlgoExecution<T>& GetData(const string& _key);
 
 	// The callback that a Connector should invoke for any new or updated data
 	void OnMessage(AlgoExecution<T>& _data);
@@ -251,43 +345,88 @@ public:
 	// Get the algo_ex to market_data listener of the service
 	AlgoExecutionToMarketDataListener<T>* GetListener();
 
+	// Get the conflating listener, an alternative to GetListener() that executes on a worker thread
+	// and only ever acts on the latest book of each product (created on first use)
+	AlgoExecutionConflator<T>* GetConflatingListener();
+
+	// Get the scheduler slicing the orders into child orders (created on first use)
+	SliceScheduler<T>* GetScheduler();
+
+	// Set the timer service the slices are scheduled on, before the scheduler is first used
+	// (by default the service has its own, on the process clock)
+	void SetTimerService(TimerService* _timerService);
+
+	// Get the timer service the slices are scheduled on
+	TimerService* GetTimerService();
+
+	// Send the slices due by the clock of the timer service; returns how many timers ran
+	int Poll();
+
+	// Send the slices left of every parent, each at its due time (at the end of the feed); returns how many timers ran
+	int Drain();
+
+	// Slice the orders of the algo from now on (SliceSchedule::None() to send them whole)
+	void SetSliceSchedule(const SliceSchedule& _schedule);
+
 	// Execute an order on a market
 	void AlgoOrderExecution(OrderBook<T>& _orderBook);
 
+	// Execute an order on a market from the top of its book
+	void AlgoOrderExecution(const TopOfBook<T>& _top);
+
+	// Record an order and notify the listeners
+	void SendOrder(AlgoExecution<T>& _algoOrder);
+
 private:
 	map<string, AlgoExecution<T>> algoExecutions;
 	vector<ServiceListener<AlgoExecution<T>>*> listeners;
 	AlgoExecutionToMarketDataListener<T>* listener;
-	double SPREAD_LIMIT;
+	AlgoExecutionConflator<T>* conflator;
+	SliceScheduler<T>* scheduler;
+	SliceSchedule sliceSchedule;
+	TimerService* timerService;
+	bool ownsTimerService;
+	int SPREAD_LIMIT_TICKS;
 	long executionCount;
 };
 
 // implementation of the algo execution service
-// constructor; set the spread to be 1.0/128.0
+// constructor; set the spread limit to be 1.0/128.0 (2 ticks)
 template<typename T>
 AlgoExecutionService<T>::AlgoExecutionService()
 {
 	algoExecutions = map<string, AlgoExecution<T>>();
 	listeners = vector<ServiceListener<AlgoExecution<T>>*>();
 	listener = new AlgoExecutionToMarketDataListener<T>(this);
-	SPREAD_LIMIT = 1.0 / 128.0;
+	conflator = nullptr;
+	scheduler = nullptr;
+	timerService = nullptr;
+	ownsTimerService = false;
+	SPREAD_LIMIT_TICKS = 2;
 	executionCount = 0;
 }
 
+// the conflator's worker calls back into the service, so it is stopped first
 template<typename T>
-AlgoExecutionService<T>::~AlgoExecutionService() {}
+AlgoExecutionService<T>::~AlgoExecutionService()
+{
+	delete conflator;
+	delete scheduler;
+	if (ownsTimerService) {
+		delete timerService;
+	}
+}
 
 template<typename T>
-AlgoExecution<T>& AlgoExecutionService<T>::GetData(string _id)
+AlgoExecution<T>& AlgoExecutionService<T>::GetData(const string& _id)
 {
-	return algoExecutions[_id];
+	return algoExecutions.at(_id);
 }
 
 template<typename T>
 void AlgoExecutionService<T>::OnMessage(AlgoExecution<T>& _data)
 {
-	string _id = _data.GetExecutionOrder()->GetProduct().GetProductId();
-	algoExecutions[_id] = _data;
+	algoExecutions.insert_or_assign(_data.GetExecutionOrder()->GetProduct().GetProductId(), _data);
 }
 
 template<typename T>
@@ -308,51 +447,119 @@ AlgoExecutionToMarketDataListener<T>* AlgoExecutionService<T>::GetListener()
 	return listener;
 }
 
+template<typename T>
+AlgoExecutionConflator<T>* AlgoExecutionService<T>::GetConflatingListener()
+{
+	if (!conflator) {
+		conflator = new AlgoExecutionConflator<T>(this);
+	}
+	return conflator;
+}
+
+template<typename T>
+SliceScheduler<T>* AlgoExecutionService<T>::GetScheduler()
+{
+	if (!scheduler) {
+		scheduler = new SliceScheduler<T>(this, GetTimerService());
+	}
+	return scheduler;
+}
+
+template<typename T>
+void AlgoExecutionService<T>::SetTimerService(TimerService* _timerService)
+{
+	if (ownsTimerService) {
+		delete timerService;
+	}
+	timerService = _timerService;
+	ownsTimerService = false;
+}
+
+template<typename T>
+TimerService* AlgoExecutionService<T>::GetTimerService()
+{
+	if (!timerService) {
+		timerService = new TimerService();
+		ownsTimerService = true;
+	}
+	return timerService;
+}
+
+template<typename T>
+int AlgoExecutionService<T>::Poll()
+{
+	return GetTimerService()->Poll();
+}
+
+template<typename T>
+int AlgoExecutionService<T>::Drain()
+{
+	return scheduler ? scheduler->Drain() : 0;
+}
+
+template<typename T>
+void AlgoExecutionService<T>::SetSliceSchedule(const SliceSchedule& _schedule)
+{
+	sliceSchedule = _schedule;
+}
+
 // the core function of this class: algo order execution
 // we only to the trade when the spread is within the limit.
 template<typename T>
 void AlgoExecutionService<T>::AlgoOrderExecution(OrderBook<T>& _orderBook)
 {
-	T _product = _orderBook.GetProduct();
-	string _productId = _product.GetProductId();
+	AlgoOrderExecution(MakeTopOfBook(_orderBook));
+}
+
+template<typename T>
+void AlgoExecutionService<T>::AlgoOrderExecution(const TopOfBook<T>& _top)
+{
+	const T& _product = *_top.product;
+	const string& _productId = _product.GetProductId();
 	PricingSide _side;
-	string _orderId = GenerateTradingId();
 	double _price;
 	long _quantity;
 
-	BidOffer currBidOffer = _orderBook.GetBidOffer();
-	Order bid_order = currBidOffer.GetBidOrder();
-	Order offer_order = currBidOffer.GetOfferOrder();
-
-	double bid_price = bid_order.GetPrice();
-	long bid_quantity = bid_order.GetQuantity();
-	double offer_price = offer_order.GetPrice();
-	long offer_quantity = offer_order.GetQuantity();
-
 	// trade only when the spread is within the limit!
-	if (offer_price - bid_price <= SPREAD_LIMIT)
+	if (_top.offerTicks - _top.bidTicks <= SPREAD_LIMIT_TICKS)
 	{
 		// we have: BID comes first then offer
 		if (executionCount % 2) {
-			_price = bid_price;
-			_quantity = bid_quantity;
+			_price = TicksToPrice(_top.bidTicks);
+			_quantity = _top.bidQuantity;
 			_side = BID;
 		}
 		else {
-			_price = offer_price;
-			_quantity = offer_quantity;
+			_price = TicksToPrice(_top.offerTicks);
+			_quantity = _top.offerQuantity;
 			_side = OFFER;
 		}
 		executionCount++;
 
-		AlgoExecution<T> algoOrder(_product, _side, _orderId, MARKET, _price, _quantity, 0, "PARENT_ORDER_ID", false);
-		algoExecutions[_productId] = algoOrder;
-
-		// notify the listners of the execution
-		for (auto& l : listeners)
+		if (sliceSchedule.type == SLICE_NONE)
 		{
-			l->ProcessAdd(algoOrder);
+			AlgoExecution<T> algoOrder(_product, _side, GenerateTradingId(), MARKET, _price, _quantity, 0, "PARENT_ORDER_ID", false);
+			SendOrder(algoOrder);
+			return;
 		}
+
+		// the parent order is sent as its slices; an iceberg parent shows its display quantity only
+		long _visible = sliceSchedule.type == SLICE_ICEBERG ? min(sliceSchedule.display, _quantity) : _quantity;
+		ExecutionOrder<T> _parent(_product, _side, GenerateTradingId(), MARKET, _price, _visible, _quantity - _visible, "", false);
+		Poll();
+		GetScheduler()->Slice(_parent, sliceSchedule);
+	}
+}
+
+template<typename T>
+void AlgoExecutionService<T>::SendOrder(AlgoExecution<T>& _algoOrder)
+{
+	algoExecutions.insert_or_assign(_algoOrder.GetExecutionOrder()->GetProduct().GetProductId(), _algoOrder);
+
+	// notify the listners of the execution
+	for (auto& l : listeners)
+	{
+		l->ProcessAdd(_algoOrder);
 	}
 }
 
@@ -400,4 +607,412 @@ void AlgoExecutionToMarketDataListener<T>::ProcessRemove(OrderBook<T>& _data) {}
 template<typename T>
 void AlgoExecutionToMarketDataListener<T>::ProcessUpdate(OrderBook<T>& _data) {}
 
+/**
+* Conflation stage between market data and algo execution.
+* Every product has one slot holding the top of its latest order book. The feed only overwrites the slot
+* and queues the product if it was not queued already; a worker thread takes the freshest book
+* of each queued product and runs the algo execution on it. A book overwritten before the worker
+* got to it is skipped (and counted), so a slow consumer never falls behind a bursty feed.
+* Everything downstream of the algo execution runs on the worker thread.
+*/
+template<typename T>
+class AlgoExecutionConflator final : public ServiceListener<OrderBook<T>>
+{
+public:
+
+	// ctor, starts the worker
+	AlgoExecutionConflator(AlgoExecutionService<T>* _service);
+
+	// processes what is still queued, then stops the worker
+	~AlgoExecutionConflator();
+
+	// Listener callback to process an add event to the Service
+	void ProcessAdd(OrderBook<T>& _data);
+
+	// Listener callback to process a remove event to the Service
+	void ProcessRemove(OrderBook<T>& _data);
+
+	// Listener callback to process an update event to the Service
+	void ProcessUpdate(OrderBook<T>& _data);
+
+	// Block until every queued book has been executed
+	void Drain();
+
+	// Get the number of books received, executed, and skipped as stale
+	long GetReceivedCount() const;
+	long GetProcessedCount() const;
+	long GetSkippedCount() const;
+
+	// Get the longest time a book waited in its slot before it was executed, in nanoseconds
+	long GetMaxDelay() const;
+
+private:
+
+	// worker loop
+	void Run();
+
+	// latest book of a product, pending until the worker picks it up
+	struct Slot
+	{
+		TopOfBook<T> top;
+		bool pending = false;
+	};
+
+	AlgoExecutionService<T>* service;
+	unordered_map<string, int> slotIds;
+	vector<Slot> slots;
+	deque<int> ready;
+
+	mutable mutex lock;
+	condition_variable wakeUp;
+	condition_variable idle;
+	bool stopping;
+	bool busy;
+	long received;
+	long processed;
+	long skipped;
+	long maxDelay;
+	thread worker;
+};
+
+template<typename T>
+AlgoExecutionConflator<T>::AlgoExecutionConflator(AlgoExecutionService<T>* _service)
+{
+	service = _service;
+	stopping = false;
+	busy = false;
+	received = 0;
+	processed = 0;
+	skipped = 0;
+	maxDelay = 0;
+	worker = thread(&AlgoExecutionConflator<T>::Run, this);
+}
+
+template<typename T>
+AlgoExecutionConflator<T>::~AlgoExecutionConflator()
+{
+	{
+		lock_guard<mutex> _guard(lock);
+		stopping = true;
+	}
+	wakeUp.notify_one();
+	worker.join();
+}
+
+template<typename T>
+void AlgoExecutionConflator<T>::ProcessAdd(OrderBook<T>& _data)
+{
+	// the book is reduced to its top outside the lock
+	int64_t _now = SteadyNanoseconds();
+	TopOfBook<T> _top = MakeTopOfBook(_data, _now);
+	{
+		lock_guard<mutex> _guard(lock);
+		const string& _productId = _data.GetProduct().GetProductId();
+		auto _it = slotIds.find(_productId);
+		if (_it == slotIds.end()) {
+			_it = slotIds.emplace(_productId, (int)slots.size()).first;
+			slots.emplace_back();
+		}
+
+		Slot& _slot = slots[_it->second];
+		_slot.top = _top;
+		received++;
+		if (_slot.pending) {
+			skipped++;		// the previous book was never executed
+			return;
+		}
+		_slot.pending = true;
+		ready.push_back(_it->second);
+	}
+	wakeUp.notify_one();
+}
+
+// do nothing for these methods (not required)
+template<typename T>
+void AlgoExecutionConflator<T>::ProcessRemove(OrderBook<T>& _data) {}
+
+template<typename T>
+void AlgoExecutionConflator<T>::ProcessUpdate(OrderBook<T>& _data) {}
+
+template<typename T>
+void AlgoExecutionConflator<T>::Drain()
+{
+	unique_lock<mutex> _guard(lock);
+	idle.wait(_guard, [this] { return ready.empty() && !busy; });
+}
+
+template<typename T>
+long AlgoExecutionConflator<T>::GetReceivedCount() const
+{
+	lock_guard<mutex> _guard(lock);
+	return received;
+}
+
+template<typename T>
+long AlgoExecutionConflator<T>::GetProcessedCount() const
+{
+	lock_guard<mutex> _guard(lock);
+	return processed;
+}
+
+template<typename T>
+long AlgoExecutionConflator<T>::GetSkippedCount() const
+{
+	lock_guard<mutex> _guard(lock);
+	return skipped;
+}
+
+template<typename T>
+long AlgoExecutionConflator<T>::GetMaxDelay() const
+{
+	lock_guard<mutex> _guard(lock);
+	return maxDelay;
+}
+
+template<typename T>
+void AlgoExecutionConflator<T>::Run()
+{
+	unique_lock<mutex> _guard(lock);
+	while (true)
+	{
+		wakeUp.wait(_guard, [this] { return stopping || !ready.empty(); });
+		if (ready.empty()) {
+			return;		// stopping, and nothing left to execute
+		}
+
+		// take the freshest book out of its slot, then execute without holding the lock
+		Slot& _slot = slots[ready.front()];
+		ready.pop_front();
+		TopOfBook<T> _top = _slot.top;
+		_slot.pending = false;
+		busy = true;
+
+		_guard.unlock();
+		int64_t _now = SteadyNanoseconds();
+		service->AlgoOrderExecution(_top);
+		_guard.lock();
+
+		maxDelay = max(maxDelay, (long)(_now - _top.timestamp));
+
+		busy = false;
+		processed++;
+		if (ready.empty()) {
+			idle.notify_all();
+		}
+	}
+}
+
+/**
+* Scheduler slicing parent orders into child orders over time.
+* The first slice of a parent is sent at once and each next one is scheduled on a timer service, so any
+* number of parents are worked by the thread advancing its time, at O(1) per slice. A TWAP parent
+* is sent in equal slices, an iceberg parent its visible quantity at a time until its hidden quantity
+* is used up. The child orders carry the parent's order id and are sent through the algo execution service.
+* Type T is the product type.
+*/
+template<typename T>
+class SliceScheduler
+{
+public:
+
+	// ctor, with the timer service the slices are scheduled on
+	SliceScheduler(AlgoExecutionService<T>* _service, TimerService* _timerService);
+
+	// Start slicing a parent order at the timer service's time: its first slice is sent at once
+	void Slice(const ExecutionOrder<T>& _parent, const SliceSchedule& _schedule);
+
+	// Stop slicing a parent order; false if it is not being sliced
+	bool Cancel(const TradingId& _parentOrderId);
+
+	// Advance the timer service to the due time of the last slice left, sending every slice in due order;
+	// returns how many timers ran
+	int Drain();
+
+	// Get the number of parent orders being sliced
+	size_t GetActiveCount() const;
+
+	// Get the quantity of the parent orders being sliced not sent yet
+	long GetUnsentQuantity() const;
+
+	// Get the number of child orders sent, and of parent orders completed and cancelled
+	long GetChildCount() const;
+	long GetCompletedCount() const;
+	long GetCancelledCount() const;
+
+private:
+
+	struct Parent
+	{
+		ExecutionOrder<T> order;
+		int64_t interval = 0;
+		long clip = 0;
+		long remaining = 0;
+		int64_t due = 0;
+		TimerId timer = INVALID_TIMER;
+	};
+
+	// send the next slice of a parent, then schedule the one after or retire the parent
+	void SendSlice(uint32_t _index);
+	void Retire(uint32_t _index);
+
+	AlgoExecutionService<T>* service;
+	TimerService* timers;
+	vector<Parent> parents;
+	vector<uint32_t> freeParents;
+	unordered_map<TradingId, uint32_t> active;
+	long childCount;
+	long completedCount;
+	long cancelledCount;
+};
+
+template<typename T>
+SliceScheduler<T>::SliceScheduler(AlgoExecutionService<T>* _service, TimerService* _timerService)
+{
+	service = _service;
+	timers = _timerService;
+	childCount = 0;
+	completedCount = 0;
+	cancelledCount = 0;
+}
+
+template<typename T>
+void SliceScheduler<T>::Slice(const ExecutionOrder<T>& _parent, const SliceSchedule& _schedule)
+{
+	uint32_t _index;
+	if (freeParents.empty()) {
+		_index = (uint32_t)parents.size();
+		parents.emplace_back();
+	}
+	else {
+		_index = freeParents.back();
+		freeParents.pop_back();
+	}
+
+	Parent& _slicing = parents[_index];
+	long _quantity = _parent.GetVisibleQuantity() + _parent.GetHiddenQuantity();
+	_slicing.order = _parent;
+	_slicing.interval = _schedule.interval;
+	_slicing.remaining = _quantity;
+	_slicing.due = timers->GetTime();
+	_slicing.timer = INVALID_TIMER;
+	switch (_schedule.type)
+	{
+	case SLICE_TWAP:
+		_slicing.clip = (_quantity + _schedule.slices - 1) / _schedule.slices;
+		break;
+	case SLICE_ICEBERG:
+		_slicing.clip = _parent.GetVisibleQuantity();
+		break;
+	default:
+		_slicing.clip = _quantity;
+		break;
+	}
+	_slicing.clip = max(_slicing.clip, 1L);
+
+	active.insert_or_assign(_parent.GetOrderId(), _index);
+	SendSlice(_index);
+}
+
+template<typename T>
+bool SliceScheduler<T>::Cancel(const TradingId& _parentOrderId)
+{
+	auto _it = active.find(_parentOrderId);
+	if (_it == active.end()) {
+		return false;
+	}
+	timers->Cancel(parents[_it->second].timer);
+	Retire(_it->second);
+	cancelledCount++;
+	return true;
+}
+
+// the listeners may slice more parents as the slices are sent, hence the loop
+template<typename T>
+int SliceScheduler<T>::Drain()
+{
+	int _fired = 0;
+	while (!active.empty())
+	{
+		int64_t _last = timers->GetTime();
+		for (const auto& [_id, _index] : active)
+		{
+			const Parent& _slicing = parents[_index];
+			long _slices = (_slicing.remaining + _slicing.clip - 1) / _slicing.clip;
+			_last = max(_last, _slicing.due + (_slices - 1) * _slicing.interval);
+		}
+		int _ran = timers->Advance(_last);
+		if (_ran == 0) {
+			break;
+		}
+		_fired += _ran;
+	}
+	return _fired;
+}
+
+template<typename T>
+void SliceScheduler<T>::SendSlice(uint32_t _index)
+{
+	// the listeners may cause more parents to be sliced, which can move the pool
+	long _quantity = min(parents[_index].clip, parents[_index].remaining);
+	const ExecutionOrder<T>& _order = parents[_index].order;
+	AlgoExecution<T> _child(_order.GetProduct(), _order.GetPricingSide(), GenerateTradingId(), _order.GetOrderType(),
+		_order.GetPrice(), _quantity, 0, _order.GetOrderId(), true);
+	parents[_index].remaining -= _quantity;
+	childCount++;
+	service->SendOrder(_child);
+
+	Parent& _slicing = parents[_index];
+	if (_slicing.remaining > 0) {
+		// the next slice is due an interval after this one was, so the schedule does not drift
+		_slicing.due += _slicing.interval;
+		_slicing.timer = timers->ScheduleAt(_slicing.due, [this, _index]() { SendSlice(_index); });
+	}
+	else {
+		Retire(_index);
+		completedCount++;
+	}
+}
+
+template<typename T>
+void SliceScheduler<T>::Retire(uint32_t _index)
+{
+	active.erase(parents[_index].order.GetOrderId());
+	parents[_index].timer = INVALID_TIMER;
+	freeParents.push_back(_index);
+}
+
+template<typename T>
+size_t SliceScheduler<T>::GetActiveCount() const
+{
+	return active.size();
+}
+
+template<typename T>
+long SliceScheduler<T>::GetUnsentQuantity() const
+{
+	long _unsent = 0;
+	for (const auto& [_id, _index] : active) {
+		_unsent += parents[_index].remaining;
+	}
+	return _unsent;
+}
+
+template<typename T>
+long SliceScheduler<T>::GetChildCount() const
+{
+	return childCount;
+}
+
+template<typename T>
+long SliceScheduler<T>::GetCompletedCount() const
+{
+	return completedCount;
+}
+
+template<typename T>
+long SliceScheduler<T>::GetCancelledCount() const
+{
+	return cancelledCount;
+}
+
 #endif //!ALGO_EXECUTION_SERVICE_HPP
@@ -89,6 +89,8 @@ vector<string> PriceStreamOrder::ToStrings() const
 
 /**
  * Price Stream with a two-way market.
+ * The product is held as a handle to its interned copy (see ProductRegistry),
+ * so a price stream is trivially copyable.
  * Type T is the product type.
  */
 template<typename T>
@@ -100,10 +102,14 @@ public:
 	// ctor
 	PriceStream() = default;
 	PriceStream(const T& _product, const PriceStreamOrder& _bidOrder, const PriceStreamOrder& _offerOrder);
+	PriceStream(const T* _product, const PriceStreamOrder& _bidOrder, const PriceStreamOrder& _offerOrder);
 
 	// Get the product
 	const T& GetProduct() const;
 
+	// Get the handle of the (interned) product
+	const T* GetProductHandle() const;
+
 	// Get the bid order
 	const PriceStreamOrder& GetBidOrder() const;
 
@@ -114,7 +120,7 @@ public:
 	vector<string> ToStrings() const;
 
 private:
-	T product;
+	const T* product = ProductRegistry<T>::Default();
 	PriceStreamOrder bidOrder;
 	PriceStreamOrder offerOrder;
 
@@ -122,12 +128,24 @@ private:
 
 template<typename T>
 PriceStream<T>::PriceStream(const T& _product, const PriceStreamOrder& _bidOrder, const PriceStreamOrder& _offerOrder) :
+	PriceStream(ProductRegistry<T>::Intern(_product), _bidOrder, _offerOrder)
+{
+}
+
+template<typename T>
+PriceStream<T>::PriceStream(const T* _product, const PriceStreamOrder& _bidOrder, const PriceStreamOrder& _offerOrder) :
 	product(_product), bidOrder(_bidOrder), offerOrder(_offerOrder)
 {
 }
 
 template<typename T>
 const T& PriceStream<T>::GetProduct() const
+{
+	return *product;
+}
+
+template<typename T>
+const T* PriceStream<T>::GetProductHandle() const
 {
 	return product;
 }
@@ -147,7 +165,7 @@ const PriceStreamOrder& PriceStream<T>::GetOfferOrder() const
 template<typename T>
 vector<string> PriceStream<T>::ToStrings() const
 {
-	string _product = product.GetProductId();
+	string _product = product->GetProductId();
 	vector<string> _bidOrder = bidOrder.ToStrings();
 	vector<string> _offerOrder = offerOrder.ToStrings();
 
@@ -172,25 +190,39 @@ public:
 	// ctor
 	AlgoStream() = default;
 	AlgoStream(const T& _product, const PriceStreamOrder& _bidOrder, const PriceStreamOrder& _offerOrder);
+	AlgoStream(const T* _product, const PriceStreamOrder& _bidOrder, const PriceStreamOrder& _offerOrder);
 
 
 	// Get the price stream
-	PriceStream<T>* GetPriceStream() const;
+	PriceStream<T>* GetPriceStream();
+	const PriceStream<T>* GetPriceStream() const;
 
 private:
-	PriceStream<T>* priceStream;
+	PriceStream<T> priceStream;
 };
 
 template<typename T>
-AlgoStream<T>::AlgoStream(const T& _product, const PriceStreamOrder& _bidOrder, const PriceStreamOrder& _offerOrder)
+AlgoStream<T>::AlgoStream(const T& _product, const PriceStreamOrder& _bidOrder, const PriceStreamOrder& _offerOrder) :
+	priceStream(_product, _bidOrder, _offerOrder)
+{
+}
+
+template<typename T>
+AlgoStream<T>::AlgoStream(const T* _product, const PriceStreamOrder& _bidOrder, const PriceStreamOrder& _offerOrder) :
+	priceStream(_product, _bidOrder, _offerOrder)
+{
+}
+
+template<typename T>
+PriceStream<T>* AlgoStream<T>::GetPriceStream()
 {
-	priceStream = new PriceStream<T>(_product, _bidOrder, _offerOrder);
+	return &priceStream;
 }
 
 template<typename T>
-PriceStream<T>* AlgoStream<T>::GetPriceStream() const
+const PriceStream<T>* AlgoStream<T>::GetPriceStream() const
 {
-	return priceStream;
+	return &priceStream;
 }
 
 // Register the Service Listener on the PricingService
@@ -216,7 +248,7 @@ public:
 	~AlgoStreamingService();
 
 	// Get data on our service given a key
-	AlgoStream<T>& GetData(string _key);
+	AlgoStream<T>& GetData(const string& _key);
 
 	// The callback that a Connector should invoke for any new or updated data
 	void OnMessage(AlgoStream<T>& _data);
@@ -253,16 +285,15 @@ template<typename T>
 AlgoStreamingService<T>::~AlgoStreamingService() {}
 
 template<typename T>
-AlgoStream<T>& AlgoStreamingService<T>::GetData(string _key)
+AlgoStream<T>& AlgoStreamingService<T>::GetData(const string& _key)
 {
-	return algoStreams[_key];
+	return algoStreams.at(_key);
 }
 
 template<typename T>
 void AlgoStreamingService<T>::OnMessage(AlgoStream<T>& _data)
 {
-	string _id = _data.GetPriceStream()->GetProduct().GetProductId();
-	algoStreams[_id] = _data;
+	algoStreams.insert_or_assign(_data.GetPriceStream()->GetProduct().GetProductId(), _data);
 }
 
 template<typename T>
@@ -288,8 +319,8 @@ ServiceListener<Price<T>>* AlgoStreamingService<T>::GetListener()
 template<typename T>
 void AlgoStreamingService<T>::AlgoPublishPrice(Price<T>& _price)
 {
-	T _product = _price.GetProduct();
-	string _productId = _product.GetProductId();
+	const T* _product = _price.GetProductHandle();
+	const string& _productId = _product->GetProductId();
 
 	double midPrice = _price.GetMid();
 	double spread = _price.GetBidOfferSpread();
@@ -302,7 +333,7 @@ void AlgoStreamingService<T>::AlgoPublishPrice(Price<T>& _price)
 	PriceStreamOrder _bidOrder(_bidPrice, _visibleQuantity, _hiddenQuantity, BID);
 	PriceStreamOrder _offerOrder(_offerPrice, _visibleQuantity, _hiddenQuantity, OFFER);
 	AlgoStream<T> _algoStream(_product, _bidOrder, _offerOrder);
-	algoStreams[_productId] = _algoStream;
+	algoStreams.insert_or_assign(_productId, _algoStream);
 
 	for (auto& l : listeners)
 	{
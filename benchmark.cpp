@@ -0,0 +1,1388 @@
+#define _CRT_SECURE_NO_WARNINGS 1
+
+/* Benchmark driver for the hot paths of the trading system.
+* Usage: bts_benchmark [--check] [dataPath], where dataPath holds the recorded inputs (default SampleData).
+* --check runs only the consistency checks (the ctest target). Either way the exit code is 1 if a check failed.
+* Nothing is persisted: the historical and GUI services are left out of the pipelines.
+* Author: Chengxun James Wu
+*/
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <functional>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <unordered_set>
+#include <map>
+#include <cstdio>
+#include <thread>
+#include "soa.hpp"
+#include "products.hpp"
+#include "algoexecutionservice.hpp"
+#include "algostreamingservice.hpp"
+#include "executionservice.hpp"
+#include "inquiryservice.hpp"
+#include "marketdataservice.hpp"
+#include "positionservice.hpp"
+#include "pricingservice.hpp"
+#include "riskservice.hpp"
+#include "streamingservice.hpp"
+#include "tradebookingservice.hpp"
+#include "tradestore.hpp"
+#include "timerwheel.hpp"
+#include "tickladder.hpp"
+#include "utilityfunctions.hpp"
+#include "bondanalytics.hpp"
+#include "riskkernel.hpp"
+
+// sink to keep the optimizer from discarding benchmarked work
+volatile double benchmarkSink = 0.0;
+
+// every heap allocation of the process is counted, to check the allocation-free paths
+// (GCC flags the inlined free() of a replaced operator new as a mismatch, which it is not here)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+atomic<long> allocationCount{ 0 };
+
+void* operator new(size_t _size)
+{
+	allocationCount.fetch_add(1, memory_order_relaxed);
+	if (void* _p = malloc(_size ? _size : 1)) {
+		return _p;
+	}
+	throw bad_alloc();
+}
+
+void operator delete(void* _p) noexcept
+{
+	free(_p);
+}
+
+void operator delete(void* _p, size_t _size) noexcept
+{
+	free(_p);
+}
+
+// consistency checks failed so far, turned into the exit code
+long checkFailures = 0;
+
+// count and report a failed check
+bool Check(bool _ok, const string& _what)
+{
+	if (!_ok) {
+		checkFailures++;
+		std::cout << "CHECK FAILED: " << _what << std::endl;
+	}
+	return _ok;
+}
+
+// report the cost per operation, the throughput and the heap allocations per operation
+void ReportBenchmark(const string& _name, long _ops, double _ns, long _allocations)
+{
+	std::cout << left << setw(56) << _name
+		<< right << setw(12) << fixed << setprecision(1) << _ns / _ops << " ns/op"
+		<< setw(14) << setprecision(0) << _ops / (_ns * 1e-9) << " ops/s"
+		<< setw(10) << setprecision(2) << (double)_allocations / _ops << " allocs/op" << std::endl;
+}
+
+// time _func over _iterations calls, each call counting as _opsPerCall operations
+template<typename F>
+void RunBenchmark(const string& _name, long _iterations, F _func, long _opsPerCall = 1)
+{
+	long _allocations = allocationCount.load();
+	auto _start = chrono::steady_clock::now();
+	for (long i = 0; i < _iterations; i++) {
+		_func(i);
+	}
+	auto _end = chrono::steady_clock::now();
+	ReportBenchmark(_name, _iterations * _opsPerCall, (double)chrono::duration_cast<chrono::nanoseconds>(_end - _start).count(),
+		allocationCount.load() - _allocations);
+}
+
+// replay a recorded input file through a connector, reported per line
+// _finish runs inside the timed section, e.g. to wait for asynchronous stages
+template<typename C>
+void RunReplay(const string& _name, C* _connector, const string& _path, const function<void()>& _finish = nullptr)
+{
+	ifstream _data(_path);
+	if (!_data) {
+		std::cout << _name << ": cannot open " << _path << std::endl;
+		return;
+	}
+	long _lines = 0;
+	string _line;
+	while (getline(_data, _line)) {
+		_lines++;
+	}
+	_data.clear();
+	_data.seekg(0);
+
+	long _allocations = allocationCount.load();
+	auto _start = chrono::steady_clock::now();
+	_connector->Subscribe(_data);
+	if (_finish) {
+		_finish();
+	}
+	auto _end = chrono::steady_clock::now();
+	ReportBenchmark(_name, _lines, (double)chrono::duration_cast<chrono::nanoseconds>(_end - _start).count(),
+		allocationCount.load() - _allocations);
+}
+
+// the utility functions used on every event
+void BenchmarkUtilities()
+{
+	const long N = 1000000;
+	vector<string> _ids;
+	for (const auto& [mat, bond] : bondMap) {
+		_ids.push_back(bond.first);
+	}
+
+	RunBenchmark("StringToPrice", N, [](long i) { benchmarkSink += StringToPrice("100-25+"); });
+	RunBenchmark("PriceToString", N, [](long i) { benchmarkSink += PriceToString(99.0 + (i % 512) / 256.0).size(); });
+	RunBenchmark("GetPV01", N, [&](long i) { benchmarkSink += GetPV01(_ids[i % _ids.size()]); });
+	RunBenchmark("FetchBond", N, [&](long i) { benchmarkSink += FetchBond(_ids[i % _ids.size()]).GetCoupon(); });
+	RunBenchmark("GenerateTradingId", N, [](long i) { benchmarkSink += GenerateTradingId().GetLength(); });
+}
+
+// trades booked through TradeBooking -> Position -> Risk
+void BenchmarkTradeBooking()
+{
+	const long N = 200000;
+	TradeBookingService<Bond> _tradeBookingService;
+	PositionService<Bond> _positionService;
+	RiskService<Bond> _riskService;
+	_tradeBookingService.AddListener(_positionService.GetListener());
+	_positionService.AddListener(_riskService.GetListener());
+
+	// pre-build the trades so that only the booking path is timed
+	vector<Trade<Bond>> _trades;
+	for (long i = 0; i < N; i++) {
+		auto _it = next(bondMap.begin(), i % bondMap.size());
+		_trades.emplace_back(FetchBond(_it->first), GenerateTradingId(), 100.0, bookNames[i % BOOK_COUNT], 1000000 * (i % 5 + 1), (i % 2) ? BUY : SELL);
+	}
+
+	RunBenchmark("TradeBooking -> Position -> Risk", N, [&](long i) { _tradeBookingService.OnMessage(_trades[i]); });
+}
+
+// counts the risk published, standing in for the historical writer
+class RiskCounter : public ServiceListener<PV01<Bond>>
+{
+public:
+	void ProcessAdd(PV01<Bond>& _data) { count++; }
+	void ProcessRemove(PV01<Bond>& _data) {}
+	void ProcessUpdate(PV01<Bond>& _data) {}
+
+	long count = 0;
+};
+
+// bursty execution: runs of 32 trades on one bond, the bonds in turn, through Position -> Risk,
+// publishing every trade against coalescing by batches of 64 trades. Both must end on the same risk.
+void BenchmarkPositionCoalescing()
+{
+	const long N = 200000;
+	const long BURST = 32;
+	vector<Trade<Bond>> _trades;
+	for (long i = 0; i < N; i++) {
+		auto _it = next(bondMap.begin(), (i / BURST) % bondMap.size());
+		_trades.emplace_back(FetchBond(_it->first), "", 100.0, bookNames[i % BOOK_COUNT], 1000000 * (i % 5 + 1), (i % 3) ? BUY : SELL);
+	}
+
+	map<string, long> _quantities[2];
+	for (size_t _batch : { 1, 64 })
+	{
+		PositionService<Bond> _positionService;
+		RiskService<Bond> _riskService;
+		RiskCounter _counter;
+		_positionService.AddListener(_riskService.GetListener());
+		_riskService.AddListener(&_counter);
+		_positionService.SetCoalescing(_batch);
+
+		RunBenchmark("Bursty trades -> Position -> Risk, batch of " + to_string(_batch) + " trades", N, [&](long i) {
+			_positionService.AddTrade(_trades[i]);
+		});
+		_positionService.Flush();
+		for (const auto& [mat, bond] : bondMap) {
+			PV01<Bond> _pv01;
+			if (_riskService.GetSnapshot(bond.first, _pv01)) {
+				_quantities[_batch > 1][bond.first] = _pv01.GetQuantity();
+			}
+		}
+		std::cout << "  " << _positionService.GetTradeCount() << " trades, " << _positionService.GetPublishCount()
+			<< " positions published, " << _counter.count << " PV01 recomputed" << std::endl;
+	}
+	std::cout << "  final risk " << (_quantities[0] == _quantities[1] ? "identical" : "DIFFERENT") << std::endl;
+	Check(_quantities[0] == _quantities[1], "coalesced trades leave the same risk");
+}
+
+// keeps the positions published
+class PositionRecorder : public ServiceListener<Position<Bond>>
+{
+public:
+	void ProcessAdd(Position<Bond>& _data) { positions.push_back(_data); }
+	void ProcessRemove(Position<Bond>& _data) {}
+	void ProcessUpdate(Position<Bond>& _data) {}
+
+	vector<Position<Bond>> positions;
+};
+
+// 48 orders on one bond, buys and sells, each executed in one fill, booked as a batch of 48 trades and
+// coalesced into one position update: the update must move the position by exactly the fills' quantity.
+void CheckCoalescedPositions()
+{
+	const int FILLS = 48;
+	const Bond _bond = FetchBond(5);
+	ExecutionService<Bond> _executionService;
+	TradeBookingService<Bond> _tradeBookingService;
+	PositionService<Bond> _positionService;
+	PositionRecorder _recorder;
+	_executionService.AddFillListener(_tradeBookingService.GetListener());
+	_tradeBookingService.AddListener(_positionService.GetListener());
+	_positionService.AddListener(&_recorder);
+	_tradeBookingService.GetListener()->SetBatch(FILLS);
+	_positionService.SetCoalescing(0);
+
+	long _expected = 0;
+	for (int i = 0; i < FILLS; i++)
+	{
+		long _quantity = (i % 7 + 1) * 1000000;
+		PricingSide _side = i % 3 ? OFFER : BID;
+		_expected += _side == OFFER ? _quantity : -_quantity;
+		ExecutionOrder<Bond> _order(_bond, _side, GenerateTradingId(), MARKET, 100.0, _quantity, 0, "", false);
+		_executionService.ExecuteOrder(_order);
+	}
+	_positionService.Flush();
+
+	long _moved = _recorder.positions.empty() ? 0 : _recorder.positions.back().GetAggregatePosition();
+	bool _ok = _recorder.positions.size() == 1 && _moved == _expected && _positionService.GetTradeCount() == FILLS;
+	std::cout << "Coalesced positions: " << FILLS << " fills, " << _positionService.GetTradeCount() << " trades, "
+		<< _recorder.positions.size() << " update moving the position by " << _moved << " for " << _expected
+		<< (_ok ? " (as expected)" : " (WRONG)") << std::endl;
+	Check(_ok, "coalesced positions");
+}
+
+// a multi-million-trade day through the booking store: bounded retention against the unbounded map
+void BenchmarkTradeStore()
+{
+	const long N = 2000000;
+	const size_t RETAINED = 100000;
+	Trade<Bond> _template(FetchBond(2), "", 100.0, bookNames[0], 1000000, BUY);
+	auto _id = [](long i) {
+		char _chars[TradingId::CAPACITY + 1];
+		snprintf(_chars, sizeof(_chars), "T%015ld", i);
+		return TradingId(_chars);
+	};
+
+	map<TradingId, Trade<Bond>> _map;
+	RunBenchmark("Trade store, std::map (unbounded)", N, [&](long i) {
+		_map.insert_or_assign(_id(i), _template);
+		benchmarkSink += _map.find(_id(i / 2))->second.GetPrice();
+	});
+	_map.clear();
+
+	TradeStore<Trade<Bond>> _store(TradeRetention::Last(RETAINED));
+	long _evicted = 0;
+	RunBenchmark("Trade store, hash + last 100000", N, [&](long i) {
+		_store.InsertOrAssign(_id(i), _template, i);
+		_store.Evict(i, [&](Trade<Bond>& _trade) { _evicted++; });
+		const Trade<Bond>* _trade = _store.Find(_id(i - (long)RETAINED / 2));
+		benchmarkSink += _trade ? _trade->GetPrice() : 0.0;
+	});
+	std::cout << "  held " << _store.GetSize() << " trades in " << _store.GetCapacity() << " slots, evicted " << _evicted << std::endl;
+}
+
+// concurrent position keeping: writer threads book buys on six bonds, one thread replaces the
+// seventh bond's position with equal books, and reader threads check every snapshot they take
+// (books never decrease on the booked bonds, books always equal on the replaced one).
+// The positions are published to RiskService, which must end on the final position of every bond.
+// N trades per writer. The checks run it with fewer trades, so that the tsan preset checks it for races.
+void BenchmarkPositionStress(long N = 250000)
+{
+	const int WRITERS = 4;
+	const int READERS = 2;
+	PositionService<Bond> _positionService;
+	RiskService<Bond> _riskService;
+	RiskCounter _counter;
+	_positionService.AddListener(_riskService.GetListener());
+	_riskService.AddListener(&_counter);
+
+	vector<Bond> _bonds;
+	for (const auto& [mat, bond] : bondMap) {
+		_bonds.push_back(FetchBond(bond.first));
+	}
+	const int BOOKED = (int)_bonds.size() - 1;
+	const Bond& _replaced = _bonds.back();
+	Position<Bond> _initial(_replaced);
+	_positionService.OnMessage(_initial);
+
+	atomic<bool> _done{ false };
+	atomic<long> _snapshots{ 0 }, _violations{ 0 };
+	vector<thread> _readers;
+	for (int r = 0; r < READERS; r++) {
+		_readers.emplace_back([&]() {
+			vector<array<long, BOOK_COUNT>> _last(BOOKED, array<long, BOOK_COUNT>{});
+			Position<Bond> _position;
+			long _count = 0;
+			while (!_done.load(memory_order_relaxed)) {
+				for (int b = 0; b < BOOKED; b++) {
+					if (!_positionService.GetSnapshot(_bonds[b].GetProductId(), _position)) {
+						continue;
+					}
+					for (int k = 0; k < BOOK_COUNT; k++) {
+						if (_position.GetPosition(k) < _last[b][k]) {
+							_violations++;
+						}
+						_last[b][k] = _position.GetPosition(k);
+					}
+					_count++;
+				}
+				_positionService.GetSnapshot(_replaced.GetProductId(), _position);
+				if (_position.GetPosition(0) != _position.GetPosition(1) || _position.GetPosition(1) != _position.GetPosition(2)) {
+					_violations++;
+				}
+				_count++;
+			}
+			_snapshots += _count;
+		});
+	}
+
+	thread _replacer([&]() {
+		array<long, BOOK_COUNT> _books;
+		for (long v = 1; !_done.load(memory_order_relaxed); v++) {
+			_books.fill(v);
+			Position<Bond> _position(_replaced, _books, (1u << BOOK_COUNT) - 1);
+			_positionService.OnMessage(_position);
+		}
+	});
+
+	// pre-built trades, so that only the booking is timed
+	vector<vector<Trade<Bond>>> _trades(WRITERS);
+	for (int w = 0; w < WRITERS; w++) {
+		for (long i = 0; i < N; i++) {
+			_trades[w].emplace_back(_bonds[(i + w) % BOOKED], "", 100.0, bookNames[i % BOOK_COUNT], i % 5 + 1, BUY);
+		}
+	}
+
+	long _allocations = allocationCount.load();
+	auto _start = chrono::steady_clock::now();
+	vector<thread> _writers;
+	for (int w = 0; w < WRITERS; w++) {
+		_writers.emplace_back([&, w]() {
+			for (auto& _trade : _trades[w]) {
+				_positionService.AddTrade(_trade);
+			}
+		});
+	}
+	for (auto& _writer : _writers) {
+		_writer.join();
+	}
+	auto _end = chrono::steady_clock::now();
+	long _writerAllocations = allocationCount.load() - _allocations;
+	_done = true;
+	_replacer.join();
+	for (auto& _reader : _readers) {
+		_reader.join();
+	}
+
+	// every quantity booked must be in the final positions
+	array<long, BOOK_COUNT> _expected{};
+	for (int w = 0; w < WRITERS; w++) {
+		for (auto& _trade : _trades[w]) {
+			_expected[FetchBookId(_trade.GetBook())] += _trade.GetQuantity();
+		}
+	}
+	Position<Bond> _position;
+	PV01<Bond> _pv01;
+	long _stale = 0;
+	for (int b = 0; b < BOOKED; b++) {
+		_positionService.GetSnapshot(_bonds[b].GetProductId(), _position);
+		for (int k = 0; k < BOOK_COUNT; k++) {
+			_expected[k] -= _position.GetPosition(k);
+		}
+		_stale += !_riskService.GetSnapshot(_bonds[b].GetProductId(), _pv01) || _pv01.GetQuantity() != _position.GetAggregatePosition();
+	}
+	bool _balanced = _expected == array<long, BOOK_COUNT>{};
+
+	ReportBenchmark("Position engine, " + to_string(WRITERS) + " writers + " + to_string(READERS + 1) + " readers/replacer",
+		WRITERS * N, (double)chrono::duration_cast<chrono::nanoseconds>(_end - _start).count(), _writerAllocations);
+	std::cout << "  " << _snapshots.load() << " snapshots, " << _positionService.GetEngine().GetRetryCount() << " retries, "
+		<< _violations.load() << " inconsistent, positions " << (_balanced ? "balanced" : "NOT balanced") << std::endl;
+	std::cout << "  " << _positionService.GetPublishCount() << " positions published for " << WRITERS * N << " trades, "
+		<< _counter.count << " risked, " << _stale << " bonds with stale risk" << std::endl;
+	Check(_violations.load() == 0 && _balanced && _stale == 0, "concurrent positions and risk");
+}
+
+// a burst of RFQs posted before the queue is drained, so that they are all open at once,
+// then the recorded inquiries through the service one by one
+void BenchmarkInquiries(const string& _dataPath)
+{
+	const long N = 50000;
+	InquiryService<Bond> _inquiryService;
+	vector<Inquiry<Bond>> _inquiries;
+	for (long i = 0; i < N; i++) {
+		auto _it = next(bondMap.begin(), i % bondMap.size());
+		_inquiries.emplace_back(GenerateTradingId(), FetchBond(_it->first), (i % 2) ? BUY : SELL, 1000000, 100.0, RECEIVED);
+	}
+
+	RunBenchmark("Inquiry burst, RECEIVED -> QUOTED -> DONE", 1, [&](long) {
+		for (auto& _inquiry : _inquiries) {
+			_inquiryService.Post(_inquiry);
+		}
+		_inquiryService.Drain();
+	}, N);
+	std::cout << "  " << _inquiryService.GetMaxOpenCount() << " open at most, " << _inquiryService.GetStateCount(DONE) << " done, "
+		<< _inquiryService.GetTransitionCount() << " transitions, " << _inquiryService.GetInvalidCount() << " refused, "
+		<< _inquiryService.GetSize() << " held" << std::endl;
+	Check(_inquiryService.GetStateCount(DONE) == N && _inquiryService.GetSize() == 0, "inquiries dropped once done");
+
+	InquiryService<Bond> _replayService;
+	RunReplay("inquiries.txt replay", _replayService.GetConnector(), _dataPath + "inquiries.txt");
+	std::cout << "  " << _replayService.GetSize() << " inquiries held after the replay, " << _replayService.GetStateCount(RECEIVED)
+		+ _replayService.GetStateCount(QUOTED) << " open" << std::endl;
+	Check(_replayService.GetSize() == (size_t)(_replayService.GetStateCount(RECEIVED) + _replayService.GetStateCount(QUOTED)),
+		"only the open inquiries held");
+}
+
+// the same burst auto-quoted from the recorded prices. The budget covers the time to quote alone:
+// the wait of each RFQ in the queue behind the earlier ones is reported, but refuses none.
+void BenchmarkAutoQuoter(const string& _dataPath)
+{
+	const long N = 50000;
+	PricingService<Bond> _pricingService;
+	InquiryService<Bond> _inquiryService;
+	AutoQuoter<Bond>* _quoter = _inquiryService.GetQuotingListener();
+	_pricingService.AddListener(_quoter);
+	_quoter->SetBudget(chrono::seconds(1));
+	RunReplay("prices.txt replay (quoter warm-up)", _pricingService.GetConnector(), _dataPath + "prices.txt");
+
+	vector<Inquiry<Bond>> _inquiries;
+	for (long i = 0; i < N; i++) {
+		auto _it = next(bondMap.begin(), i % bondMap.size());
+		_inquiries.emplace_back(GenerateTradingId(), FetchBond(_it->first), (i % 2) ? BUY : SELL, 1000000 * (1 + i % 5), 100.0, RECEIVED);
+	}
+
+	// one at a time, the time to quote is the quoting path alone
+	long _next = 0;
+	RunBenchmark("Auto-quoted inquiry, one at a time", N / 2, [&](long) {
+		_inquiryService.OnMessage(_inquiries[_next++]);
+	});
+	const LatencyStats& _latency = _quoter->GetLatency();
+	std::cout << "  time to quote (ns) mean " << (long)_latency.GetMean() << ", p50 " << _latency.GetPercentile(0.5) << ", p99 "
+		<< _latency.GetPercentile(0.99) << ", max " << _latency.GetMax() << "; " << _quoter->GetQuotedCount() << " quoted, "
+		<< _quoter->GetUnpricedCount() << " unpriced, " << _quoter->GetLateCount() << " late" << std::endl;
+
+	// a burst within the default budget: only an RFQ whose pricing itself overran it would be refused
+	_quoter->SetBudget(chrono::microseconds(250));
+	long _quoted = _quoter->GetQuotedCount();
+	long _late = _quoter->GetLateCount();
+	RunBenchmark("Auto-quoted inquiry burst, 250us budget", 1, [&](long) {
+		for (; _next < N; _next++) {
+			_inquiryService.Post(_inquiries[_next]);
+		}
+		_inquiryService.Drain();
+	}, N / 2);
+	_quoted = _quoter->GetQuotedCount() - _quoted;
+	_late = _quoter->GetLateCount() - _late;
+	const LatencyStats& _queue = _quoter->GetQueueLatency();
+	std::cout << "  " << _quoted << " quoted, " << _late << " late, time to quote p99 " << _latency.GetPercentile(0.99)
+		<< " ns, queue wait p99 " << _queue.GetPercentile(0.99) << " ns, max " << _queue.GetMax() << " ns" << std::endl;
+	Check(_quoted + _late == N / 2 && _late * 100 <= _quoted, "at most 1% of a burst over the quoting budget");
+}
+
+// parent orders of every type split across three venues quoting different prices and sizes;
+// the venues are requoted before each order, so every order sees the same books
+void BenchmarkOrderRouter()
+{
+	const long N = 100000;
+	SmartOrderRouter<Bond> _router;
+	const Bond* _bond = ProductRegistry<Bond>::Intern(FetchBond(2));
+	auto _quote = [&](Market _market, int32_t _bidTicks, int64_t _size) {
+		TopOfBook<Bond> _top{ _bond, 0, _size, _size, _bidTicks, _bidTicks + 2 };
+		_router.UpdateVenue(_market, _top);
+	};
+	const OrderType _types[] = { MARKET, LIMIT, FOK, IOC };
+	vector<ExecutionOrder<Bond>> _parents;
+	for (int i = 0; i < 8; i++) {
+		_parents.emplace_back(*_bond, (i % 2) ? BID : OFFER, GenerateTradingId(), _types[i / 2], (i % 2) ? 99.0 : 99.0 + 2.0 / 256,
+			10000000.0 * (1 + i % 5), 0.0, "", false);
+	}
+
+	vector<ExecutionOrder<Bond>> _children;
+	RunBenchmark("Smart order routing, 3 venues", N, [&](long i) {
+		_quote(BROKERTEC, 99 * 256, 10000000);
+		_quote(ESPEED, 99 * 256 - 1, 20000000);
+		_quote(CME, 99 * 256, 5000000);
+		_router.Route(_parents[i % _parents.size()], _children);
+		benchmarkSink += (double)_children.size();
+	});
+	const LatencyStats& _latency = _router.GetLatency();
+	std::cout << "  routing time (ns) mean " << (long)_latency.GetMean() << ", p99 " << _latency.GetPercentile(0.99) << ", max "
+		<< _latency.GetMax() << "; " << _router.GetChildCount() << " children, " << _router.GetRejectedCount() << " rejected, "
+		<< _router.GetCancelledQuantity() << " cancelled" << std::endl;
+}
+
+// timers from a millisecond to a day ahead on simulated time advanced by random steps, a third of them
+// cancelled; every timer must fire in the first advance reaching its deadline, in deadline order
+void BenchmarkTimerWheel()
+{
+	const long N = 200000;
+	const int64_t MS = 1000000;
+	TimerWheel<long> _wheel(MS);
+	vector<int64_t> _deadlines(N);
+	vector<TimerId> _timers(N);
+	uint64_t _state = 42;
+	for (long i = 0; i < N; i++) {
+		int64_t _range = (i % 10 == 0) ? 86400000 * MS : (i % 3 == 0) ? 60000 * MS : 300 * MS;
+		_deadlines[i] = 1 + (int64_t)(SplitMix64(_state) % (uint64_t)_range);
+	}
+
+	long _next = 0;
+	RunBenchmark("TimerWheel::Schedule", N, [&](long i) { _timers[_next] = _wheel.Schedule(_deadlines[_next], _next); _next++; });
+	RunBenchmark("TimerWheel::Cancel (every third timer)", N / 3, [&](long i) { _wheel.Cancel(_timers[3 * i + 1]); });
+
+	int64_t _previous = 0;
+	int64_t _now = 0;
+	int64_t _last = 0;
+	long _fired = 0;
+	long _early = 0;
+	long _late = 0;
+	long _unordered = 0;
+	auto _check = [&](long& i) {
+		_early += _deadlines[i] > _now;
+		_late += _deadlines[i] <= _previous;
+		_unordered += _deadlines[i] < _last;
+		_last = _deadlines[i];
+		_fired++;
+	};
+	auto _start = chrono::steady_clock::now();
+	while (_wheel.GetSize() > 0)
+	{
+		_previous = _now;
+		_now += 1 + (int64_t)(SplitMix64(_state) % (uint64_t)(_now < 60000 * MS ? 5 * MS : 3600000 * MS));
+		_wheel.Advance(_now, _check);
+	}
+	auto _end = chrono::steady_clock::now();
+	ReportBenchmark("TimerWheel::Advance (per timer fired)", _fired, (double)chrono::duration_cast<chrono::nanoseconds>(_end - _start).count(), 0);
+	std::cout << "  " << _fired << " fired, " << _early << " early, " << _late << " late, " << _unordered << " out of order" << std::endl;
+}
+
+// thousands of parent orders sliced at once on simulated time: TWAP over 10 slices 1ms apart, and
+// icebergs showing a tenth of their size; a tenth of the parents are cancelled half way through
+void BenchmarkSliceScheduler()
+{
+	const long PARENTS = 10000;
+	const int64_t MS = 1000000;
+	SimulatedClock _clock;
+	TimerService _timerService(&_clock);
+	AlgoExecutionService<Bond> _algoExecutionService;
+	_algoExecutionService.SetTimerService(&_timerService);
+	SliceScheduler<Bond>* _scheduler = _algoExecutionService.GetScheduler();
+	vector<ExecutionOrder<Bond>> _parents;
+	for (long i = 0; i < PARENTS; i++) {
+		auto _it = next(bondMap.begin(), i % bondMap.size());
+		_parents.emplace_back(FetchBond(_it->first), (i % 2) ? BID : OFFER, GenerateTradingId(), MARKET, 99.0, 1000000.0, 9000000.0, "", false);
+	}
+
+	int64_t _now = 0;
+	long _sent = 0;
+	auto _start = chrono::steady_clock::now();
+	long _startAllocations = allocationCount.load(memory_order_relaxed);
+	for (long i = 0; i < PARENTS; i++) {
+		_scheduler->Slice(_parents[i], (i % 2) ? SliceSchedule::Twap(10, chrono::milliseconds(1)) : SliceSchedule::Iceberg(1000000, chrono::milliseconds(1)));
+	}
+	size_t _peak = _scheduler->GetActiveCount();
+	for (int t = 1; _scheduler->GetActiveCount() > 0; t++)
+	{
+		_now = t * MS / 4;
+		_clock.Set(_now);
+		_sent += _timerService.Poll();
+		if (t == 20) {
+			for (long i = 0; i < PARENTS; i += 10) {
+				_scheduler->Cancel(_parents[i].GetOrderId());
+			}
+		}
+	}
+	auto _end = chrono::steady_clock::now();
+	ReportBenchmark("Slice scheduler, " + to_string(PARENTS) + " parents (per child order)", _scheduler->GetChildCount(),
+		(double)chrono::duration_cast<chrono::nanoseconds>(_end - _start).count(), allocationCount.load(memory_order_relaxed) - _startAllocations);
+	std::cout << "  " << _peak << " parents at once, " << _sent << " slices fired, " << _scheduler->GetCompletedCount() << " completed, "
+		<< _scheduler->GetCancelledCount() << " cancelled, " << _now / MS << "ms simulated" << std::endl;
+
+	// parents still sliced when the feed ends, with no book left to poll the timers: drained
+	for (long i = 0; i < 100; i++) {
+		_scheduler->Slice(_parents[i], SliceSchedule::Twap(10, chrono::milliseconds(1)));
+	}
+	long _unsent = _scheduler->GetUnsentQuantity();
+	int _drained = _algoExecutionService.Drain();
+	std::cout << "  end of feed: " << _unsent << " sliced quantity unsent, " << _drained << " slices drained, "
+		<< _scheduler->GetUnsentQuantity() << " left unsent" << std::endl;
+	Check(_unsent == 100 * 9000000L && _drained == 900 && _scheduler->GetActiveCount() == 0 && _scheduler->GetUnsentQuantity() == 0,
+		"slices drained at the end of the feed");
+}
+
+// a stream of depth updates on one product: adds and partial cancels on the five ticks either side of
+// a drifting mid, levels left behind by the mid cancelled, and the best bid/offer read after every update.
+// OrderBook keeps the depth as unsorted stacks (one order per price), updated in place and copied into the
+// book's reused buffers as the connector does, then scanned for the best prices; the tick ladder indexes
+// the same depth by tick. Both must give the same tops.
+struct DepthUpdate
+{
+	PricingSide side;
+	int32_t ticks;
+	int64_t quantity;
+	bool add;
+};
+
+// apply a depth update to an order stack, one order per price
+void ApplyToStack(vector<Order>& _stack, const DepthUpdate& _update)
+{
+	double _price = TicksToPrice(_update.ticks);
+	for (size_t i = 0; i < _stack.size(); i++)
+	{
+		if (_stack[i].GetPrice() == _price)
+		{
+			long _quantity = _stack[i].GetQuantity() + (_update.add ? _update.quantity : -min<int64_t>(_update.quantity, _stack[i].GetQuantity()));
+			if (_quantity > 0) {
+				_stack[i] = Order(_price, _quantity, _update.side);
+			}
+			else {
+				_stack[i] = _stack.back();
+				_stack.pop_back();
+			}
+			return;
+		}
+	}
+	if (_update.add) {
+		_stack.emplace_back(_price, _update.quantity, _update.side);
+	}
+}
+
+void BenchmarkTickLadder()
+{
+	const long N = 1000000;
+	const int32_t BAND = 5;
+	const int64_t MILLION = 1000000;
+	const Bond* _bond = ProductRegistry<Bond>::Intern(FetchBond(2));
+
+	// the updates are generated against a model of the depth, so cancels only hit resting quantity
+	// and each side always keeps a level; both books start from the same depth
+	vector<DepthUpdate> _updates;
+	_updates.reserve(N);
+	map<int32_t, int64_t> _levels[2];
+	int32_t _mid = 100 * TICKS_PER_POINT;
+	uint64_t _state = 7;
+	vector<Order> _bidStack;
+	vector<Order> _offerStack;
+	TickLadderBook<Bond> _ladder(_bond, 64);
+	for (int32_t k = 1; k <= BAND; k++)
+	{
+		_levels[BID][_mid - k] = k * MILLION;
+		_levels[OFFER][_mid + k] = k * MILLION;
+		_bidStack.emplace_back(TicksToPrice(_mid - k), k * MILLION, BID);
+		_offerStack.emplace_back(TicksToPrice(_mid + k), k * MILLION, OFFER);
+		_ladder.Add(BID, _mid - k, k * MILLION);
+		_ladder.Add(OFFER, _mid + k, k * MILLION);
+	}
+	while ((long)_updates.size() < N)
+	{
+		uint64_t _random = SplitMix64(_state);
+		if (_random % 64 == 0) {
+			_mid += (int32_t)((_random >> 8) % 3) - 1;
+		}
+		PricingSide _side = ((_random >> 16) & 1) ? BID : OFFER;
+		map<int32_t, int64_t>& _side_levels = _levels[_side];
+		int32_t _near = _side == BID ? _mid - 1 : _mid + 1;
+		int32_t _far = _side == BID ? _mid - 2 * BAND : _mid + 2 * BAND;
+		auto _stale = find_if(_side_levels.begin(), _side_levels.end(), [&](const pair<const int32_t, int64_t>& _level) {
+			return _side == BID ? (_level.first > _near || _level.first < _far) : (_level.first < _near || _level.first > _far);
+		});
+
+		DepthUpdate _update{ _side, 0, 0, true };
+		if (_stale != _side_levels.end() && _side_levels.size() > 1) {
+			_update = { _side, _stale->first, _stale->second, false };
+		}
+		else if (_side_levels.size() > 1 && ((_random >> 24) & 1)) {
+			auto _level = next(_side_levels.begin(), (long)((_random >> 32) % _side_levels.size()));
+			_update = { _side, _level->first, min<int64_t>(_level->second, (int64_t)(1 + (_random >> 40) % 5) * MILLION), false };
+		}
+		else {
+			int32_t _offset = 1 + (int32_t)((_random >> 48) % BAND);
+			_update = { _side, _side == BID ? _mid - _offset : _mid + _offset, (int64_t)(1 + (_random >> 56) % 5) * MILLION, true };
+		}
+		_side_levels[_update.ticks] += _update.add ? _update.quantity : -_update.quantity;
+		if (_side_levels[_update.ticks] == 0) {
+			_side_levels.erase(_update.ticks);
+		}
+		_updates.push_back(_update);
+	}
+
+	vector<Order> _bidBuffer(_bidStack);
+	vector<Order> _offerBuffer(_offerStack);
+	vector<TopOfBook<Bond>> _stackTops(N);
+	RunBenchmark("OrderBook stacks, update + best bid/offer", N, [&](long i) {
+		ApplyToStack(_updates[i].side == BID ? _bidStack : _offerStack, _updates[i]);
+		_bidBuffer.assign(_bidStack.begin(), _bidStack.end());
+		_offerBuffer.assign(_offerStack.begin(), _offerStack.end());
+		OrderBook<Bond> _orderBook(_bond, move(_bidBuffer), move(_offerBuffer));
+		_stackTops[i] = MakeTopOfBook(_orderBook);
+		_orderBook.ReleaseStacks(_bidBuffer, _offerBuffer);
+	});
+
+	vector<TopOfBook<Bond>> _ladderTops(N);
+	RunBenchmark("TickLadderBook, update + best bid/offer", N, [&](long i) {
+		if (_updates[i].add) {
+			_ladder.Add(_updates[i].side, _updates[i].ticks, _updates[i].quantity);
+		}
+		else {
+			_ladder.Cancel(_updates[i].side, _updates[i].ticks, _updates[i].quantity);
+		}
+		_ladderTops[i] = _ladder.GetTopOfBook();
+	});
+
+	long _mismatches = 0;
+	for (long i = 0; i < N; i++) {
+		_mismatches += _stackTops[i].bidTicks != _ladderTops[i].bidTicks || _stackTops[i].offerTicks != _ladderTops[i].offerTicks
+			|| _stackTops[i].bidQuantity != _ladderTops[i].bidQuantity || _stackTops[i].offerQuantity != _ladderTops[i].offerQuantity;
+	}
+	std::cout << "  mid drifted " << _mid - 100 * TICKS_PER_POINT << " ticks, " << _ladder.GetRecenterCount() << " recenters, window "
+		<< _ladder.GetWindow() << " ticks; " << _mismatches << " tops differing" << std::endl;
+	Check(_mismatches == 0, "tick ladder tops");
+
+	// whole books as received from the feed: the ladder is loaded from the stacks before its top is read
+	OrderBook<Bond> _orderBook(_bond, vector<Order>(), vector<Order>());
+	{
+		vector<Order> _bids;
+		vector<Order> _offers;
+		for (int k = 0; k < 5; k++) {
+			_bids.emplace_back(TicksToPrice(_mid - 1 - (k * 3) % 5), (k + 1) * MILLION, BID);
+			_offers.emplace_back(TicksToPrice(_mid + 1 + (k * 3) % 5), (k + 1) * MILLION, OFFER);
+		}
+		_orderBook = OrderBook<Bond>(_bond, move(_bids), move(_offers));
+	}
+	RunBenchmark("OrderBook::GetBidOffer, 5x5 book", N, [&](long i) { benchmarkSink += _orderBook.GetBidOffer().GetBidOrder().GetPrice(); });
+	RunBenchmark("TickLadderBook::Load + GetBidOffer, 5x5 book", N, [&](long i) {
+		_ladder.Load(_orderBook);
+		benchmarkSink += _ladder.GetBidOffer().GetBidOrder().GetPrice();
+	});
+}
+
+// order flow on three bonds: limit orders around a slowly moving mid (a fifth of them marketable, some
+// with hidden quantity), market, IOC, FOK and stop orders
+vector<ExecutionOrder<Bond>> MakeOrderFlow(long _count)
+{
+	const long MILLION = 1000000;
+	const Bond _bonds[3] = { FetchBond(2), FetchBond(5), FetchBond(10) };
+	vector<ExecutionOrder<Bond>> _orders;
+	_orders.reserve(_count);
+	uint64_t _state = 11;
+	int32_t _mid = 100 * TICKS_PER_POINT;
+	for (long i = 0; i < _count; i++)
+	{
+		uint64_t _random = SplitMix64(_state);
+		if (_random % 32 == 0) {
+			_mid += (int32_t)((_random >> 8) % 3) - 1;
+		}
+		int _roll = (int)((_random >> 16) % 100);
+		OrderType _type = _roll < 70 ? LIMIT : _roll < 80 ? MARKET : _roll < 88 ? IOC : _roll < 94 ? FOK : STOP;
+		bool _buy = (_random >> 24) & 1;
+		int32_t _offset = 1 + (int32_t)((_random >> 32) % 5);
+		// passive limits sit behind the mid, the others reach through it; stops are set beyond it
+		bool _passive = _type == LIMIT && (_random >> 40) % 5 != 0;
+		int32_t _ticks = _passive ? (_buy ? _mid - _offset : _mid + _offset) : (_buy ? _mid + _offset - 3 : _mid - _offset + 3);
+		if (_type == STOP) {
+			_ticks = _buy ? _mid + _offset : _mid - _offset;
+		}
+		long _visible = (long)(1 + (_random >> 48) % 5) * MILLION;
+		long _hidden = (_type == LIMIT && (_random >> 56) % 10 == 0) ? 4 * _visible : 0;
+		_orders.emplace_back(_bonds[i % 3], _buy ? OFFER : BID, GenerateTradingId(), _type, TicksToPrice(_ticks), _visible, _hidden, "", false);
+	}
+	return _orders;
+}
+
+// an IOC buy of 12 @ 100 against 10 @ 100 and 5 @ 100.5 on the offer, with a buy stop of 20 @ 100 waiting
+// and a passive buy resting: the IOC cancels 2, its trade triggers the stop, which takes the 5 and cancels
+// 15, then the resting buy is cancelled. The engine must report each of the three cancels.
+void CheckMatchingCancels()
+{
+	const Bond _bond = FetchBond(2);
+	auto _order = [&](PricingSide _side, const string& _id, OrderType _type, double _price, long _quantity) {
+		return ExecutionOrder<Bond>(_bond, _side, _id, _type, _price, _quantity, 0, "", false);
+	};
+	MatchingEngine<Bond> _engine;
+	map<string, long> _cancelled;
+	auto _cancel = [&](const MatchedOrder& _matched, long _quantity) { _cancelled[_matched.orderId.ToString()] += _quantity; };
+	auto _ignore = [](const Match&) {};
+
+	_engine.Submit(_order(BID, "ASK1", LIMIT, 100.0, 10), _ignore, _cancel);
+	_engine.Submit(_order(BID, "ASK2", LIMIT, 100.5, 5), _ignore, _cancel);
+	_engine.Submit(_order(OFFER, "STOP", STOP, 100.0, 20), _ignore, _cancel);
+	OrderHandle _resting = _engine.Submit(_order(OFFER, "REST", LIMIT, 99.0, 7), _ignore, _cancel);
+	_engine.Submit(_order(OFFER, "IOC", IOC, 100.0, 12), _ignore, _cancel);
+	_engine.Cancel(_resting, _cancel);
+
+	bool _ok = _cancelled == map<string, long>{ { "IOC", 2 }, { "STOP", 15 }, { "REST", 7 } } && _engine.GetCancelledQuantity() == 24
+		&& _engine.GetRestingCount() + _engine.GetStopCount() == 0;
+	std::cout << "Matching engine cancels: IOC " << _cancelled["IOC"] << ", stop " << _cancelled["STOP"] << ", resting "
+		<< _cancelled["REST"] << " cancelled " << (_ok ? "(as expected)" : "(WRONG)") << std::endl;
+	Check(_ok, "matching engine cancels");
+}
+
+// the order flow through the matching engine, with random cancels keeping at most 20000 orders on the books.
+// Once everything left is cancelled, every quantity submitted must have been matched (twice: once per side),
+// cancelled or rejected, and reported so; and no book may ever be crossed.
+void BenchmarkMatchingEngine()
+{
+	const long N = 2000000;
+	const long TEMPLATES = 1 << 16;
+	const size_t RESTING = 20000;
+	vector<ExecutionOrder<Bond>> _orders = MakeOrderFlow(TEMPLATES);
+	uint64_t _state = 13;
+
+	MatchingEngine<Bond> _engine;
+	vector<OrderHandle> _handles;
+	_handles.reserve(RESTING + 1);
+	long _submitted = 0;
+	long _rejected = 0;
+	long _matched = 0;
+	long _ended = 0;
+	auto _cancelled = [&](const MatchedOrder&, long _quantity) { _ended += _quantity; };
+	auto _cancelOne = [&](uint64_t _random) {
+		size_t _index = (size_t)(_random % _handles.size());
+		_engine.Cancel(_handles[_index], _cancelled);
+		_handles[_index] = _handles.back();
+		_handles.pop_back();
+	};
+	RunBenchmark("MatchingEngine::Submit, 3 books", N, [&](long i) {
+		const ExecutionOrder<Bond>& _order = _orders[i & (TEMPLATES - 1)];
+		long _quantity = _order.GetVisibleQuantity() + _order.GetHiddenQuantity();
+		long _rejectedBefore = _engine.GetRejectedCount();
+		OrderHandle _handle = _engine.Submit(_order, [&](const Match& _match) { _matched += _match.quantity; }, _cancelled);
+		_submitted += _quantity;
+		_rejected += _engine.GetRejectedCount() != _rejectedBefore ? _quantity : 0;
+		if (_handle != INVALID_ORDER) {
+			_handles.push_back(_handle);
+		}
+		if (_handles.size() > RESTING) {
+			_cancelOne(SplitMix64(_state));
+		}
+	});
+	std::cout << "  " << _engine.GetMatchCount() << " matches, " << _engine.GetRejectedCount() << " FOK rejected, "
+		<< _engine.GetTriggeredCount() << " stops triggered, " << _engine.GetRestingCount() << " resting and "
+		<< _engine.GetStopCount() << " stops waiting" << std::endl;
+
+	while (!_handles.empty()) {
+		_cancelOne(0);
+	}
+	long _unaccounted = _submitted - 2 * _engine.GetMatchedQuantity() - _engine.GetCancelledQuantity() - _rejected;
+	std::cout << "  after cancelling the rest: " << _engine.GetRestingCount() + _engine.GetStopCount() << " orders left, "
+		<< _unaccounted << " quantity unaccounted for, " << _matched - _engine.GetMatchedQuantity() << " matched and "
+		<< _engine.GetCancelledQuantity() + _rejected - _ended << " cancelled quantity unreported" << std::endl;
+	Check(_engine.GetRestingCount() + _engine.GetStopCount() == 0 && _unaccounted == 0 && _matched == _engine.GetMatchedQuantity()
+		&& _engine.GetCancelledQuantity() + _rejected == _ended, "matching engine quantities");
+
+	// the same flow again, checking the books after every order
+	MatchingEngine<Bond> _checked;
+	long _crossed = 0;
+	for (long i = 0; i < TEMPLATES; i++)
+	{
+		const ExecutionOrder<Bond>& _order = _orders[i];
+		_checked.Submit(_order, [](const Match&) {});
+		int32_t _bid;
+		int32_t _offer;
+		long _size;
+		const string& _productId = _order.GetProduct().GetProductId();
+		_crossed += _checked.GetBestBid(_productId, _bid, _size) && _checked.GetBestOffer(_productId, _offer, _size) && _bid >= _offer;
+	}
+	std::cout << "  " << _crossed << " crossed books in " << TEMPLATES << " orders" << std::endl;
+	Check(_crossed == 0, "matching engine books uncrossed");
+}
+
+// keeps the last fill of each order
+class FillRecorder : public ServiceListener<Fill<Bond>>
+{
+public:
+	void ProcessAdd(Fill<Bond>& _data) { last.insert_or_assign(_data.GetOrderId().ToString(), _data); }
+	void ProcessRemove(Fill<Bond>& _data) {}
+	void ProcessUpdate(Fill<Bond>& _data) {}
+
+	map<string, Fill<Bond>> last;
+};
+
+// the orders of CheckMatchingCancels through the execution service: every order must end with a fill
+// leaving nothing, the IOC and the stop with their cancelled remainders, the resting buy once cancelled;
+// then neither the service nor the booking listener may hold an order open.
+void CheckFillLifecycle()
+{
+	const Bond _bond = FetchBond(2);
+	auto _order = [&](PricingSide _side, const string& _id, OrderType _type, double _price, long _quantity) {
+		return ExecutionOrder<Bond>(_bond, _side, _id, _type, _price, _quantity, 0, "", false);
+	};
+	ExecutionService<Bond> _executionService;
+	TradeBookingService<Bond> _tradeBookingService;
+	FillRecorder _recorder;
+	_executionService.SetMatching(true);
+	_executionService.AddFillListener(&_recorder);
+	_executionService.AddFillListener(_tradeBookingService.GetListener());
+
+	vector<ExecutionOrder<Bond>> _orders{ _order(BID, "ASK1", LIMIT, 100.0, 10), _order(BID, "ASK2", LIMIT, 100.5, 5),
+		_order(OFFER, "STOP", STOP, 100.0, 20), _order(OFFER, "REST", LIMIT, 99.0, 7), _order(OFFER, "IOC", IOC, 100.0, 12) };
+	for (auto& _o : _orders) {
+		_executionService.ExecuteOrder(_o);
+	}
+	bool _cancelled = _executionService.CancelOrder(TradingId("REST"));
+
+	map<string, long> _cumulative{ { "ASK1", 10 }, { "ASK2", 5 }, { "STOP", 5 }, { "REST", 0 }, { "IOC", 10 } };
+	long _wrong = !_cancelled;
+	for (const auto& [_id, _quantity] : _cumulative) {
+		auto _it = _recorder.last.find(_id);
+		_wrong += _it == _recorder.last.end() || _it->second.GetLeavesQuantity() != 0 || _it->second.GetCumulativeQuantity() != _quantity;
+	}
+	size_t _open = _executionService.GetOpenOrderCount() + _tradeBookingService.GetListener()->GetOpenOrderCount();
+	std::cout << "Fill lifecycle: " << _wrong << " orders not ended as expected, " << _open << " orders left open" << std::endl;
+	Check(_wrong == 0 && _open == 0, "fill lifecycle");
+}
+
+// parent orders through the router, with 15 offered on two venues: the FOK for 20 is rejected and the
+// IOC for 20 leaves 5 no venue takes. Both parents must end with a fill leaving nothing.
+void CheckRoutedFills()
+{
+	const Bond _bond = FetchBond(2);
+	const Bond* _handle = ProductRegistry<Bond>::Intern(_bond);
+	ExecutionService<Bond> _executionService;
+	TradeBookingService<Bond> _tradeBookingService;
+	FillRecorder _recorder;
+	_executionService.AddFillListener(&_recorder);
+	_executionService.AddFillListener(_tradeBookingService.GetListener());
+	_executionService.GetRouter().UpdateVenue(BROKERTEC, TopOfBook<Bond>{ _handle, 0, 0, 10, 0, 100 * 256 });
+	_executionService.GetRouter().UpdateVenue(ESPEED, TopOfBook<Bond>{ _handle, 0, 0, 5, 0, 100 * 256 });
+
+	ExecutionOrder<Bond> _fok(_bond, OFFER, "FOK", FOK, 100.0, 20, 0, "", false);
+	ExecutionOrder<Bond> _ioc(_bond, OFFER, "IOC", IOC, 100.0, 20, 0, "", false);
+	_executionService.ExecuteOrder(_fok);
+	_executionService.ExecuteOrder(_ioc);
+
+	auto _ended = [&](const string& _id, long _cumulative) {
+		auto _it = _recorder.last.find(_id);
+		return _it != _recorder.last.end() && _it->second.GetLeavesQuantity() == 0 && _it->second.GetCumulativeQuantity() == _cumulative;
+	};
+	bool _fokEnded = _ended("FOK", 0);
+	bool _iocEnded = _ended("IOC", 15);
+	size_t _open = _tradeBookingService.GetListener()->GetOpenOrderCount();
+	std::cout << "Routed fills: FOK parent " << (_fokEnded ? "rejected" : "NOT ended") << ", IOC parent "
+		<< (_iocEnded ? "ended at 15" : "NOT ended") << ", " << _open << " orders left open" << std::endl;
+	Check(_fokEnded, "rejected FOK parent filled");
+	Check(_iocEnded && _open == 0, "IOC parent remainder filled");
+}
+
+// the order flow matched through Execution -> TradeBooking -> Position -> Risk: a trade booked for every
+// fill, against the fills of each order aggregated and booked every 64 fills. Every order must be closed
+// once those left on the books are cancelled.
+void BenchmarkFillBooking()
+{
+	const long N = 200000;
+	vector<ExecutionOrder<Bond>> _orders = MakeOrderFlow(N);
+	for (size_t _batch : { 1, 64 })
+	{
+		ExecutionService<Bond> _executionService;
+		TradeBookingService<Bond> _tradeBookingService(TradeRetention::Last(100000));
+		PositionService<Bond> _positionService;
+		RiskService<Bond> _riskService;
+		_executionService.SetMatching(true);
+		_executionService.AddFillListener(_tradeBookingService.GetListener());
+		_tradeBookingService.AddListener(_positionService.GetListener());
+		_positionService.AddListener(_riskService.GetListener());
+		TradeBookingToExecutionListener<Bond>* _booking = _tradeBookingService.GetListener();
+		_booking->SetBatch(_batch);
+
+		RunBenchmark("Matched orders -> TradeBooking, batch of " + to_string(_batch) + " fills", N, [&](long i) {
+			_executionService.ExecuteOrder(_orders[i]);
+		});
+		_booking->Flush();
+		std::cout << "  " << _booking->GetFillCount() << " fills booked as " << _booking->GetTradeCount() << " trades, "
+			<< _executionService.GetOpenOrderCount() << " orders left on the books";
+		for (auto& _order : _orders) {
+			_executionService.CancelOrder(_order.GetOrderId());
+		}
+		_booking->Flush();
+		std::cout << ", " << _booking->GetOpenOrderCount() << " open once they are cancelled" << std::endl;
+		Check(_booking->GetOpenOrderCount() == 0 && _executionService.GetOpenOrderCount() == 0, "orders closed once cancelled");
+	}
+}
+
+// recorded market data through MarketData -> AlgoExecution -> Execution -> TradeBooking -> Position -> Risk
+void BenchmarkMarketData(const string& _dataPath)
+{
+	MarketDataService<Bond> _marketDataService;
+	AlgoExecutionService<Bond> _algoExecutionService;
+	ExecutionService<Bond> _executionService;
+	TradeBookingService<Bond> _tradeBookingService;
+	PositionService<Bond> _positionService;
+	RiskService<Bond> _riskService;
+	_marketDataService.AddListener(_algoExecutionService.GetListener());
+	_algoExecutionService.AddListener(_executionService.GetListener());
+	_executionService.AddFillListener(_tradeBookingService.GetListener());
+	_tradeBookingService.AddListener(_positionService.GetListener());
+	_positionService.AddListener(_riskService.GetListener());
+
+	RunReplay("marketdata.txt replay", _marketDataService.GetConnector(), _dataPath + "marketdata.txt");
+}
+
+// counts the allocations made between two published books, charging them to the second book.
+// Books of a product seen before are the steady state; the first book of a product is warm-up.
+class AllocationProbe : public ServiceListener<OrderBook<Bond>>
+{
+public:
+	void ProcessAdd(OrderBook<Bond>& _data)
+	{
+		long _allocations = allocationCount.load(memory_order_relaxed) - lastCount;
+		const string& _productId = _data.GetProduct().GetProductId();
+		if (products.count(_productId)) {
+			steadyBooks++;
+			steadyAllocations += _allocations;
+		}
+		else {
+			products.insert(_productId);
+			warmupAllocations += _allocations;
+		}
+		lastCount = allocationCount.load(memory_order_relaxed);
+	}
+	void ProcessRemove(OrderBook<Bond>& _data) {}
+	void ProcessUpdate(OrderBook<Bond>& _data) {}
+
+	unordered_set<string> products;
+	long lastCount = 0;
+	long steadyBooks = 0;
+	long steadyAllocations = 0;
+	long warmupAllocations = 0;
+};
+
+// heap allocations of the market data connector while it parses, builds and publishes books
+void BenchmarkMarketDataAllocations(const string& _dataPath)
+{
+	MarketDataService<Bond> _marketDataService;
+	AllocationProbe _probe;
+	_marketDataService.AddListener(&_probe);
+
+	_probe.lastCount = allocationCount.load();
+	RunReplay("marketdata.txt replay, book construction only", _marketDataService.GetConnector(), _dataPath + "marketdata.txt");
+	std::cout << "  allocations: " << _probe.warmupAllocations << " for the first book of " << _probe.products.size() << " products, "
+		<< _probe.steadyAllocations << " for the other " << _probe.steadyBooks << " books" << std::endl;
+	Check(_probe.steadyBooks > 0 && _probe.steadyAllocations == 0, "no allocation once every product has a book");
+}
+
+// the same pipeline with the conflation stage in front of AlgoExecution.
+// The whole file is one burst: the feed never waits for the executions, which only see the latest books.
+void BenchmarkMarketDataConflated(const string& _dataPath)
+{
+	MarketDataService<Bond> _marketDataService;
+	AlgoExecutionService<Bond> _algoExecutionService;
+	ExecutionService<Bond> _executionService;
+	TradeBookingService<Bond> _tradeBookingService;
+	PositionService<Bond> _positionService;
+	RiskService<Bond> _riskService;
+	AlgoExecutionConflator<Bond>* _conflator = _algoExecutionService.GetConflatingListener();
+	_marketDataService.AddListener(_conflator);
+	_algoExecutionService.AddListener(_executionService.GetListener());
+	_executionService.AddFillListener(_tradeBookingService.GetListener());
+	_tradeBookingService.AddListener(_positionService.GetListener());
+	_positionService.AddListener(_riskService.GetListener());
+
+	RunReplay("marketdata.txt replay, conflated", _marketDataService.GetConnector(), _dataPath + "marketdata.txt",
+		[&]() { _conflator->Drain(); });
+	std::cout << "  books received " << _conflator->GetReceivedCount() << ", executed " << _conflator->GetProcessedCount()
+		<< ", skipped as stale " << _conflator->GetSkippedCount() << ", max delay " << _conflator->GetMaxDelay() / 1000 << " us" << std::endl;
+}
+
+// recorded prices through Pricing -> AlgoStreaming -> Streaming
+void BenchmarkPricing(const string& _dataPath)
+{
+	PricingService<Bond> _pricingService;
+	AlgoStreamingService<Bond> _algoStreamingService;
+	StreamingService<Bond> _streamingService;
+	_pricingService.AddListener(_algoStreamingService.GetListener());
+	_algoStreamingService.AddListener(_streamingService.GetListener());
+
+	RunReplay("prices.txt replay", _pricingService.GetConnector(), _dataPath + "prices.txt");
+	std::cout << "  event sizes: Price " << sizeof(Price<Bond>) << ", PriceStream " << sizeof(PriceStream<Bond>)
+		<< ", TopOfBook " << sizeof(TopOfBook<Bond>) << " bytes" << std::endl;
+}
+
+// lock-free reads of the latest prices and tops of book, alone and while the replays run
+// 20000 keys added by two writer threads to a table sized for 64, while a reader thread reads back the
+// keys already written: each must be found with its own value while the index grows under the reader.
+// Run it from the tsan build to check the growth for races.
+void BenchmarkSnapshotGrowth()
+{
+	const int WRITERS = 2;
+	const long N = 10000;
+	SnapshotTable<long> _table;
+	vector<string> _keys;
+	for (long i = 0; i < WRITERS * N; i++) {
+		_keys.push_back("K" + to_string(i));
+	}
+
+	atomic<long> _written[WRITERS] = {};
+	atomic<bool> _done{ false };
+	atomic<long> _reads{ 0 }, _violations{ 0 };
+	thread _reader([&]() {
+		long _count = 0;
+		long _value;
+		while (!_done.load(memory_order_relaxed)) {
+			for (int w = 0; w < WRITERS; w++) {
+				long _n = _written[w].load(memory_order_acquire);
+				if (_n == 0) {
+					continue;
+				}
+				long _index = w * N + _count % _n;
+				if (!_table.Read(_keys[_index], _value) || _value != _index) {
+					_violations++;
+				}
+				_reads.store(++_count, memory_order_relaxed);
+			}
+		}
+	});
+
+	long _allocations = allocationCount.load();
+	auto _start = chrono::steady_clock::now();
+	vector<thread> _writers;
+	for (int w = 0; w < WRITERS; w++) {
+		_writers.emplace_back([&, w]() {
+			for (long i = 0; i < N; i++) {
+				_table.Publish(_keys[w * N + i], w * N + i);
+				_written[w].store(i + 1, memory_order_release);
+			}
+		});
+	}
+	for (auto& _writer : _writers) {
+		_writer.join();
+	}
+	auto _end = chrono::steady_clock::now();
+	long _writerAllocations = allocationCount.load() - _allocations;
+	// the reader may not have run yet on a single core
+	while (_reads.load(memory_order_relaxed) < N) {
+		this_thread::yield();
+	}
+	_done = true;
+	_reader.join();
+	long _value;
+	for (long i = 0; i < WRITERS * N; i++) {
+		_violations += !_table.Read(_keys[i], _value) || _value != i;
+	}
+
+	ReportBenchmark("SnapshotTable, new keys from 2 writers + 1 reader", WRITERS * N,
+		(double)chrono::duration_cast<chrono::nanoseconds>(_end - _start).count(), _writerAllocations);
+	std::cout << "  " << _table.GetSize() << " keys in a table sized for 64, " << _reads.load() << " reads, "
+		<< _violations.load() << " missing or wrong" << std::endl;
+	Check(_violations.load() == 0, "snapshot table growth");
+}
+
+void BenchmarkSnapshots(const string& _dataPath)
+{
+	PricingService<Bond> _pricingService;
+	MarketDataService<Bond> _marketDataService;
+	vector<string> _ids;
+	for (const auto& [mat, bond] : bondMap) {
+		_ids.push_back(bond.first);
+	}
+
+	// a reader thread polling every product; a snapshot must name the product it was asked for
+	atomic<bool> _done{ false };
+	atomic<long> _reads{ 0 }, _violations{ 0 };
+	thread _reader([&]() {
+		Price<Bond> _price;
+		TopOfBook<Bond> _top;
+		long _count = 0;
+		while (!_done.load(memory_order_relaxed)) {
+			for (auto& _id : _ids) {
+				if (_pricingService.GetSnapshot(_id, _price) && _price.GetProduct().GetProductId() != _id) {
+					_violations++;
+				}
+				if (_marketDataService.GetSnapshot(_id, _top) && (_top.product->GetProductId() != _id || _top.bidTicks > _top.offerTicks)) {
+					_violations++;
+				}
+				_count += 2;
+			}
+		}
+		_reads += _count;
+	});
+	RunReplay("prices.txt replay, with a snapshot reader", _pricingService.GetConnector(), _dataPath + "prices.txt");
+	RunReplay("marketdata.txt replay, with a snapshot reader", _marketDataService.GetConnector(), _dataPath + "marketdata.txt");
+	_done = true;
+	_reader.join();
+	std::cout << "  " << _reads.load() << " snapshots read, " << _violations.load() << " inconsistent" << std::endl;
+	Check(_violations.load() == 0, "snapshots consistent");
+
+	const long N = 1000000;
+	Price<Bond> _price;
+	TopOfBook<Bond> _top;
+	RunBenchmark("PricingService::GetSnapshot", N, [&](long i) {
+		_pricingService.GetSnapshot(_ids[i % _ids.size()], _price);
+		benchmarkSink += _price.GetMid();
+	});
+	RunBenchmark("MarketDataService::GetSnapshot", N, [&](long i) {
+		_marketDataService.GetSnapshot(_ids[i % _ids.size()], _top);
+		benchmarkSink += _top.bidTicks;
+	});
+}
+
+// a position held, then price moves: each must re-risk the product, its bucket and the portfolio.
+// Once the settlement date is past its maturity, the bond has no risk.
+void CheckRiskOnPriceMoves()
+{
+	const Bond _bond = FetchBond(2);
+	RiskService<Bond> _riskService;
+	_riskService.GetRiskEngine().SetSettlementDate(date(2022, Dec, 23));
+	BucketedSector<Bond> _sector({ _bond }, "Sector");
+	_riskService.AddBucketedSector(_sector);
+	Position<Bond> _position(_bond, array<long, BOOK_COUNT>{ 1000000, 2000000, -500000 }, (1u << BOOK_COUNT) - 1);
+	_riskService.AddPosition(_position);
+
+	long _stale = 0;
+	BondRiskEngine& _engine = _riskService.GetRiskEngine();
+	for (double _mid : { 99.0, 100.5, 98.25 })
+	{
+		_riskService.UpdatePrice(Price<Bond>(_bond, _mid, 1.0 / 128));
+		double _pv01 = _engine.GetPV01(_engine.GetIndex(_bond.GetProductId()));
+		double _risk = _pv01 * _position.GetAggregatePosition();
+		_stale += _riskService.GetData(_bond.GetProductId()).GetPV01() != _pv01
+			|| abs(_riskService.GetBucketedRisk(_sector).GetPV01() - _risk) > 1e-9 * abs(_risk)
+			|| abs(_riskService.GetPortfolioRisk().total - _risk) > 1e-9 * abs(_risk);
+	}
+
+	_engine.SetSettlementDate(_bond.GetMaturityDate() + days(1));
+	_riskService.UpdatePrice(Price<Bond>(_bond, 100.0, 1.0 / 128));
+	double _matured = _riskService.GetData(_bond.GetProductId()).GetPV01();
+	std::cout << "Risk on price moves: " << _stale << " of 3 moves with stale risk, PV01 " << _matured << " once matured" << std::endl;
+	Check(_stale == 0, "price moves re-risk the positions held");
+	Check(_matured == 0.0 && abs(_riskService.GetBucketedRisk(_sector).GetPV01()) < 1e-6, "no risk once matured");
+}
+
+// analytic re-risking of a large synthetic universe of bonds after a market-wide price move
+void BenchmarkRiskEngine()
+{
+	const int BONDS = 10000;
+	const int ROUNDS = 20;
+	date _settlement(2022, Dec, 19);
+	BondRiskEngine _engine(_settlement);
+	for (int i = 0; i < BONDS; i++) {
+		double _coupon = 0.01 + 0.001 * (i % 50);
+		date _maturity = _settlement + months(6 + i % 354);
+		_engine.AddBond(Bond("BOND" + to_string(i), CUSIP, "T", _coupon, _maturity));
+	}
+
+	// every round moves all prices, then re-risks the whole universe in one batch
+	RunBenchmark("BondRiskEngine::Rerisk (per bond)", ROUNDS, [&](long r) {
+		for (int i = 0; i < BONDS; i++) {
+			_engine.SetPrice(i, 95.0 + 0.01 * ((r + i) % 1000));
+		}
+		benchmarkSink += _engine.Rerisk();
+	}, BONDS);
+	benchmarkSink += _engine.GetPV01(0);
+}
+
+// portfolio, per-book and per-bucket DV01 over growing universes, vector kernel against the scalar fallback,
+// which must give the same risk up to rounding
+void BenchmarkPortfolioRisk()
+{
+	const int ROUNDS = 200;
+	for (int _size : { 1000, 10000, 100000 })
+	{
+		PortfolioRiskStore _store;
+		for (int b = 0; b < 3; b++) {
+			_store.AddBucket();
+		}
+		double _gross = 0.0;
+		for (int i = 0; i < _size; i++) {
+			int _index = _store.AddProduct("BOND" + to_string(i));
+			double _pv01 = 0.01 + 0.0001 * (i % 2000);
+			_store.SetPV01(_index, _pv01);
+			for (int k = 0; k < BOOK_COUNT; k++) {
+				long _quantity = 1000000L * ((i + k) % 7 - 3);
+				_store.SetQuantity(_index, k, _quantity);
+				_gross += _pv01 * abs(_quantity);
+			}
+			_store.SetBucketMember(_index, i % 3);
+		}
+
+		// the kernels only differ in the order of the additions
+		PortfolioRisk _vector = _store.Aggregate();
+		PortfolioRisk _scalar = _store.AggregateScalar();
+		double _tolerance = 1e-12 * _gross;
+		bool _same = abs(_vector.total - _scalar.total) <= _tolerance && _vector.books.size() == _scalar.books.size()
+			&& _vector.buckets.size() == _scalar.buckets.size();
+		for (size_t k = 0; _same && k < _scalar.books.size(); k++) {
+			_same = abs(_vector.books[k] - _scalar.books[k]) <= _tolerance;
+		}
+		for (size_t b = 0; _same && b < _scalar.buckets.size(); b++) {
+			_same = abs(_vector.buckets[b] - _scalar.buckets[b]) <= _tolerance;
+		}
+
+		string _suffix = " (" + to_string(_size) + " instruments)";
+		RunBenchmark("Portfolio DV01, vector kernel" + _suffix, ROUNDS, [&](long i) { benchmarkSink += _store.Aggregate().total; }, _size);
+		RunBenchmark("Portfolio DV01, scalar kernel" + _suffix, ROUNDS, [&](long i) { benchmarkSink += _store.AggregateScalar().total; }, _size);
+		std::cout << "  total " << fixed << setprecision(2) << _vector.total << " vector, " << _scalar.total << " scalar" << std::endl;
+		Check(_same, "vector and scalar DV01" + _suffix);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	bool checkOnly = argc > 1 && string(argv[1]) == "--check";
+	int _path = checkOnly ? 2 : 1;
+	string dataPath = (argc > _path ? string(argv[_path]) : string("SampleData")) + "/";
+
+	if (checkOnly) {
+		// the checks, and the benchmarks checking what they ran
+		std::cout << GetTimeStamp() << " Checks started." << std::endl;
+		CheckCoalescedPositions();
+		BenchmarkPositionCoalescing();
+		BenchmarkPositionStress(50000);
+		BenchmarkInquiries(dataPath);
+		BenchmarkAutoQuoter(dataPath);
+		CheckRiskOnPriceMoves();
+		BenchmarkPortfolioRisk();
+		BenchmarkSliceScheduler();
+		BenchmarkTickLadder();
+		CheckMatchingCancels();
+		BenchmarkMatchingEngine();
+		CheckFillLifecycle();
+		CheckRoutedFills();
+		BenchmarkFillBooking();
+		BenchmarkMarketDataAllocations(dataPath);
+		BenchmarkSnapshots(dataPath);
+		BenchmarkSnapshotGrowth();
+		std::cout << GetTimeStamp() << " Checks finished, " << checkFailures << " failed." << std::endl;
+		return checkFailures == 0 ? 0 : 1;
+	}
+
+	std::cout << GetTimeStamp() << " Benchmarks started." << std::endl;
+	BenchmarkUtilities();
+	BenchmarkTradeBooking();
+	CheckCoalescedPositions();
+	BenchmarkPositionCoalescing();
+	BenchmarkTradeStore();
+	BenchmarkPositionStress();
+	BenchmarkInquiries(dataPath);
+	BenchmarkAutoQuoter(dataPath);
+	CheckRiskOnPriceMoves();
+	BenchmarkRiskEngine();
+	BenchmarkPortfolioRisk();
+	BenchmarkOrderRouter();
+	BenchmarkTimerWheel();
+	BenchmarkSliceScheduler();
+	BenchmarkTickLadder();
+	CheckMatchingCancels();
+	BenchmarkMatchingEngine();
+	CheckFillLifecycle();
+	CheckRoutedFills();
+	BenchmarkFillBooking();
+	BenchmarkMarketData(dataPath);
+	BenchmarkMarketDataConflated(dataPath);
+	BenchmarkMarketDataAllocations(dataPath);
+	BenchmarkPricing(dataPath);
+	BenchmarkSnapshots(dataPath);
+	BenchmarkSnapshotGrowth();
+	std::cout << GetTimeStamp() << " Benchmarks finished, " << checkFailures << " checks failed." << std::endl;
+	return checkFailures == 0 ? 0 : 1;
+}
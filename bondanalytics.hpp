@@ -0,0 +1,372 @@
+/**
+* bondanalytics.hpp
+* Bond analytics computed from the cash flows of a Bond:
+* price, yield, modified duration, convexity and PV01.
+* Conventions (US Treasuries): semi-annual coupons paid on the maturity day of month,
+* yields compounded semi-annually, accrued interest actual/actual within the coupon period.
+* All prices and PV01 values are per 100 face, PV01 being the dirty price change for 1bp of yield.
+*
+* @author James Wu
+*/
+#ifndef BOND_ANALYTICS_HPP
+#define BOND_ANALYTICS_HPP
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "products.hpp"
+#include "clock.hpp"
+#include <boost/date_time/gregorian/gregorian.hpp>
+
+using namespace std;
+using namespace boost::gregorian;
+
+/**
+* Cash flows of a bond seen from a settlement date.
+* Flows are one coupon period apart, the first one firstPeriod periods after settlement.
+*/
+struct CashFlowSchedule
+{
+	double firstPeriod = 0.0;	// fraction of a coupon period until the next coupon
+	double accrued = 0.0;		// accrued interest per 100 face
+	vector<double> amounts;		// coupons (and the final redemption) per 100 face
+};
+
+/**
+* Analytics of a bond at a given price.
+*/
+struct BondAnalytics
+{
+	double cleanPrice = 0.0;
+	double dirtyPrice = 0.0;
+	double yield = 0.0;
+	double modifiedDuration = 0.0;
+	double convexity = 0.0;
+	double pv01 = 0.0;
+};
+
+// the (UTC) date of a clock's wall time
+date ClockDate(const Clock& _clock)
+{
+	return date(1970, Jan, 1) + days(_clock.Now() / (86400LL * 1000000000LL));
+}
+
+// build the remaining coupon schedule of a bond from its coupon and maturity date.
+// coupon dates are generated backwards from maturity in steps of 6 months.
+CashFlowSchedule BuildCashFlowSchedule(double _coupon, const date& _maturityDate, const date& _settlementDate)
+{
+	CashFlowSchedule _schedule;
+	if (_maturityDate <= _settlementDate) {
+		return _schedule;		// matured: no flows left
+	}
+
+	double _couponAmount = 100.0 * _coupon / 2.0;
+	int _periods = 0;
+	date _previous = _maturityDate;
+	while (_previous > _settlementDate) {
+		_periods++;
+		_previous = _maturityDate - months(6 * _periods);
+	}
+	date _next = _maturityDate - months(6 * (_periods - 1));
+
+	double _periodDays = (double)(_next - _previous).days();
+	_schedule.firstPeriod = (double)(_next - _settlementDate).days() / _periodDays;
+	_schedule.accrued = _couponAmount * (double)(_settlementDate - _previous).days() / _periodDays;
+	_schedule.amounts.assign(_periods, _couponAmount);
+	_schedule.amounts.back() += 100.0;
+	return _schedule;
+}
+
+CashFlowSchedule BuildCashFlowSchedule(const Bond& _bond, const date& _settlementDate)
+{
+	return BuildCashFlowSchedule(_bond.GetCoupon(), _bond.GetMaturityDate(), _settlementDate);
+}
+
+// dirty price and the first two yield derivatives of the flows, discounting with df_i = v^(t0 + i)
+// where v = 1 / (1 + y/2). Only a single pow() is needed per evaluation.
+inline void DiscountCashFlows(double _firstPeriod, const double* _amounts, int _count, double _yield,
+	double& _price, double& _firstDerivative, double& _secondDerivative)
+{
+	double _v = 1.0 / (1.0 + 0.5 * _yield);
+	double _df = pow(_v, _firstPeriod);
+	double _t = _firstPeriod;
+	double _pv = 0.0, _tpv = 0.0, _ttpv = 0.0;
+	for (int i = 0; i < _count; i++) {
+		double _flow = _amounts[i] * _df;
+		_pv += _flow;
+		_tpv += _t * _flow;
+		_ttpv += _t * (_t + 1.0) * _flow;
+		_df *= _v;
+		_t += 1.0;
+	}
+	_price = _pv;
+	_firstDerivative = -0.5 * _v * _tpv;
+	_secondDerivative = 0.25 * _v * _v * _ttpv;
+}
+
+// solve the yield matching a dirty price by Newton's method, starting from _guess,
+// then fill in duration, convexity and PV01 at that yield.
+inline void SolveBondAnalytics(double _firstPeriod, const double* _amounts, int _count, double _dirtyPrice, double _guess,
+	double& _yield, double& _modifiedDuration, double& _convexity, double& _pv01)
+{
+	if (_count == 0 || _dirtyPrice <= 0.0) {
+		_yield = _modifiedDuration = _convexity = _pv01 = 0.0;
+		return;
+	}
+
+	double _y = _guess;
+	double _price = 0.0, _d1 = 0.0, _d2 = 0.0;
+	for (int i = 0; i < 50; i++) {
+		DiscountCashFlows(_firstPeriod, _amounts, _count, _y, _price, _d1, _d2);
+		double _step = (_price - _dirtyPrice) / _d1;
+		_y -= _step;
+		if (fabs(_step) < 1e-12) {
+			break;
+		}
+	}
+	DiscountCashFlows(_firstPeriod, _amounts, _count, _y, _price, _d1, _d2);
+
+	_yield = _y;
+	_modifiedDuration = -_d1 / _price;
+	_convexity = _d2 / _price;
+	_pv01 = -_d1 * 0.0001;
+}
+
+// dirty price of a schedule at a yield
+double BondPriceFromYield(const CashFlowSchedule& _schedule, double _yield)
+{
+	double _price = 0.0, _d1 = 0.0, _d2 = 0.0;
+	DiscountCashFlows(_schedule.firstPeriod, _schedule.amounts.data(), (int)_schedule.amounts.size(), _yield, _price, _d1, _d2);
+	return _price;
+}
+
+// full analytics of a bond from its clean price
+BondAnalytics ComputeBondAnalytics(const Bond& _bond, double _cleanPrice, const date& _settlementDate)
+{
+	CashFlowSchedule _schedule = BuildCashFlowSchedule(_bond, _settlementDate);
+	BondAnalytics _analytics;
+	_analytics.cleanPrice = _cleanPrice;
+	_analytics.dirtyPrice = _cleanPrice + _schedule.accrued;
+	SolveBondAnalytics(_schedule.firstPeriod, _schedule.amounts.data(), (int)_schedule.amounts.size(), _analytics.dirtyPrice, _bond.GetCoupon(),
+		_analytics.yield, _analytics.modifiedDuration, _analytics.convexity, _analytics.pv01);
+	return _analytics;
+}
+
+/**
+* Batch risk engine over many bonds.
+* The schedules of all bonds are flattened into contiguous arrays and the analytics are kept
+* as parallel arrays (structure of arrays). Price moves only mark a bond dirty; Rerisk()
+* recomputes every dirty bond in one pass, warm-starting Newton from the previous yield.
+* The bonds are valued for settlement on the date of the process clock, unless a date is given;
+* a replay should set the date of its data, so that its risk does not depend on the day it is run.
+* A bond matured by the settlement date has no cash flows left, and no analytics.
+*/
+class BondRiskEngine
+{
+
+public:
+
+	// ctor, valuing the bonds for settlement on the given date (the process clock's by default)
+	BondRiskEngine(const date& _settlementDate = ClockDate(CurrentClock()));
+
+	// Add a bond to the engine, returning its index (existing bonds keep their index)
+	int AddBond(const Bond& _bond);
+
+	// Get the index of a bond, -1 if it was never added
+	int GetIndex(const string& _productId) const;
+
+	// Get the number of bonds in the engine
+	int GetSize() const;
+
+	// Set the clean price of a bond, marking it for re-risking
+	void SetPrice(int _index, double _cleanPrice);
+
+	// Has the bond been priced yet?
+	bool HasPrice(int _index) const;
+
+	// Has the bond matured by the settlement date?
+	bool IsMatured(int _index) const;
+
+	// Re-risk all bonds whose price moved since the last call; returns how many were re-risked
+	int Rerisk();
+
+	// Get the settlement date
+	const date& GetSettlementDate() const;
+
+	// Move the settlement date: rebuilds all schedules and re-risks every priced bond
+	void SetSettlementDate(const date& _settlementDate);
+
+	// Get the analytics of a bond (as of the last Rerisk)
+	double GetYield(int _index) const;
+	double GetModifiedDuration(int _index) const;
+	double GetConvexity(int _index) const;
+	double GetPV01(int _index) const;
+	BondAnalytics GetAnalytics(int _index) const;
+
+private:
+
+	// rebuild the flattened schedule of every bond
+	void BuildSchedules();
+
+	date settlementDate;
+	vector<Bond> bonds;
+	unordered_map<string, int> indices;
+
+	// flattened cash flows: bond i owns amounts[flowBegin[i], flowBegin[i + 1])
+	vector<double> amounts;
+	vector<int> flowBegin;
+
+	// per bond inputs and results
+	vector<double> firstPeriods;
+	vector<double> accrued;
+	vector<double> cleanPrices;
+	vector<double> yields;
+	vector<double> modifiedDurations;
+	vector<double> convexities;
+	vector<double> pv01s;
+	vector<char> priced;
+	vector<int> dirty;
+	vector<char> isDirty;
+};
+
+BondRiskEngine::BondRiskEngine(const date& _settlementDate) :
+	settlementDate(_settlementDate)
+{
+	flowBegin.push_back(0);
+}
+
+int BondRiskEngine::AddBond(const Bond& _bond)
+{
+	auto _it = indices.find(_bond.GetProductId());
+	if (_it != indices.end()) {
+		return _it->second;
+	}
+
+	int _index = (int)bonds.size();
+	indices.emplace(_bond.GetProductId(), _index);
+	bonds.push_back(_bond);
+
+	CashFlowSchedule _schedule = BuildCashFlowSchedule(_bond, settlementDate);
+	amounts.insert(amounts.end(), _schedule.amounts.begin(), _schedule.amounts.end());
+	flowBegin.push_back((int)amounts.size());
+	firstPeriods.push_back(_schedule.firstPeriod);
+	accrued.push_back(_schedule.accrued);
+	cleanPrices.push_back(0.0);
+	yields.push_back(_bond.GetCoupon());
+	modifiedDurations.push_back(0.0);
+	convexities.push_back(0.0);
+	pv01s.push_back(0.0);
+	priced.push_back(0);
+	isDirty.push_back(0);
+	return _index;
+}
+
+int BondRiskEngine::GetIndex(const string& _productId) const
+{
+	auto _it = indices.find(_productId);
+	return _it == indices.end() ? -1 : _it->second;
+}
+
+int BondRiskEngine::GetSize() const
+{
+	return (int)bonds.size();
+}
+
+void BondRiskEngine::SetPrice(int _index, double _cleanPrice)
+{
+	cleanPrices[_index] = _cleanPrice;
+	priced[_index] = 1;
+	if (!isDirty[_index]) {
+		isDirty[_index] = 1;
+		dirty.push_back(_index);
+	}
+}
+
+bool BondRiskEngine::HasPrice(int _index) const
+{
+	return priced[_index] != 0;
+}
+
+bool BondRiskEngine::IsMatured(int _index) const
+{
+	return flowBegin[_index + 1] == flowBegin[_index];
+}
+
+int BondRiskEngine::Rerisk()
+{
+	int _count = (int)dirty.size();
+	for (int i : dirty)
+	{
+		int _begin = flowBegin[i];
+		SolveBondAnalytics(firstPeriods[i], amounts.data() + _begin, flowBegin[i + 1] - _begin, cleanPrices[i] + accrued[i], yields[i],
+			yields[i], modifiedDurations[i], convexities[i], pv01s[i]);
+		isDirty[i] = 0;
+	}
+	dirty.clear();
+	return _count;
+}
+
+const date& BondRiskEngine::GetSettlementDate() const
+{
+	return settlementDate;
+}
+
+void BondRiskEngine::SetSettlementDate(const date& _settlementDate)
+{
+	settlementDate = _settlementDate;
+	BuildSchedules();
+	for (int i = 0; i < (int)bonds.size(); i++) {
+		if (priced[i]) {
+			SetPrice(i, cleanPrices[i]);
+		}
+	}
+}
+
+void BondRiskEngine::BuildSchedules()
+{
+	amounts.clear();
+	flowBegin.assign(1, 0);
+	for (int i = 0; i < (int)bonds.size(); i++)
+	{
+		CashFlowSchedule _schedule = BuildCashFlowSchedule(bonds[i], settlementDate);
+		amounts.insert(amounts.end(), _schedule.amounts.begin(), _schedule.amounts.end());
+		flowBegin.push_back((int)amounts.size());
+		firstPeriods[i] = _schedule.firstPeriod;
+		accrued[i] = _schedule.accrued;
+	}
+}
+
+double BondRiskEngine::GetYield(int _index) const
+{
+	return yields[_index];
+}
+
+double BondRiskEngine::GetModifiedDuration(int _index) const
+{
+	return modifiedDurations[_index];
+}
+
+double BondRiskEngine::GetConvexity(int _index) const
+{
+	return convexities[_index];
+}
+
+double BondRiskEngine::GetPV01(int _index) const
+{
+	return pv01s[_index];
+}
+
+BondAnalytics BondRiskEngine::GetAnalytics(int _index) const
+{
+	BondAnalytics _analytics;
+	_analytics.cleanPrice = cleanPrices[_index];
+	_analytics.dirtyPrice = cleanPrices[_index] + accrued[_index];
+	_analytics.yield = yields[_index];
+	_analytics.modifiedDuration = modifiedDurations[_index];
+	_analytics.convexity = convexities[_index];
+	_analytics.pv01 = pv01s[_index];
+	return _analytics;
+}
+
+#endif
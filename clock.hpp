@@ -0,0 +1,155 @@
+/**
+* clock.hpp
+* Clocks the services read the time from: the real clock, or a simulated one that only moves when
+* it is set or advanced, so that a recorded day replays in seconds with the event times it would
+* have had. The process clock is the real one unless a simulated clock is installed, which must be
+* done before the services are built. Latencies of the code itself are always measured on the
+* real steady clock (SteadyNanoseconds).
+*
+* @author James Wu
+*/
+#ifndef CLOCK_HPP
+#define CLOCK_HPP
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+using namespace std;
+
+/**
+* Source of the time.
+* Now() is the wall time (ns since the epoch), for timestamps; Steady() never goes back (ns), for
+* intervals, throttles and timers.
+*/
+class Clock
+{
+
+public:
+
+	virtual ~Clock() = default;
+
+	// Get the wall time (ns since the epoch)
+	virtual int64_t Now() const = 0;
+
+	// Get the monotonic time (ns)
+	virtual int64_t Steady() const = 0;
+
+	// Does the time move on its own?
+	virtual bool IsRealTime() const = 0;
+};
+
+// time on the real steady clock (ns), for measuring how long the code takes
+inline int64_t SteadyNanoseconds()
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+* The system and steady clocks.
+*/
+class RealClock final : public Clock
+{
+
+public:
+
+	int64_t Now() const;
+	int64_t Steady() const;
+	bool IsRealTime() const;
+};
+
+int64_t RealClock::Now() const
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+int64_t RealClock::Steady() const
+{
+	return SteadyNanoseconds();
+}
+
+bool RealClock::IsRealTime() const
+{
+	return true;
+}
+
+/**
+* Clock moved by the replay driver. Both times are the same simulated time and never go back.
+* It can be read from any thread.
+*/
+class SimulatedClock final : public Clock
+{
+
+public:
+
+	// ctor, starting at _start (ns since the epoch)
+	SimulatedClock(int64_t _start = 0);
+
+	int64_t Now() const;
+	int64_t Steady() const;
+	bool IsRealTime() const;
+
+	// Move the time to _time (ns since the epoch); an earlier time is ignored
+	void Set(int64_t _time);
+
+	// Move the time forward by _step
+	void Advance(chrono::nanoseconds _step);
+
+private:
+	atomic<int64_t> time;
+};
+
+SimulatedClock::SimulatedClock(int64_t _start) :
+	time(_start)
+{
+}
+
+int64_t SimulatedClock::Now() const
+{
+	return time.load(memory_order_acquire);
+}
+
+int64_t SimulatedClock::Steady() const
+{
+	return time.load(memory_order_acquire);
+}
+
+bool SimulatedClock::IsRealTime() const
+{
+	return false;
+}
+
+void SimulatedClock::Set(int64_t _time)
+{
+	int64_t _current = time.load(memory_order_relaxed);
+	while (_current < _time && !time.compare_exchange_weak(_current, _time, memory_order_release, memory_order_relaxed)) {}
+}
+
+void SimulatedClock::Advance(chrono::nanoseconds _step)
+{
+	time.fetch_add(max<int64_t>(_step.count(), 0), memory_order_release);
+}
+
+// the installed clock, nullptr for the real one
+inline atomic<Clock*>& InstalledClock()
+{
+	static atomic<Clock*> _clock{ nullptr };
+	return _clock;
+}
+
+// Get the process clock
+inline Clock& CurrentClock()
+{
+	static RealClock _realClock;
+	Clock* _clock = InstalledClock().load(memory_order_acquire);
+	return _clock ? *_clock : _realClock;
+}
+
+// Install the process clock (nullptr for the real one); the clock must outlive its use
+inline void SetClock(Clock* _clock)
+{
+	InstalledClock().store(_clock, memory_order_release);
+}
+
+#endif
@@ -154,7 +154,7 @@ void GenerateProductTradeData(string _id, int _size, ofstream& file) {
 		int _market = (int)(d(gen) * 3) % 3 + 1;
 		string _book_name = "TRSY" + to_string(_market);
 		double _price = 99.0 + mintick * (double)_n;
-		string trading_id = GenerateTradingId(12);
+		TradingId trading_id = GenerateTradingId(12);
 		file << _id << "," << trading_id << "," << PriceToString(_price) << "," << _book_name << "," << _volume << "," << _string_side << std::endl;
 	}
 }
@@ -183,8 +183,7 @@ void GenerateProductInquiryData(string _id, int _size, ofstream& file) {
 		int _volume = volumeVec[i % 5];
 		int _numTicks = rand() % 512;
 		double _price = 99.0 + mintick * (double)_n;
-		string _inquiry_id = GenerateTradingId(9);
-		_inquiry_id = "INQ" + _inquiry_id;		// indicating it's "INQUIRY"
+		string _inquiry_id = "INQ" + GenerateTradingId(9).ToString();		// indicating it's "INQUIRY"
 		file << _inquiry_id << "," << _id << "," << _string_side << "," << _volume << "," << PriceToString(_price) << "," << "RECEIVED" << std::endl;
 	}
 }
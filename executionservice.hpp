@@ -10,7 +10,307 @@
 
 #include "soa.hpp"
 #include <string>
+#include <array>
+#include <unordered_map>
 #include "algoexecutionservice.hpp"
+#include "matchingengine.hpp"
+#include "latencystats.hpp"
+
+/**
+* A fill of an execution order: the quantity and price of this execution, with the quantity the order
+* has filled so far (cumulative) and what is still open (leaves). An order is done once its leaves
+* reach 0: a last fill of quantity 0 reports the end of an order whose remainder was cancelled.
+* Type T is the product type.
+*/
+template<typename T>
+class Fill
+{
+
+public:
+
+	// ctor for a fill
+	Fill() = default;
+	Fill(const T* _product, const TradingId& _orderId, const TradingId& _parentOrderId, PricingSide _side, double _price,
+		long _quantity, long _cumulativeQuantity, long _leavesQuantity, Market _market);
+
+	// Get the product
+	const T& GetProduct() const;
+
+	// Get the handle of the (interned) product
+	const T* GetProductHandle() const;
+
+	// Get the order ID and the parent order ID
+	const TradingId& GetOrderId() const;
+	const TradingId& GetParentOrderId() const;
+
+	// Get the pricing side of the order
+	PricingSide GetPricingSide() const;
+
+	// Get the price and quantity of this fill
+	double GetPrice() const;
+	long GetQuantity() const;
+
+	// Get the quantity filled so far, and the quantity still open
+	long GetCumulativeQuantity() const;
+	long GetLeavesQuantity() const;
+
+	// Get the venue of the fill
+	Market GetMarket() const;
+
+private:
+	const T* product = ProductRegistry<T>::Default();
+	TradingId orderId;
+	TradingId parentOrderId;
+	PricingSide side;
+	double price;
+	long quantity;
+	long cumulativeQuantity;
+	long leavesQuantity;
+	Market market;
+};
+
+template<typename T>
+Fill<T>::Fill(const T* _product, const TradingId& _orderId, const TradingId& _parentOrderId, PricingSide _side, double _price,
+	long _quantity, long _cumulativeQuantity, long _leavesQuantity, Market _market) :
+	product(_product), orderId(_orderId), parentOrderId(_parentOrderId)
+{
+	side = _side;
+	price = _price;
+	quantity = _quantity;
+	cumulativeQuantity = _cumulativeQuantity;
+	leavesQuantity = _leavesQuantity;
+	market = _market;
+}
+
+template<typename T>
+const T& Fill<T>::GetProduct() const
+{
+	return *product;
+}
+
+template<typename T>
+const T* Fill<T>::GetProductHandle() const
+{
+	return product;
+}
+
+template<typename T>
+const TradingId& Fill<T>::GetOrderId() const
+{
+	return orderId;
+}
+
+template<typename T>
+const TradingId& Fill<T>::GetParentOrderId() const
+{
+	return parentOrderId;
+}
+
+template<typename T>
+PricingSide Fill<T>::GetPricingSide() const
+{
+	return side;
+}
+
+template<typename T>
+double Fill<T>::GetPrice() const
+{
+	return price;
+}
+
+template<typename T>
+long Fill<T>::GetQuantity() const
+{
+	return quantity;
+}
+
+template<typename T>
+long Fill<T>::GetCumulativeQuantity() const
+{
+	return cumulativeQuantity;
+}
+
+template<typename T>
+long Fill<T>::GetLeavesQuantity() const
+{
+	return leavesQuantity;
+}
+
+template<typename T>
+Market Fill<T>::GetMarket() const
+{
+	return market;
+}
+
+/**
+* Smart order router across the venues (BROKERTEC, ESPEED, CME).
+* It keeps the top of book of each product on each venue and splits a parent order into child orders,
+* best price first (the larger size first at the same price), each taking at most the size shown on its venue.
+* The size taken is removed from the venue's top of book until its next update, so that back-to-back
+* parents do not count the same liquidity twice. LIMIT, FOK and IOC orders only take prices at their
+* own price or better. What the venues cannot fill is rejected altogether for FOK, cancelled for IOC,
+* and otherwise sent at the parent's price to the best venue (the primary venue BROKERTEC if none quotes).
+* Type T is the product type.
+*/
+template<typename T>
+class SmartOrderRouter
+{
+public:
+
+	// ctor
+	SmartOrderRouter();
+
+	// Update the top of book of a product on a venue
+	void UpdateVenue(Market _market, const TopOfBook<T>& _top);
+
+	// Has any venue quoted the product?
+	bool IsRouted(const string& _productId) const;
+
+	// Split a parent order into child orders (replacing the content of _children); false if it is rejected
+	bool Route(const ExecutionOrder<T>& _parent, vector<ExecutionOrder<T>>& _children);
+
+	// Get the number of parent orders routed and rejected, and of child orders sent
+	long GetRoutedCount() const;
+	long GetRejectedCount() const;
+	long GetChildCount() const;
+
+	// Get the quantity of IOC orders left unfilled
+	long GetCancelledQuantity() const;
+
+	// Get the time taken by the routing decisions
+	const LatencyStats& GetLatency() const;
+
+private:
+	unordered_map<string, array<TopOfBook<T>, MARKET_COUNT>> venueBooks;
+	LatencyStats latency;
+	long routedCount;
+	long rejectedCount;
+	long childCount;
+	long cancelledQuantity;
+};
+
+template<typename T>
+SmartOrderRouter<T>::SmartOrderRouter()
+{
+	routedCount = 0;
+	rejectedCount = 0;
+	childCount = 0;
+	cancelledQuantity = 0;
+}
+
+template<typename T>
+void SmartOrderRouter<T>::UpdateVenue(Market _market, const TopOfBook<T>& _top)
+{
+	venueBooks[_top.product->GetProductId()][_market] = _top;
+}
+
+template<typename T>
+bool SmartOrderRouter<T>::IsRouted(const string& _productId) const
+{
+	return venueBooks.count(_productId) != 0;
+}
+
+template<typename T>
+bool SmartOrderRouter<T>::Route(const ExecutionOrder<T>& _parent, vector<ExecutionOrder<T>>& _children)
+{
+	int64_t _start = SteadyNanoseconds();
+	_children.clear();
+	auto& _tops = venueBooks.at(_parent.GetProduct().GetProductId());
+
+	// an OFFER order lifts the venues' offers, a BID order hits their bids
+	bool _lift = _parent.GetPricingSide() == OFFER;
+	OrderType _type = _parent.GetOrderType();
+	bool _limited = _type == LIMIT || _type == FOK || _type == IOC;
+	int32_t _limit = PriceToTicks(_parent.GetPrice());
+
+	// the venues that can take the order, best first (insertion sort, there are three)
+	Market _venues[MARKET_COUNT];
+	int _count = 0;
+	long _available = 0;
+	for (int m = 0; m < MARKET_COUNT; m++)
+	{
+		int32_t _ticks = _lift ? _tops[m].offerTicks : _tops[m].bidTicks;
+		int64_t _size = _lift ? _tops[m].offerQuantity : _tops[m].bidQuantity;
+		if (_size <= 0 || (_limited && (_lift ? _ticks > _limit : _ticks < _limit))) {
+			continue;
+		}
+		int i = _count++;
+		for (; i > 0; i--)
+		{
+			const TopOfBook<T>& _other = _tops[_venues[i - 1]];
+			int32_t _otherTicks = _lift ? _other.offerTicks : _other.bidTicks;
+			int64_t _otherSize = _lift ? _other.offerQuantity : _other.bidQuantity;
+			bool _better = _ticks != _otherTicks ? (_lift ? _ticks < _otherTicks : _ticks > _otherTicks) : _size > _otherSize;
+			if (!_better) {
+				break;
+			}
+			_venues[i] = _venues[i - 1];
+		}
+		_venues[i] = (Market)m;
+		_available += _size;
+	}
+
+	long _remaining = _parent.GetVisibleQuantity() + _parent.GetHiddenQuantity();
+	bool _routed = !(_type == FOK && _available < _remaining);
+	if (_routed)
+	{
+		for (int i = 0; i < _count && _remaining > 0; i++)
+		{
+			TopOfBook<T>& _top = _tops[_venues[i]];
+			int64_t& _size = _lift ? _top.offerQuantity : _top.bidQuantity;
+			long _take = (long)min<int64_t>(_remaining, _size);
+			_size -= _take;
+			_remaining -= _take;
+			_children.emplace_back(_parent.GetProduct(), _parent.GetPricingSide(), GenerateTradingId(), _type,
+				TicksToPrice(_lift ? _top.offerTicks : _top.bidTicks), _take, 0, _parent.GetOrderId(), true, _venues[i]);
+		}
+		if (_remaining > 0 && _type == IOC) {
+			cancelledQuantity += _remaining;
+		}
+		else if (_remaining > 0) {
+			_children.emplace_back(_parent.GetProduct(), _parent.GetPricingSide(), GenerateTradingId(), _type,
+				_parent.GetPrice(), _remaining, 0, _parent.GetOrderId(), true, _count ? _venues[0] : BROKERTEC);
+		}
+		routedCount++;
+		childCount += (long)_children.size();
+	}
+	else {
+		rejectedCount++;
+	}
+
+	latency.Record(SteadyNanoseconds() - _start);
+	return _routed;
+}
+
+template<typename T>
+long SmartOrderRouter<T>::GetRoutedCount() const
+{
+	return routedCount;
+}
+
+template<typename T>
+long SmartOrderRouter<T>::GetRejectedCount() const
+{
+	return rejectedCount;
+}
+
+template<typename T>
+long SmartOrderRouter<T>::GetChildCount() const
+{
+	return childCount;
+}
+
+template<typename T>
+long SmartOrderRouter<T>::GetCancelledQuantity() const
+{
+	return cancelledQuantity;
+}
+
+template<typename T>
+const LatencyStats& SmartOrderRouter<T>::GetLatency() const
+{
+	return latency;
+}
 
  /**
  * Pre-declearations to avoid errors.
@@ -20,10 +320,24 @@
  */
 template<typename T>
 class AlgoExecutionToExecutionListener;
+template<typename T>
+class VenueMarketDataListener;
 
 /**
 * Service for executing orders (general).
 * Keyed on product identifier.
+* Once a venue listener is added to a market data service, the parent orders of the products quoted
+* on the venues are split by the SmartOrderRouter, and their child orders are executed instead.
+* Orders are assumed to execute in full when they are sent, unless matching is on: then they are
+* matched on the internal books of the MatchingEngine, and the listeners are only sent what executes,
+* one execution per order matched (both the incoming and the resting order) at the price and quantity
+* of the match.
+* Each execution is also reported to the fill listeners as a Fill, with the order's cumulative and
+* leaves quantity: a single complete fill for an order assumed to execute, partial fills when matching.
+* Every order ends with a fill leaving nothing: its last partial fill, or a fill of quantity 0 when what
+* is left of it is cancelled (a MARKET, IOC or triggered stop remainder, a rejected FOK, a CancelOrder).
+* A routed parent is filled through its children, except for what the router does not send: a FOK it
+* rejects, or an IOC remainder no venue takes, ends the parent with a fill of quantity 0 leaving nothing.
 * Type T is the product type.
 * We follow the normal schedule of constructing service class.
 */
@@ -32,11 +346,12 @@ class ExecutionService : public Service<string, ExecutionOrder<T>>
 {
 public:
 
-	// Ctor
+	// Ctor and dtor
 	ExecutionService();
+	~ExecutionService();
 
 	// Get data on our service given a key
-	ExecutionOrder<T>& GetData(string _id);
+	ExecutionOrder<T>& GetData(const string& _id);
 
 	// The callback that a Connector should invoke for any new or updated data
 	void OnMessage(ExecutionOrder<T>& _data);
@@ -47,16 +362,67 @@ public:
 	// Get all listeners on the Service
 	const vector<ServiceListener<ExecutionOrder<T>>*>& GetListeners() const;
 
+	// Add a listener receiving the fills of the orders
+	void AddFillListener(ServiceListener<Fill<T>>* _listener);
+
+	// Get the fill listeners
+	const vector<ServiceListener<Fill<T>>*>& GetFillListeners() const;
+
 	// Get the listener of the service
 	AlgoExecutionToExecutionListener<T>* GetListener();
 
+	// Get the listener feeding a venue's top of book to the router (created on first use)
+	VenueMarketDataListener<T>* GetVenueListener(Market _market);
+
+	// Get the order router
+	SmartOrderRouter<T>& GetRouter();
+
+	// Match the orders on the internal books from now on, instead of assuming they execute in full
+	void SetMatching(bool _matching);
+
+	// Get the matching engine
+	MatchingEngine<T>& GetMatchingEngine();
+
 	// order execution upon receiving an execution request.
 	void ExecuteOrder(ExecutionOrder<T>& _executionOrder);
 
+	// Cancel what is left of an order resting on the books or waiting as a stop; false if there is none
+	bool CancelOrder(const TradingId& _orderId);
+
+	// Get the number of orders resting on the books or waiting as stops
+	size_t GetOpenOrderCount() const;
+
 private:
+
+	// an order left on the books of the matching engine
+	struct OpenOrder
+	{
+		OrderHandle handle;
+		const T* product;
+	};
+
+	// execute an order that is not split any further
+	void Execute(ExecutionOrder<T>& _executionOrder);
+
+	// close an order whose remainder was cancelled, with a fill of quantity 0
+	void Cancelled(const T* _product, const MatchedOrder& _order, long _quantity);
+
+	// record an execution and notify the listeners
+	void Publish(ExecutionOrder<T>& _execution);
+
+	// notify the fill listeners
+	void PublishFill(Fill<T>& _fill);
+
 	map<string, ExecutionOrder<T>> executionOrders;
 	vector<ServiceListener<ExecutionOrder<T>>*> listeners;
+	vector<ServiceListener<Fill<T>>*> fillListeners;
 	AlgoExecutionToExecutionListener<T>* listener;
+	array<VenueMarketDataListener<T>*, MARKET_COUNT> venueListeners;
+	SmartOrderRouter<T> router;
+	vector<ExecutionOrder<T>> children;
+	MatchingEngine<T> engine;
+	unordered_map<TradingId, OpenOrder> openOrders;
+	bool matching;
 };
 
 template<typename T>
@@ -65,19 +431,28 @@ ExecutionService<T>::ExecutionService()
 	executionOrders = map<string, ExecutionOrder<T>>();
 	listeners = vector<ServiceListener<ExecutionOrder<T>>*>();
 	listener = new AlgoExecutionToExecutionListener<T>(this);
+	venueListeners.fill(nullptr);
+	matching = false;
 }
 
 template<typename T>
-ExecutionOrder<T>& ExecutionService<T>::GetData(string _id)
+ExecutionService<T>::~ExecutionService()
 {
-	return executionOrders[_id];
+	for (auto _venueListener : venueListeners) {
+		delete _venueListener;
+	}
+}
+
+template<typename T>
+ExecutionOrder<T>& ExecutionService<T>::GetData(const string& _id)
+{
+	return executionOrders.at(_id);
 }
 
 template<typename T>
 void ExecutionService<T>::OnMessage(ExecutionOrder<T>& _data)
 {
-	string _id = _data.GetProduct().GetProductId();
-	executionOrders[_id] = _data;
+	executionOrders.insert_or_assign(_data.GetProduct().GetProductId(), _data);
 }
 
 template<typename T>
@@ -92,22 +467,170 @@ const vector<ServiceListener<ExecutionOrder<T>>*>& ExecutionService<T>::GetListe
 	return listeners;
 }
 
+template<typename T>
+void ExecutionService<T>::AddFillListener(ServiceListener<Fill<T>>* _listener)
+{
+	fillListeners.push_back(_listener);
+}
+
+template<typename T>
+const vector<ServiceListener<Fill<T>>*>& ExecutionService<T>::GetFillListeners() const
+{
+	return fillListeners;
+}
+
 template<typename T>
 AlgoExecutionToExecutionListener<T>* ExecutionService<T>::GetListener()
 {
 	return listener;
 }
 
+template<typename T>
+VenueMarketDataListener<T>* ExecutionService<T>::GetVenueListener(Market _market)
+{
+	if (!venueListeners[_market]) {
+		venueListeners[_market] = new VenueMarketDataListener<T>(&router, _market);
+	}
+	return venueListeners[_market];
+}
+
+template<typename T>
+SmartOrderRouter<T>& ExecutionService<T>::GetRouter()
+{
+	return router;
+}
+
+template<typename T>
+void ExecutionService<T>::SetMatching(bool _matching)
+{
+	matching = _matching;
+}
+
+template<typename T>
+MatchingEngine<T>& ExecutionService<T>::GetMatchingEngine()
+{
+	return engine;
+}
+
 template<typename T>
 void ExecutionService<T>::ExecuteOrder(ExecutionOrder<T>& _executionOrder)
 {
-	string _productId = _executionOrder.GetProduct().GetProductId();
-	executionOrders[_productId] = _executionOrder;
+	// a parent order quoted on the venues is executed as its child orders
+	if (!_executionOrder.IsChildOrder() && router.IsRouted(_executionOrder.GetProduct().GetProductId()))
+	{
+		bool _routed = router.Route(_executionOrder, children);
+		long _quantity = _executionOrder.GetVisibleQuantity() + _executionOrder.GetHiddenQuantity();
+		long _sent = 0;
+		for (auto& _child : children)
+		{
+			_sent += _child.GetVisibleQuantity() + _child.GetHiddenQuantity();
+			Execute(_child);
+		}
+		if (!_routed || _sent < _quantity)
+		{
+			Fill<T> _fill(ProductRegistry<T>::Intern(_executionOrder.GetProduct()), _executionOrder.GetOrderId(),
+				_executionOrder.GetParentOrderId(), _executionOrder.GetPricingSide(), 0.0, 0, _sent, 0, _executionOrder.GetMarket());
+			PublishFill(_fill);
+		}
+		return;
+	}
+
+	Execute(_executionOrder);
+}
+
+// each match executes the incoming order and the resting one, at the resting order's price. The
+// matches of the stops the order triggers come through the same callback, with the stop as aggressor.
+// An order leaves the open orders with its last fill.
+template<typename T>
+void ExecutionService<T>::Execute(ExecutionOrder<T>& _executionOrder)
+{
+	const T& _product = _executionOrder.GetProduct();
+	const T* _handle = ProductRegistry<T>::Intern(_product);
+	long _quantity = _executionOrder.GetVisibleQuantity() + _executionOrder.GetHiddenQuantity();
+	if (!matching)
+	{
+		Publish(_executionOrder);
+		Fill<T> _fill(_handle, _executionOrder.GetOrderId(), _executionOrder.GetParentOrderId(), _executionOrder.GetPricingSide(),
+			_executionOrder.GetPrice(), _quantity, _quantity, 0, _executionOrder.GetMarket());
+		PublishFill(_fill);
+		return;
+	}
+
+	OrderHandle _resting = engine.Submit(_executionOrder, [&](const Match& _match) {
+		PricingSide _restingSide = _match.aggressorSide == BID ? OFFER : BID;
+		double _price = TicksToPrice(_match.ticks);
+		const MatchedOrder* _orders[2] = { _match.aggressor, _match.resting };
+		PricingSide _sides[2] = { _match.aggressorSide, _restingSide };
+		long _leavesQuantities[2] = { _match.aggressorLeaves, _match.restingLeaves };
+		for (int i = 0; i < 2; i++)
+		{
+			ExecutionOrder<T> _execution(_product, _sides[i], _orders[i]->orderId, _orders[i]->orderType, _price, _match.quantity, 0,
+				_orders[i]->parentOrderId, _orders[i]->isChildOrder, _orders[i]->market);
+			Publish(_execution);
+			Fill<T> _fill(_handle, _orders[i]->orderId, _orders[i]->parentOrderId, _sides[i], _price, _match.quantity,
+				_orders[i]->quantity - _leavesQuantities[i], _leavesQuantities[i], _orders[i]->market);
+			PublishFill(_fill);
+			if (_leavesQuantities[i] == 0 && !openOrders.empty()) {
+				openOrders.erase(_orders[i]->orderId);
+			}
+		}
+	}, [&](const MatchedOrder& _order, long _cancelled) {
+		Cancelled(_handle, _order, _cancelled);
+	});
+
+	if (_resting != INVALID_ORDER) {
+		openOrders[_executionOrder.GetOrderId()] = OpenOrder{ _resting, _handle };
+	}
+}
+
+template<typename T>
+bool ExecutionService<T>::CancelOrder(const TradingId& _orderId)
+{
+	auto _it = openOrders.find(_orderId);
+	if (_it == openOrders.end()) {
+		return false;
+	}
+	OpenOrder _order = _it->second;
+	openOrders.erase(_it);
+	return engine.Cancel(_order.handle, [&](const MatchedOrder& _matched, long _cancelled) {
+		Cancelled(_order.product, _matched, _cancelled);
+	});
+}
+
+template<typename T>
+size_t ExecutionService<T>::GetOpenOrderCount() const
+{
+	return openOrders.size();
+}
+
+template<typename T>
+void ExecutionService<T>::Cancelled(const T* _product, const MatchedOrder& _order, long _quantity)
+{
+	if (!openOrders.empty()) {
+		openOrders.erase(_order.orderId);
+	}
+	Fill<T> _fill(_product, _order.orderId, _order.parentOrderId, _order.side, 0.0, 0, _order.quantity - _quantity, 0, _order.market);
+	PublishFill(_fill);
+}
+
+template<typename T>
+void ExecutionService<T>::Publish(ExecutionOrder<T>& _execution)
+{
+	executionOrders.insert_or_assign(_execution.GetProduct().GetProductId(), _execution);
 
 	// call the listeners
 	for (auto& l : listeners)
 	{
-		l->ProcessAdd(_executionOrder);
+		l->ProcessAdd(_execution);
+	}
+}
+
+template<typename T>
+void ExecutionService<T>::PublishFill(Fill<T>& _fill)
+{
+	for (auto& l : fillListeners)
+	{
+		l->ProcessAdd(_fill);
 	}
 }
 
@@ -165,4 +688,49 @@ void AlgoExecutionToExecutionListener<T>::ProcessRemove(AlgoExecution<T>& _data)
 template<typename T>
 void AlgoExecutionToExecutionListener<T>::ProcessUpdate(AlgoExecution<T>& _data) {}
 
+/**
+* Listener feeding the top of the books of one venue's market data to the order router.
+* Type T is the product type.
+*/
+template<typename T>
+class VenueMarketDataListener final : public ServiceListener<OrderBook<T>>
+{
+public:
+	// ctor
+	VenueMarketDataListener(SmartOrderRouter<T>* _router, Market _market);
+
+	// Listener callback to process an add event to the Service
+	void ProcessAdd(OrderBook<T>& _data);
+
+	// Listener callback to process a remove event to the Service
+	void ProcessRemove(OrderBook<T>& _data);
+
+	// Listener callback to process an update event to the Service
+	void ProcessUpdate(OrderBook<T>& _data);
+
+private:
+	SmartOrderRouter<T>* router;
+	Market market;
+};
+
+template<typename T>
+VenueMarketDataListener<T>::VenueMarketDataListener(SmartOrderRouter<T>* _router, Market _market)
+{
+	router = _router;
+	market = _market;
+}
+
+template<typename T>
+void VenueMarketDataListener<T>::ProcessAdd(OrderBook<T>& _data)
+{
+	router->UpdateVenue(market, MakeTopOfBook(_data));
+}
+
+// do nothing for these methods (not required)
+template<typename T>
+void VenueMarketDataListener<T>::ProcessRemove(OrderBook<T>& _data) {}
+
+template<typename T>
+void VenueMarketDataListener<T>::ProcessUpdate(OrderBook<T>& _data) {}
+
 #endif
@@ -5,6 +5,7 @@
  * @author Breman Thuraisingham
  * Defines the data types and Service for historical data.
  * Should register the following listeners: Position,  Risk, Execution, Steaming, Inquiry services.
+ * The trade service persists the trades evicted from TradeBookingService.
  *
  * @author Breman Thuraisingham
  * @coauthor James Wu
@@ -19,8 +20,9 @@
 #include "executionservice.hpp"
 #include "streamingservice.hpp"
 #include "inquiryservice.hpp"
+#include "tradebookingservice.hpp"
 
-enum ServiceType { POSITION, RISK, EXECUTION, STREAMING, INQUIRY };
+enum ServiceType { POSITION, RISK, EXECUTION, STREAMING, INQUIRY, TRADE };
 
 /**
 * Pre-declearations to avoid errors.
@@ -47,7 +49,7 @@ public:
 	HistoricalDataService(ServiceType _type);
 
 	// Get data on our service given a key
-	V& GetData(string _key);
+	V& GetData(const string& _key);
 
 	// The callback that a Connector should invoke for any new or updated data
 	void OnMessage(V& _data);
@@ -68,7 +70,7 @@ public:
 	ServiceType GetServiceType() const;
 
 	// Persist data to a store
-	void PersistData(string _persistKey, V& _data);
+	void PersistData(const string& _persistKey, V& _data);
 private:
 
 	map<string, V> historicalDatas;
@@ -100,15 +102,15 @@ HistoricalDataService<V>::HistoricalDataService(ServiceType _type)
 }
 
 template<typename V>
-V& HistoricalDataService<V>::GetData(string _key)
+V& HistoricalDataService<V>::GetData(const string& _key)
 {
-	return historicalDatas[_key];
+	return historicalDatas.at(_key);
 }
 
 template<typename V>
 void HistoricalDataService<V>::OnMessage(V& _data)
 {
-	historicalDatas[_data.GetProduct().GetProductId()] = _data;
+	historicalDatas.insert_or_assign(_data.GetProduct().GetProductId(), _data);
 }
 
 template<typename V>
@@ -142,7 +144,7 @@ ServiceType HistoricalDataService<V>::GetServiceType() const
 }
 
 template<typename V>
-void HistoricalDataService<V>::PersistData(string _persistKey, V& _data)
+void HistoricalDataService<V>::PersistData(const string& _persistKey, V& _data)
 {
 	connector->Publish(_data);
 }
@@ -200,6 +202,9 @@ void HistoricalDataConnector<V>::Publish(V& _data)
 	if (_type == INQUIRY) {
 		_file.open("allinquiries.txt", ios::app);
 	}
+	if (_type == TRADE) {
+		_file.open("bookedtrades.txt", ios::app);
+	}
 
 	_file << GetTimeStamp() << ",";
 	
@@ -258,8 +263,7 @@ HistoricalDataListener<V>::~HistoricalDataListener() {}
 template<typename V>
 void HistoricalDataListener<V>::ProcessAdd(V& _data)
 {
-	string _persistKey = _data.GetProduct().GetProductId();
-	service->PersistData(_persistKey, _data);
+	service->PersistData(_data.GetProduct().GetProductId(), _data);
 }
 
 // do nothing for these methods (not required)
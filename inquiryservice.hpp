@@ -8,8 +8,17 @@
 #ifndef INQUIRY_SERVICE_HPP
 #define INQUIRY_SERVICE_HPP
 
+#include <deque>
+#include <array>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include "soa.hpp"
 #include "tradebookingservice.hpp"
+#include "marketdataservice.hpp"
+#include "pricingservice.hpp"
+#include "latencystats.hpp"
 #include "utilityfunctions.hpp"
 
  // Various inqyury states
@@ -27,10 +36,10 @@ public:
 
 	// ctor for an inquiry
 	Inquiry() = default;
-	Inquiry(string _inquiryId, const T& _product, Side _side, long _quantity, double _price, InquiryState _state);
+	Inquiry(TradingId _inquiryId, const T& _product, Side _side, long _quantity, double _price, InquiryState _state);
 
 	// Get the inquiry ID
-	const string& GetInquiryId() const;
+	const TradingId& GetInquiryId() const;
 
 	// Get the product
 	const T& GetProduct() const;
@@ -57,7 +66,7 @@ public:
 	vector<string> ToStrings() const;
 
 private:
-	string inquiryId;
+	TradingId inquiryId;
 	T product;
 	Side side;
 	long quantity;
@@ -67,10 +76,9 @@ private:
 };
 
 template<typename T>
-Inquiry<T>::Inquiry(string _inquiryId, const T& _product, Side _side, long _quantity, double _price, InquiryState _state) :
-	product(_product)
+Inquiry<T>::Inquiry(TradingId _inquiryId, const T& _product, Side _side, long _quantity, double _price, InquiryState _state) :
+	inquiryId(_inquiryId), product(_product)
 {
-	inquiryId = _inquiryId;
 	side = _side;
 	quantity = _quantity;
 	price = _price;
@@ -78,7 +86,7 @@ Inquiry<T>::Inquiry(string _inquiryId, const T& _product, Side _side, long _quan
 }
 
 template<typename T>
-const string& Inquiry<T>::GetInquiryId() const
+const TradingId& Inquiry<T>::GetInquiryId() const
 {
 	return inquiryId;
 }
@@ -128,7 +136,7 @@ void Inquiry<T>::SetState(InquiryState _state)
 template<typename T>
 vector<string> Inquiry<T>::ToStrings() const
 {
-	string _inquiryId = inquiryId;
+	string _inquiryId = inquiryId.ToString();
 	string _product = product.GetProductId();
 	string _side;
 	switch (side)
@@ -163,6 +171,200 @@ vector<string> Inquiry<T>::ToStrings() const
 	return _strings;
 }
 
+/**
+* Inquiry events and the transition table of the inquiry state machine.
+* QUOTE_SENT: we quote (or requote) the client; QUOTE_ACCEPTED / QUOTE_REJECTED: the client answers
+* the quote; INQUIRY_REJECTED: we reject the inquiry.
+*/
+enum InquiryEvent { QUOTE_SENT, QUOTE_ACCEPTED, QUOTE_REJECTED, INQUIRY_REJECTED };
+
+const int INQUIRY_STATE_COUNT = 5;
+const int INQUIRY_EVENT_COUNT = 4;
+const int INVALID_TRANSITION = -1;
+
+// next state by current state and event
+const int inquiryTransitions[INQUIRY_STATE_COUNT][INQUIRY_EVENT_COUNT] = {
+	// QUOTE_SENT, QUOTE_ACCEPTED, QUOTE_REJECTED, INQUIRY_REJECTED
+	{ QUOTED, INVALID_TRANSITION, INVALID_TRANSITION, REJECTED },					// RECEIVED
+	{ QUOTED, DONE, CUSTOMER_REJECTED, REJECTED },									// QUOTED
+	{ INVALID_TRANSITION, INVALID_TRANSITION, INVALID_TRANSITION, INVALID_TRANSITION },	// DONE
+	{ INVALID_TRANSITION, INVALID_TRANSITION, INVALID_TRANSITION, INVALID_TRANSITION },	// REJECTED
+	{ INVALID_TRANSITION, INVALID_TRANSITION, INVALID_TRANSITION, INVALID_TRANSITION },	// CUSTOMER_REJECTED
+};
+
+// Is the state final?
+inline bool IsTerminal(InquiryState _state)
+{
+	return _state == DONE || _state == REJECTED || _state == CUSTOMER_REJECTED;
+}
+
+/**
+* Skew applied by the auto-quoter, in 1/256 ticks: per million of inquiry size, and per client side.
+*/
+struct QuoteSkew
+{
+	double ticksPerMillion = 0.25;
+	double buyTicks = 0.0;		// added to the offer shown to a buying client
+	double sellTicks = 0.0;		// taken off the bid shown to a selling client
+};
+
+/**
+* Auto-quoter for the RECEIVED inquiries, listening to the pricing service for the latest mid and spread.
+* A buying client is shown the offer (mid + half spread + skew, rounded up to a tick), a selling
+* client the bid (mid - half spread - skew, rounded down). An inquiry is refused if its product has
+* no price yet, or if pricing it takes longer than the latency budget.
+* The budget covers the time to quote, from when the quoter takes the inquiry to when its quote is
+* ready: the wait in the service's queue depends on the burst it came in, not on the quoter, and is
+* recorded apart (GetQueueLatency) without counting against the budget.
+* Type T is the product type.
+*/
+template<typename T>
+class AutoQuoter final : public ServiceListener<Price<T>>
+{
+
+public:
+
+	// ctor
+	AutoQuoter(const QuoteSkew& _skew = QuoteSkew(), chrono::nanoseconds _budget = chrono::microseconds(250));
+
+	// Listener callback to process an add event to the Service: keep the latest mid and spread
+	void ProcessAdd(Price<T>& _data);
+
+	// Listener callback to process a remove event to the Service
+	void ProcessRemove(Price<T>& _data);
+
+	// Listener callback to process an update event to the Service
+	void ProcessUpdate(Price<T>& _data);
+
+	// Price an inquiry received at _received (steady clock, ns); false if it is refused
+	bool Quote(const Inquiry<T>& _inquiry, int64_t _received, double& _price);
+
+	// Set the skew and the latency budget
+	void SetSkew(const QuoteSkew& _skew);
+	void SetBudget(chrono::nanoseconds _budget);
+
+	// Get the time to quote of the inquiries quoted
+	const LatencyStats& GetLatency() const;
+
+	// Get the time the inquiries priced waited in the queue, from their receipt to the quoter
+	const LatencyStats& GetQueueLatency() const;
+
+	// Get the number of inquiries quoted, refused for lack of a price, and refused over budget
+	long GetQuotedCount() const;
+	long GetUnpricedCount() const;
+	long GetLateCount() const;
+
+private:
+
+	// latest mid and spread by product id
+	unordered_map<string, pair<double, double>> prices;
+	QuoteSkew skew;
+	int64_t budget;
+	LatencyStats latency;
+	LatencyStats queueLatency;
+	long quotedCount;
+	long unpricedCount;
+	long lateCount;
+};
+
+template<typename T>
+AutoQuoter<T>::AutoQuoter(const QuoteSkew& _skew, chrono::nanoseconds _budget) :
+	skew(_skew)
+{
+	budget = _budget.count();
+	quotedCount = 0;
+	unpricedCount = 0;
+	lateCount = 0;
+}
+
+template<typename T>
+void AutoQuoter<T>::ProcessAdd(Price<T>& _data)
+{
+	prices[_data.GetProduct().GetProductId()] = { _data.GetMid(), _data.GetBidOfferSpread() };
+}
+
+// do nothing for these methods (not required)
+template<typename T>
+void AutoQuoter<T>::ProcessRemove(Price<T>& _data) {}
+
+template<typename T>
+void AutoQuoter<T>::ProcessUpdate(Price<T>& _data) {}
+
+template<typename T>
+bool AutoQuoter<T>::Quote(const Inquiry<T>& _inquiry, int64_t _received, double& _price)
+{
+	int64_t _start = SteadyNanoseconds();
+	auto _it = prices.find(_inquiry.GetProduct().GetProductId());
+	if (_it == prices.end()) {
+		unpricedCount++;
+		return false;
+	}
+
+	double _mid = _it->second.first;
+	double _halfSpread = _it->second.second / 2.0;
+	double _sizeTicks = skew.ticksPerMillion * (double)_inquiry.GetQuantity() / 1000000.0;
+	if (_inquiry.GetSide() == BUY) {
+		double _ticks = (_mid + _halfSpread) * TICKS_PER_POINT + _sizeTicks + skew.buyTicks;
+		_price = ceil(_ticks - 1e-9) / TICKS_PER_POINT;
+	}
+	else {
+		double _ticks = (_mid - _halfSpread) * TICKS_PER_POINT - _sizeTicks - skew.sellTicks;
+		_price = floor(_ticks + 1e-9) / TICKS_PER_POINT;
+	}
+
+	int64_t _elapsed = SteadyNanoseconds() - _start;
+	queueLatency.Record(_start - _received);
+	if (_elapsed > budget) {
+		lateCount++;
+		return false;
+	}
+	latency.Record(_elapsed);
+	quotedCount++;
+	return true;
+}
+
+template<typename T>
+void AutoQuoter<T>::SetSkew(const QuoteSkew& _skew)
+{
+	skew = _skew;
+}
+
+template<typename T>
+void AutoQuoter<T>::SetBudget(chrono::nanoseconds _budget)
+{
+	budget = _budget.count();
+}
+
+template<typename T>
+const LatencyStats& AutoQuoter<T>::GetLatency() const
+{
+	return latency;
+}
+
+template<typename T>
+const LatencyStats& AutoQuoter<T>::GetQueueLatency() const
+{
+	return queueLatency;
+}
+
+template<typename T>
+long AutoQuoter<T>::GetQuotedCount() const
+{
+	return quotedCount;
+}
+
+template<typename T>
+long AutoQuoter<T>::GetUnpricedCount() const
+{
+	return unpricedCount;
+}
+
+template<typename T>
+long AutoQuoter<T>::GetLateCount() const
+{
+	return lateCount;
+}
+
 /**
 * Pre-declearations to avoid errors.
 */
@@ -172,23 +374,39 @@ class InquiryConnector;
 /**
  * Service for customer inquirry objects.
  * Keyed on inquiry identifier (NOTE: this is NOT a product identifier since each inquiry must be unique).
+ * Inquiries move through the inquiryTransitions table. Incoming messages and our own actions are
+ * posted to a work queue as events and processed in order by Drain, so a transition that triggers
+ * another one (a quote answered by the client) never re-enters the service recursively.
+ * Listeners are notified when an inquiry reaches a final state (DONE, REJECTED, CUSTOMER_REJECTED),
+ * after which the service drops it: only the open inquiries are held, and a later event for it is
+ * refused as one for an unknown inquiry.
+ * Once its quoting listener is added to the pricing service, RECEIVED inquiries are priced by an
+ * AutoQuoter (and rejected when it refuses them); otherwise they are quoted back at their own price.
  * Type T is the product type.
  */
 template<typename T>
-class InquiryService : public Service<string, Inquiry <T> >
+class InquiryService : public Service<TradingId, Inquiry <T> >
 {
 
 public:
 
-	// Ctor
+	// Ctor and dtor
 	InquiryService();
+	~InquiryService();
 
 	// Get data on our service given a key
-	Inquiry<T>& GetData(string _key);
+	Inquiry<T>& GetData(const TradingId& _key);
 
-	// The callback that a Connector should invoke for any new or updated data
+	// The callback that a Connector should invoke for any new or updated data: post it and drain the queue
 	void OnMessage(Inquiry<T>& _data);
 
+	// Post an incoming inquiry message without processing it: a RECEIVED inquiry is registered and
+	// quoted at its price, a QUOTED / DONE answer accepts our quote and a CUSTOMER_REJECTED one rejects it
+	void Post(const Inquiry<T>& _data);
+
+	// Process the queued events (does nothing when called from within a transition)
+	void Drain();
+
 	// Add a listener to the Service for callbacks on add, remove, and update events for data to the Service
 	void AddListener(ServiceListener<Inquiry<T>>* _listener);
 
@@ -198,56 +416,172 @@ public:
 	// Get the connector of the service
 	InquiryConnector<T>* GetConnector();
 
+	// Get the auto-quoter, to be added as a listener to the pricing service (created on first use)
+	AutoQuoter<T>* GetQuotingListener();
+
 	// Send a quote back to the client
-	void SendQuote(const string& _inquiryId, double _price);
+	void SendQuote(const TradingId& _inquiryId, double _price);
 
 	// Reject an inquiry from the client
-	void RejectInquiry(const string& _inquiryId);
+	void RejectInquiry(const TradingId& _inquiryId);
+
+	// Get the number of inquiries currently in an open state, or that reached a final state
+	long GetStateCount(InquiryState _state) const;
+
+	// Get the number of inquiries held (the open ones)
+	size_t GetSize() const;
 
+	// Get the largest number of open (RECEIVED or QUOTED) inquiries so far
+	long GetMaxOpenCount() const;
+
+	// Get the number of transitions made, and of events refused (unknown inquiry or invalid transition)
+	long GetTransitionCount() const;
+	long GetInvalidCount() const;
 
 private:
 
-	map<string, Inquiry<T>> inquiries;
+	// received is the steady clock time (ns) of a RECEIVED inquiry to auto-quote, 0 otherwise
+	struct InquiryWork
+	{
+		TradingId inquiryId;
+		InquiryEvent event;
+		double price;
+		int64_t received;
+	};
+
+	// Apply one event
+	void Process(const InquiryWork& _work);
+
+	unordered_map<TradingId, Inquiry<T>> inquiries;
+	deque<InquiryWork> work;
+	bool draining;
+	array<long, INQUIRY_STATE_COUNT> stateCounts{};
+	long maxOpenCount;
+	long transitionCount;
+	long invalidCount;
 	vector<ServiceListener<Inquiry<T>>*> listeners;
 	InquiryConnector<T>* connector;
+	AutoQuoter<T>* quoter;
 };
 
 template<typename T>
 InquiryService<T>::InquiryService()
 {
-	inquiries = map<string, Inquiry<T>>();
+	inquiries = unordered_map<TradingId, Inquiry<T>>();
 	listeners = vector<ServiceListener<Inquiry<T>>*>();
 	connector = new InquiryConnector<T>(this);
+	quoter = nullptr;
+	draining = false;
+	maxOpenCount = 0;
+	transitionCount = 0;
+	invalidCount = 0;
 }
 
 template<typename T>
-Inquiry<T>& InquiryService<T>::GetData(string _key)
+InquiryService<T>::~InquiryService()
 {
-	return inquiries[_key];
+	delete quoter;
 }
 
+template<typename T>
+Inquiry<T>& InquiryService<T>::GetData(const TradingId& _key)
+{
+	return inquiries.at(_key);
+}
 
-// core function in this hpp
-// deals with the cases of RECEIVED AND QUOTED
-// then feedback to the listeners
 template<typename T>
 void InquiryService<T>::OnMessage(Inquiry<T>& _data)
 {
-	InquiryState _state = _data.GetState();
-	if (_state == RECEIVED) {
-		inquiries[_data.GetInquiryId()] = _data;
-		connector->Publish(_data);
+	Post(_data);
+	Drain();
+}
+
+template<typename T>
+void InquiryService<T>::Post(const Inquiry<T>& _data)
+{
+	const TradingId& _id = _data.GetInquiryId();
+	switch (_data.GetState())
+	{
+	case RECEIVED:
+		if (!inquiries.emplace(_id, _data).second) {
+			invalidCount++;
+			return;
+		}
+		stateCounts[RECEIVED]++;
+		maxOpenCount = max(maxOpenCount, stateCounts[RECEIVED] + stateCounts[QUOTED]);
+		work.push_back({ _id, QUOTE_SENT, _data.GetPrice(), quoter ? SteadyNanoseconds() : 0 });
+		break;
+	case QUOTED:
+	case DONE:
+		work.push_back({ _id, QUOTE_ACCEPTED, 0.0, 0 });
+		break;
+	case CUSTOMER_REJECTED:
+		work.push_back({ _id, QUOTE_REJECTED, 0.0, 0 });
+		break;
+	case REJECTED:
+		work.push_back({ _id, INQUIRY_REJECTED, 0.0, 0 });
+		break;
+	}
+}
+
+template<typename T>
+void InquiryService<T>::Drain()
+{
+	if (draining) {
+		return;
+	}
+	draining = true;
+	while (!work.empty())
+	{
+		InquiryWork _work = work.front();
+		work.pop_front();
+		Process(_work);
+	}
+	draining = false;
+}
+
+// core function in this hpp: one table lookup per event, then the side effects of the new state
+template<typename T>
+void InquiryService<T>::Process(const InquiryWork& _work)
+{
+	auto _it = inquiries.find(_work.inquiryId);
+	if (_it == inquiries.end()) {
+		invalidCount++;
+		return;
+	}
+	Inquiry<T>& _inquiry = _it->second;
+
+	// an inquiry to auto-quote is rejected if the quoter refuses it
+	InquiryEvent _event = _work.event;
+	double _price = _work.price;
+	if (_event == QUOTE_SENT && _work.received != 0 && quoter && !quoter->Quote(_inquiry, _work.received, _price)) {
+		_event = INQUIRY_REJECTED;
+	}
+
+	InquiryState _state = _inquiry.GetState();
+	int _next = inquiryTransitions[_state][_event];
+	if (_next == INVALID_TRANSITION) {
+		invalidCount++;
+		return;
 	}
 
-	// QUOTED --> DONE
-	if (_state == QUOTED) {
-		_data.SetState(DONE);
-		inquiries[_data.GetInquiryId()] = _data;
+	stateCounts[_state]--;
+	stateCounts[_next]++;
+	transitionCount++;
+	_inquiry.SetState((InquiryState)_next);
 
+	// the quote goes out to the client, whose answer comes back through the queue
+	if (_event == QUOTE_SENT) {
+		_inquiry.SetPrice(_price);
+		connector->Publish(_inquiry);
+	}
+
+	if (IsTerminal(_inquiry.GetState())) {
 		for (auto& l : listeners)
 		{
-			l->ProcessAdd(_data);
+			l->ProcessAdd(_inquiry);
 		}
+		inquiries.erase(_it);
 	}
 }
 
@@ -269,28 +603,59 @@ InquiryConnector<T>* InquiryService<T>::GetConnector()
 	return connector;
 }
 
-// send a quote
 template<typename T>
-void InquiryService<T>::SendQuote(const string& _inquiryId, double _price)
+AutoQuoter<T>* InquiryService<T>::GetQuotingListener()
 {
-	Inquiry<T>& _inquiry = inquiries[_inquiryId];
-	InquiryState _state = _inquiry.GetState();
-
-	// update the inquiry price, then register the listeners
-	_inquiry.SetPrice(_price);
-	for (auto& l : listeners)
-	{
-		l->ProcessAdd(_inquiry);
+	if (!quoter) {
+		quoter = new AutoQuoter<T>();
 	}
+	return quoter;
+}
+
+// send a quote
+template<typename T>
+void InquiryService<T>::SendQuote(const TradingId& _inquiryId, double _price)
+{
+	work.push_back({ _inquiryId, QUOTE_SENT, _price, 0 });
+	Drain();
 }
 
 // rejection of Inquiry
-// simply set the state as rejected.
 template<typename T>
-void InquiryService<T>::RejectInquiry(const string& _inquiryId)
+void InquiryService<T>::RejectInquiry(const TradingId& _inquiryId)
+{
+	work.push_back({ _inquiryId, INQUIRY_REJECTED, 0.0, 0 });
+	Drain();
+}
+
+template<typename T>
+long InquiryService<T>::GetStateCount(InquiryState _state) const
+{
+	return stateCounts[_state];
+}
+
+template<typename T>
+size_t InquiryService<T>::GetSize() const
+{
+	return inquiries.size();
+}
+
+template<typename T>
+long InquiryService<T>::GetMaxOpenCount() const
+{
+	return maxOpenCount;
+}
+
+template<typename T>
+long InquiryService<T>::GetTransitionCount() const
+{
+	return transitionCount;
+}
+
+template<typename T>
+long InquiryService<T>::GetInvalidCount() const
 {
-	Inquiry<T>& _inquiry = inquiries[_inquiryId];
-	_inquiry.SetState(REJECTED);
+	return invalidCount;
 }
 
 
@@ -319,7 +684,7 @@ public:
 	void Subscribe(ifstream& _data);
 
 	// Re-subscribe data from the Connector
-	// Needed for subscribing the data from inquiries after updating status
+	// Needed for subscribing the answer of the client to a quote
 	void Subscribe(Inquiry<T>& _data);
 
 };
@@ -330,12 +695,12 @@ InquiryConnector<T>::InquiryConnector(InquiryService<T>* _service)
 	service = _service;
 }
 
+// the quote is sent to the client, who accepts it: the QUOTED inquiry comes back as the answer
 template<typename T>
 void InquiryConnector<T>::Publish(Inquiry<T>& _data)
 {
-	if (_data.GetState() == RECEIVED)
+	if (_data.GetState() == QUOTED)
 	{
-		_data.SetState(QUOTED);
 		this->Subscribe(_data);
 	}
 }
@@ -346,16 +711,16 @@ template<typename T>
 void InquiryConnector<T>::Subscribe(ifstream& _data)
 {
 	string _line;
+	vector<string> _cells;
 	while (getline(_data, _line))
 	{
-		auto _cells = LineToCells(_line);
+		LineToCells(_line, _cells);
 
-		string _inquiryId = _cells[0];
-		string _productId = _cells[1];
+		const string& _productId = _cells[1];
 		Side _side = _cells[2] == "BUY" ? BUY : SELL;
 		long _quantity = stol(_cells[3]);
 		double _price = StringToPrice(_cells[4]);
-		InquiryState _state;
+		InquiryState _state = RECEIVED;
 		if (_cells[5] == "RECEIVED"){
 			_state = RECEIVED;
 		}
@@ -372,8 +737,7 @@ void InquiryConnector<T>::Subscribe(ifstream& _data)
 			_state = CUSTOMER_REJECTED;
 		}
 
-		T _product = FetchBond(_productId);
-		Inquiry<T> _inquiry(_inquiryId, _product, _side, _quantity, _price, _state);
+		Inquiry<T> _inquiry(_cells[0], FetchBond(_productId), _side, _quantity, _price, _state);
 		service->OnMessage(_inquiry);
 	}
 }
@@ -0,0 +1,96 @@
+/**
+* latencystats.hpp
+* Fixed-size latency histogram: 100 ns buckets up to 1 ms and one overflow bucket, so recording
+* is a division and an increment, and percentiles are read back without keeping the samples.
+*
+* @author James Wu
+*/
+#ifndef LATENCY_STATS_HPP
+#define LATENCY_STATS_HPP
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+class LatencyStats
+{
+
+public:
+
+	// width of a bucket and number of buckets (samples beyond go to the overflow bucket)
+	static constexpr int64_t BUCKET_NS = 100;
+	static constexpr int BUCKETS = 10000;
+
+	// ctor
+	LatencyStats();
+
+	// Record a latency (ns)
+	void Record(int64_t _ns);
+
+	// Get the number of samples
+	long GetCount() const;
+
+	// Get the mean and the largest latency (ns)
+	double GetMean() const;
+	int64_t GetMax() const;
+
+	// Get the latency (ns) under which a fraction _p of the samples fall, to the bucket's upper bound
+	int64_t GetPercentile(double _p) const;
+
+private:
+	vector<long> buckets;
+	long count;
+	double total;
+	int64_t max;
+};
+
+LatencyStats::LatencyStats() :
+	buckets(BUCKETS + 1, 0)
+{
+	count = 0;
+	total = 0.0;
+	max = 0;
+}
+
+void LatencyStats::Record(int64_t _ns)
+{
+	_ns = std::max<int64_t>(_ns, 0);
+	buckets[(size_t)std::min<int64_t>(_ns / BUCKET_NS, BUCKETS)]++;
+	count++;
+	total += (double)_ns;
+	max = std::max(max, _ns);
+}
+
+long LatencyStats::GetCount() const
+{
+	return count;
+}
+
+double LatencyStats::GetMean() const
+{
+	return count ? total / count : 0.0;
+}
+
+int64_t LatencyStats::GetMax() const
+{
+	return max;
+}
+
+// the overflow bucket reports the largest sample
+int64_t LatencyStats::GetPercentile(double _p) const
+{
+	long _rank = (long)(_p * count);
+	long _seen = 0;
+	for (int i = 0; i < BUCKETS; i++)
+	{
+		_seen += buckets[i];
+		if (_seen > _rank) {
+			return std::min((i + 1) * BUCKET_NS, max);
+		}
+	}
+	return max;
+}
+
+#endif
@@ -29,19 +29,45 @@ void initialize() {
 	GenerateAllInquiryData();
 }
 
+// number of trades held by the trade booking service
+const size_t TRADE_RETENTION = 1000;
+
+// time between two recorded events in a replay on simulated time
+const chrono::milliseconds REPLAY_STEP(100);
+
+// the bonds of the reference data (bondMap) and the sample data are from December 23rd, 2022:
+// risk is valued for settlement then, so that a replay gives the same risk whatever the day
+const date SETTLEMENT_DATE(2022, Dec, 23);
+
 /* We implement the Bond services by specifiying T as Bond in the templates
 specified by the header files.
 */
 
-int main() {
+int main(int argc, char* argv[]) {
 	std::cout << GetTimeStamp() << " Program Started. " << std::endl;
-	initialize(); // run if there are no existing data txts
+
+	// an optional argument points to a folder of recorded inputs (e.g. SampleData) to replay;
+	// otherwise fresh input data is generated in the working directory.
+	string dataPath = argc > 1 ? string(argv[1]) + "/" : "";
+	if (dataPath.empty()) {
+		initialize();
+	}
 	std::cout << GetTimeStamp() << " Data Prepared." << std::endl;
 
+	// a second argument "simulated" replays on simulated time, from now on and REPLAY_STEP per
+	// recorded event, so that throttles and timestamps follow the events instead of the machine.
+	// The clock is installed before the services are built.
+	bool simulated = argc > 2 && string(argv[2]) == "simulated";
+	SimulatedClock replayClock(RealClock().Now());
+	if (simulated) {
+		SetClock(&replayClock);
+	}
+
 	// 1) Service initialization. Take T as bonds.
 	MarketDataService<Bond> BondMarketDataService;
 	PricingService<Bond> BondPricingService;
-	TradeBookingService<Bond> BondTradeBookingService;
+	// only the latest trades are kept in memory, older ones go to the historical trade service
+	TradeBookingService<Bond> BondTradeBookingService(TradeRetention::Last(TRADE_RETENTION));
 	PositionService<Bond> BondPositionService;
 	RiskService<Bond> BondRiskService;
 	AlgoExecutionService<Bond> BondAlgoExecutionService;
@@ -58,11 +84,22 @@ int main() {
 	HistoricalDataService<ExecutionOrder<Bond>> histExecutionService(EXECUTION);
 	HistoricalDataService<PriceStream<Bond>> histStreamingService(STREAMING);
 	HistoricalDataService<Inquiry<Bond>> histInquiryService(INQUIRY);
+	HistoricalDataService<Trade<Bond>> histTradeService(TRADE);
 	std::cout << "Historical services initialized.\n";
 
 	// 3) linking using listeners (so many links though)
 	std::cout << GetTimeStamp() << " Services Linking... " << std::endl;
 
+	// 3.0 on simulated time, the clock moves with the recorded prices, books and trades (before anything else sees them)
+	ReplayPacer<Price<Bond>> pricePacer(&replayClock, REPLAY_STEP);
+	ReplayPacer<OrderBook<Bond>> marketDataPacer(&replayClock, REPLAY_STEP);
+	ReplayPacer<Trade<Bond>> tradePacer(&replayClock, REPLAY_STEP);
+	if (simulated) {
+		BondPricingService.AddListener(&pricePacer);
+		BondMarketDataService.AddListener(&marketDataPacer);
+		BondTradeBookingService.AddListener(&tradePacer);
+	}
+
 	// 3.1 GUI listens to PricingService
 	BondPricingService.AddListener(BondGUIService.GetListener());
 	
@@ -72,35 +109,52 @@ int main() {
 	BondStreamingService.AddListener(histStreamingService.GetServiceListener());
 
 	// 3.3 histExe -> Exe -> AlgoExe -> MarketData
+	// the recorded feed is BrokerTec's; its books reach the order router before the algo trades on them
+	BondMarketDataService.AddListener(BondExecutionService.GetVenueListener(BROKERTEC));
 	BondMarketDataService.AddListener(BondAlgoExecutionService.GetListener());
 	BondAlgoExecutionService.AddListener(BondExecutionService.GetListener());
 	BondExecutionService.AddListener(histExecutionService.GetServiceListener());
 
-	// 3.4 TradeBooking -> Execution.
-	BondExecutionService.AddListener(BondTradeBookingService.GetListener());
+	// 3.4 TradeBooking -> Execution, booking the fills of the orders.
+	BondExecutionService.AddFillListener(BondTradeBookingService.GetListener());
 
 	// 3.5 histPos & histRisk -> Pos & Risk; Risk -> Pos and Pos -> Trade Booking
 	BondTradeBookingService.AddListener(BondPositionService.GetListener());
 	BondPositionService.AddListener(BondRiskService.GetListener());
 	BondPositionService.AddListener(histPositionService.GetServiceListener());
 	BondRiskService.AddListener(histRiskService.GetServiceListener());
+	BondTradeBookingService.SetEvictionListener(histTradeService.GetServiceListener());
 
-	// 3.6 histInquiry -> inquiry
+	// Risk -> Pricing, for the analytic PV01 at the latest prices
+	BondRiskService.GetRiskEngine().SetSettlementDate(SETTLEMENT_DATE);
+	BondPricingService.AddListener(BondRiskService.GetPricingListener());
+
+	// 3.6 histInquiry -> inquiry; inquiries are quoted from the latest prices
 	BondInquiryService.AddListener(histInquiryService.GetServiceListener());
+	BondPricingService.AddListener(BondInquiryService.GetQuotingListener());
+
+	// 3.7 bucketed risk sectors aggregated by the risk service
+	BucketedSector<Bond> frontEnd({ FetchBond(2), FetchBond(3) }, "FrontEnd");
+	BucketedSector<Bond> belly({ FetchBond(5), FetchBond(7), FetchBond(10) }, "Belly");
+	BucketedSector<Bond> longEnd({ FetchBond(20), FetchBond(30) }, "LongEnd");
+	BondRiskService.AddBucketedSector(frontEnd);
+	BondRiskService.AddBucketedSector(belly);
+	BondRiskService.AddBucketedSector(longEnd);
 	std::cout << GetTimeStamp() << " Services linked successfully." << std::endl;
 
 	// preload data
 	std::cout << GetTimeStamp() << " Linking with data..." << std::endl;
-	ifstream priceData("prices.txt");
-	ifstream tradeData("trades.txt");
-	ifstream inquiryData("inquiries.txt");
-	ifstream marketData("marketdata.txt");
+	ifstream priceData(dataPath + "prices.txt");
+	ifstream tradeData(dataPath + "trades.txt");
+	ifstream inquiryData(dataPath + "inquiries.txt");
+	ifstream marketData(dataPath + "marketdata.txt");
 	std::cout << GetTimeStamp() << " Data linked successfully. Start data processing..." << std::endl;
 
 	// 4) Recording into local files.
 	// 4.1 reading prices, update streaming data
 	std::cout << GetTimeStamp() << " Processing Price data..." << std::endl;
 	BondPricingService.GetConnector()->Subscribe(priceData);
+	BondRiskService.Rerisk();
 	std::cout << GetTimeStamp() << " Price data processed successfully!" << std::endl;
 
 	// 4.2 reading trade data, update position and risk
@@ -111,14 +165,36 @@ int main() {
 	// 4.3 reading market data, update executions
 	std::cout << GetTimeStamp() << " Processing Market data..." << std::endl;
 	BondMarketDataService.GetConnector()->Subscribe(marketData);
+	BondAlgoExecutionService.Drain();		// the slices still scheduled when the feed ends
 	std::cout << GetTimeStamp() << " Market data processed successfully!" << std::endl;
+	const SmartOrderRouter<Bond>& router = BondExecutionService.GetRouter();
+	std::cout << GetTimeStamp() << " Orders routed: " << router.GetRoutedCount() << " into " << router.GetChildCount()
+		<< " child orders, " << router.GetRejectedCount() << " rejected, routing time (us) mean " << router.GetLatency().GetMean() / 1000.0
+		<< ", p99 " << router.GetLatency().GetPercentile(0.99) / 1000.0 << ", max " << router.GetLatency().GetMax() / 1000.0 << std::endl;
 
 	// 4.4 reading inquiry data, update all inquiries
 	std::cout << GetTimeStamp() << " Processing inquiry data..." << std::endl;
 	BondInquiryService.GetConnector()->Subscribe(inquiryData);
 	std::cout << GetTimeStamp() << " Inquiry data processed successfully!" << std::endl;
-
-	// 4.5 Finished!
+	const AutoQuoter<Bond>* quoter = BondInquiryService.GetQuotingListener();
+	std::cout << GetTimeStamp() << " Inquiries quoted: " << quoter->GetQuotedCount() << ", refused (no price / over budget): "
+		<< quoter->GetUnpricedCount() << " / " << quoter->GetLateCount() << ", time to quote (us) mean "
+		<< quoter->GetLatency().GetMean() / 1000.0 << ", p99 " << quoter->GetLatency().GetPercentile(0.99) / 1000.0
+		<< ", max " << quoter->GetLatency().GetMax() / 1000.0 << ", queue wait (us) mean " << quoter->GetQueueLatency().GetMean() / 1000.0 << std::endl;
+
+	// 4.5 report the bucketed and portfolio risk
+	for (auto& sector : { frontEnd, belly, longEnd }) {
+		std::cout << GetTimeStamp() << " Bucketed risk " << sector.GetName() << ": " << to_string(BondRiskService.GetBucketedRisk(sector).GetPV01()) << std::endl;
+	}
+	PortfolioRisk portfolioRisk = BondRiskService.GetPortfolioRisk();
+	for (int k = 0; k < BOOK_COUNT; k++) {
+		std::cout << GetTimeStamp() << " Book risk " << bookNames[k] << ": " << to_string(portfolioRisk.books[k]) << std::endl;
+	}
+	std::cout << GetTimeStamp() << " Portfolio risk: " << to_string(portfolioRisk.total) << std::endl;
+
+	// 4.6 Finished!
 	std::cout << GetTimeStamp() << " Finished the tasks, now exiting the program..." << std::endl;
+#ifdef _WIN32
 	system("pause");
+#endif
 }
\ No newline at end of file
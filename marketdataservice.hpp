@@ -12,7 +12,12 @@
 #include <vector>
 #include <unordered_map>
 #include <map>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <chrono>
 #include "soa.hpp"
+#include "snapshottable.hpp"
 #include "utilityfunctions.hpp"
 
 
@@ -74,6 +79,7 @@ private:
 
 /**
  * Order book with a bid and offer stack.
+ * The product is held as a handle to its interned copy (see ProductRegistry).
  * Type T is the product type.
  */
 template<typename T>
@@ -85,10 +91,15 @@ public:
 	// ctor for the order book
 	OrderBook()=default;
 	OrderBook(const T& _product, const vector<Order>& _bidStack, const vector<Order>& _offerStack);
+	OrderBook(const T& _product, vector<Order>&& _bidStack, vector<Order>&& _offerStack);
+	OrderBook(const T* _product, vector<Order>&& _bidStack, vector<Order>&& _offerStack);
 
 	// Get the product
 	const T& GetProduct() const;
 
+	// Get the handle of the (interned) product
+	const T* GetProductHandle() const;
+
 	// Get the bid stack
 	const vector<Order>& GetBidStack() const;
 
@@ -98,12 +109,64 @@ public:
 	// Get the best bid/offer order (the ones at the top)
 	const BidOffer GetBidOffer() const;
 
+	// Move the stacks out into the given vectors, cleared but keeping their capacity,
+	// so that the buffers can be filled again for the next book
+	void ReleaseStacks(vector<Order>& _bidStack, vector<Order>& _offerStack);
+
 private:
-	T product;
+	const T* product = ProductRegistry<T>::Default();
 	vector<Order> bidStack;
 	vector<Order> offerStack;
 };
 
+// prices are quoted in ticks of 1/256
+const int TICKS_PER_POINT = 256;
+
+inline int32_t PriceToTicks(double _price)
+{
+	return (int32_t)lround(_price * TICKS_PER_POINT);
+}
+
+inline double TicksToPrice(int32_t _ticks)
+{
+	return (double)_ticks / TICKS_PER_POINT;
+}
+
+/**
+ * Compact top-of-book event for the market data hot path: the product handle, the best bid
+ * and offer in ticks with their quantities, and when the book was received (steady clock, ns).
+ * Trivially copyable; the full Bond is only resolved through the handle when needed.
+ * Type T is the product type.
+ */
+template<typename T>
+struct TopOfBook
+{
+	const T* product;
+	int64_t timestamp;
+	int64_t bidQuantity;
+	int64_t offerQuantity;
+	int32_t bidTicks;
+	int32_t offerTicks;
+};
+
+static_assert(sizeof(TopOfBook<Bond>) <= 64, "TopOfBook must fit a cache line");
+static_assert(is_trivially_copyable<TopOfBook<Bond>>::value, "TopOfBook must be trivially copyable");
+
+// top of an order book
+template<typename T>
+TopOfBook<T> MakeTopOfBook(const OrderBook<T>& _orderBook, int64_t _timestamp = 0)
+{
+	BidOffer _bidOffer = _orderBook.GetBidOffer();
+	TopOfBook<T> _top;
+	_top.product = _orderBook.GetProductHandle();
+	_top.timestamp = _timestamp;
+	_top.bidQuantity = _bidOffer.GetBidOrder().GetQuantity();
+	_top.offerQuantity = _bidOffer.GetOfferOrder().GetQuantity();
+	_top.bidTicks = PriceToTicks(_bidOffer.GetBidOrder().GetPrice());
+	_top.offerTicks = PriceToTicks(_bidOffer.GetOfferOrder().GetPrice());
+	return _top;
+}
+
 // pre-declaration of connector, to avoid errors
 template <typename T>
 class MarketDataConnector;
@@ -111,6 +174,8 @@ class MarketDataConnector;
 /**
  * Market Data Service which distributes market data
  * Keyed on product identifier.
+ * The top of each book is also published to a SnapshotTable, which other threads (GUI, monitoring)
+ * read through GetSnapshot without blocking the service.
  * Type T is the product type.
  */
 template<typename T>
@@ -122,8 +187,11 @@ public:
 	MarketDataService();
 	~MarketDataService();
 
-	// fetch orderbook with given product id
-	OrderBook<T>& GetData(string _key);
+	// fetch orderbook with given product id (throws out_of_range for a product never seen)
+	OrderBook<T>& GetData(const string& _key);
+
+	// copy the latest top of book of a product, safe from any thread; false if never seen
+	bool GetSnapshot(const string& _productId, TopOfBook<T>& _top) const;
 
 	// call back function for the connector
 	void OnMessage(OrderBook<T>& _data);
@@ -148,6 +216,7 @@ public:
 
 private:
 	map<string, OrderBook<T>> orderBooks;
+	SnapshotTable<TopOfBook<T>> snapshots;
 	vector<ServiceListener<OrderBook<T>>*> listeners;
 	MarketDataConnector<T>* connector;
 	int bookDepth;
@@ -190,12 +259,30 @@ const Order& BidOffer::GetOfferOrder() const
 
 template<typename T>
 OrderBook<T>::OrderBook(const T& _product, const vector<Order>& _bidStack, const vector<Order>& _offerStack) :
-	product(_product), bidStack(_bidStack), offerStack(_offerStack)
+	product(ProductRegistry<T>::Intern(_product)), bidStack(_bidStack), offerStack(_offerStack)
+{
+}
+
+template<typename T>
+OrderBook<T>::OrderBook(const T& _product, vector<Order>&& _bidStack, vector<Order>&& _offerStack) :
+	OrderBook(ProductRegistry<T>::Intern(_product), move(_bidStack), move(_offerStack))
+{
+}
+
+template<typename T>
+OrderBook<T>::OrderBook(const T* _product, vector<Order>&& _bidStack, vector<Order>&& _offerStack) :
+	product(_product), bidStack(move(_bidStack)), offerStack(move(_offerStack))
 {
 }
 
 template<typename T>
 const T& OrderBook<T>::GetProduct() const
+{
+	return *product;
+}
+
+template<typename T>
+const T* OrderBook<T>::GetProductHandle() const
 {
 	return product;
 }
@@ -239,6 +326,15 @@ const BidOffer OrderBook<T>::GetBidOffer() const {
 	return BidOffer(highest_bid, lowest_offer);
 }
 
+template<typename T>
+void OrderBook<T>::ReleaseStacks(vector<Order>& _bidStack, vector<Order>& _offerStack)
+{
+	_bidStack = move(bidStack);
+	_offerStack = move(offerStack);
+	_bidStack.clear();
+	_offerStack.clear();
+}
+
 // implementation of marketDataService classes
 
 template<typename T>
@@ -257,15 +353,24 @@ MarketDataService<T>::~MarketDataService()
 }
 
 template<typename T>
-OrderBook<T>& MarketDataService<T>::GetData(string _key)
+OrderBook<T>& MarketDataService<T>::GetData(const string& _key)
+{
+	return orderBooks.at(_key);
+}
+
+template<typename T>
+bool MarketDataService<T>::GetSnapshot(const string& _productId, TopOfBook<T>& _top) const
 {
-	return orderBooks[_key];
+	return snapshots.Read(_productId, _top);
 }
 
+// the snapshot is stamped with the steady clock (ns) so that readers can tell its age
 template<typename T>
 void MarketDataService<T>::OnMessage(OrderBook<T>& _data) {
-	string product_id = _data.GetProduct().GetProductId();
-	orderBooks[product_id] = _data;
+	const string& _productId = _data.GetProduct().GetProductId();
+	orderBooks.insert_or_assign(_productId, _data);
+	int64_t _now = CurrentClock().Steady();
+	snapshots.Publish(_productId, MakeTopOfBook(_data, _now));
 
 	for (auto& listener : listeners) {
 		listener->ProcessAdd(_data);
@@ -299,7 +404,7 @@ int MarketDataService<T>::GetOrderBookDepth() const {
 // Get the best bid/offer order
 template<typename T>
 const BidOffer MarketDataService<T>::GetBestBidOffer(const string& _id) {
-	return orderBooks[_id].GetBidOffer();
+	return orderBooks.at(_id).GetBidOffer();
 }
 
 // Aggregate the order book
@@ -376,14 +481,19 @@ void MarketDataConnector<T>::Subscribe(ifstream& _data)
 	int _thread = bookDepth * 2;
 	long orderCount = 0;	// keep track of total orders added
 
+	// the stacks are moved into each book and taken back once it has been published,
+	// so after the first book no buffer is allocated again
 	vector<Order> bidStack;
 	vector<Order> offerStack;
+	bidStack.reserve(bookDepth);
+	offerStack.reserve(bookDepth);
 	string line;
+	vector<string> _cells;
 
 	while (getline(_data, line))
 	{
 		string _productId;
-		vector<string> _cells = LineToCells(line);
+		LineToCells(line, _cells);
 
 		// process data
 		_productId = _cells[0];
@@ -408,13 +518,11 @@ void MarketDataConnector<T>::Subscribe(ifstream& _data)
 		// since both BID and ASK offers have been processed
 		if (orderCount % _thread == 0)
 		{
-			T _product = FetchBond(_productId);
-			OrderBook<T> tmpOrderBook(_product, bidStack, offerStack);
+			OrderBook<T> tmpOrderBook(InternBond(_productId), move(bidStack), move(offerStack));
 			service->OnMessage(tmpOrderBook);
 
-			// reset, empty the stacks.
-			bidStack = vector<Order>();
-			offerStack = vector<Order>();
+			// take the (emptied) stacks back for the next book.
+			tmpOrderBook.ReleaseStacks(bidStack, offerStack);
 		}
 	}
 }
@@ -0,0 +1,779 @@
+/**
+* matchingengine.hpp
+* Price-time priority matching of execution orders against an internal book per product.
+* The price levels of a book are kept in a ladder indexed by tick offset around a center that moves
+* with the market (as TickLadderBook), and each level queues its orders in arrival order. Orders
+* live in a pool and are linked into their level, so resting, cancelling and matching an order
+* are O(1) and allocate nothing once the pool has grown to the day's peak.
+*
+* @author James Wu
+*/
+#ifndef MATCHING_ENGINE_HPP
+#define MATCHING_ENGINE_HPP
+
+#include <cstdint>
+#include <climits>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <stdexcept>
+#include "algoexecutionservice.hpp"
+
+using namespace std;
+
+// handle of an order left on a book: pool index and generation, so a stale handle is recognized
+typedef uint64_t OrderHandle;
+
+const OrderHandle INVALID_ORDER = 0;
+
+/**
+* What a match reports of each of its orders; the quantity is the whole order's.
+*/
+struct MatchedOrder
+{
+	TradingId orderId;
+	TradingId parentOrderId;
+	OrderType orderType;
+	PricingSide side;
+	Market market;
+	bool isChildOrder;
+	long quantity;
+};
+
+/**
+* A match between an incoming order and an order resting on the book, at the resting order's price.
+* The quantities left are those of each order once the match is done.
+*/
+struct Match
+{
+	const MatchedOrder* aggressor;
+	const MatchedOrder* resting;
+	PricingSide aggressorSide;
+	int32_t ticks;
+	long quantity;
+	long aggressorLeaves;
+	long restingLeaves;
+};
+
+/**
+* Matching engine with one price-time priority book per product.
+* As for the order router, an OFFER order buys (lifts the offers) and a BID order sells (hits the
+* bids); buy orders left on the book are its bids and sell orders its offers. The order types are
+* honored as follows:
+* - LIMIT matches up to its price and rests the remainder on the book;
+* - MARKET matches at any price and cancels the remainder;
+* - IOC matches up to its price and cancels the remainder;
+* - FOK matches up to its price only if the whole order can be filled, and is rejected otherwise;
+* - STOP waits off the book until a trade of the product reaches its price (at or above for a buy,
+*   at or below for a sell), then goes in as a MARKET order.
+* A resting order with hidden quantity shows its visible quantity; when that is taken, as much again
+* is shown from the hidden quantity, at the back of the level's queue.
+* An order ends when it is filled (a match leaves it nothing) or when what is left of it is cancelled:
+* a MARKET, IOC or triggered stop remainder, a rejected FOK, or a Cancel. The cancellation callbacks
+* are called with the order and the quantity cancelled, so that the caller can close the order.
+* Type T is the product type.
+*/
+template<typename T>
+class MatchingEngine
+{
+
+public:
+
+	// ctor, with the number of ticks each book covers before its center moves
+	MatchingEngine(int _window = 512);
+
+	// Match an order against the book of its product, calling _match(const Match&) on each match and
+	// _cancelled(const MatchedOrder&, long) on each order ending with quantity cancelled (this one, or
+	// the stops it triggers), neither of which may submit to the engine; returns the handle of what is
+	// left of the order if it rests on the book or waits as a stop, INVALID_ORDER otherwise
+	template<typename F, typename G>
+	OrderHandle Submit(const ExecutionOrder<T>& _order, F&& _match, G&& _cancelled);
+	template<typename F>
+	OrderHandle Submit(const ExecutionOrder<T>& _order, F&& _match);
+
+	// Cancel a resting order or a waiting stop, calling _cancelled(const MatchedOrder&, long) with what
+	// was left of it; false if it was filled or cancelled already
+	template<typename G>
+	bool Cancel(OrderHandle _order, G&& _cancelled);
+	bool Cancel(OrderHandle _order);
+
+	// Get the best bid/offer of a product's book and the quantity there; false if that side is empty
+	bool GetBestBid(const string& _productId, int32_t& _ticks, long& _quantity) const;
+	bool GetBestOffer(const string& _productId, int32_t& _ticks, long& _quantity) const;
+
+	// Get the price of the last trade of a product; false if it never traded
+	bool GetLastTrade(const string& _productId, int32_t& _ticks) const;
+
+	// Get the number of orders submitted, of matches and of the quantity matched
+	long GetOrderCount() const;
+	long GetMatchCount() const;
+	long GetMatchedQuantity() const;
+
+	// Get the number of FOK orders rejected, and the quantity cancelled (MARKET and IOC remainders, cancels)
+	long GetRejectedCount() const;
+	long GetCancelledQuantity() const;
+
+	// Get the number of stops triggered
+	long GetTriggeredCount() const;
+
+	// Get the number of orders resting on the books, and of stops waiting
+	size_t GetRestingCount() const;
+	size_t GetStopCount() const;
+
+private:
+
+	static constexpr uint32_t NIL = UINT32_MAX;
+	static constexpr int32_t NO_LEVEL = -1;
+	// the sides of a book: bids (buy orders) and offers (sell orders)
+	static constexpr int BIDS = 0;
+	static constexpr int OFFERS = 1;
+
+	enum NodeState : uint8_t { NODE_FREE, NODE_RESTING, NODE_STOP };
+
+	struct Node
+	{
+		MatchedOrder order;
+		long visible = 0;
+		long hidden = 0;
+		long display = 0;
+		int32_t ticks = 0;
+		uint32_t book = 0;
+		uint32_t next = NIL;
+		uint32_t prev = NIL;
+		uint32_t generation = 1;
+		uint8_t side = BIDS;
+		NodeState state = NODE_FREE;
+	};
+
+	struct Level
+	{
+		uint32_t head = NIL;
+		uint32_t tail = NIL;
+		long quantity = 0;
+	};
+
+	// levels of both sides over the same window; low and high bound the occupied indexes of both
+	struct Book
+	{
+		int window = 0;
+		int32_t base = 0;
+		vector<Level> levels[2];
+		int32_t best[2] = { NO_LEVEL, NO_LEVEL };
+		int32_t low = 0;
+		int32_t high = -1;
+		uint32_t stopHead = NIL;
+		uint32_t stopTail = NIL;
+		// the nearest stop price of each side: the lowest buy stop and the highest sell stop
+		int32_t stopTicks[2] = { INT32_MAX, INT32_MIN };
+		int32_t lastTicks = 0;
+		bool traded = false;
+	};
+
+	// the book of a product, created on first use
+	uint32_t FindBook(const string& _productId);
+	const Book* FindBook(const string& _productId) const;
+
+	// index of a price in a book, or NO_LEVEL if it is outside the window
+	int32_t Index(const Book& _book, int32_t _ticks) const;
+
+	// move the center of a book (and grow its window if needed) so that _ticks and the occupied levels fit
+	void Recenter(Book& _book, int32_t _ticks);
+
+	// is the price of a level of side _side better than (or as good as) _limit for an order taking it?
+	bool Reaches(int _side, int32_t _levelTicks, int32_t _limit) const;
+
+	// quantity of the other side an order of _side can take, up to _quantity
+	long Available(const Book& _book, int _side, bool _limited, int32_t _limit, long _quantity) const;
+
+	// match an order of _side against the other side of a book; returns the quantity left
+	template<typename F>
+	long Take(uint32_t _book, int _side, bool _limited, int32_t _limit, long _quantity, const MatchedOrder& _order, F&& _match);
+
+	// rest an order on a book
+	OrderHandle Rest(uint32_t _book, int _side, int32_t _ticks, long _quantity, long _display, const MatchedOrder& _order);
+
+	// park a stop order off the book
+	OrderHandle Park(uint32_t _book, int _side, int32_t _ticks, long _quantity, const MatchedOrder& _order);
+
+	// has the last trade of a book reached the price of a stop of _side?
+	bool Triggered(const Book& _book, int _side, int32_t _ticks) const;
+
+	// send the stops of a book triggered by its last trade as MARKET orders, in arrival order
+	template<typename F, typename G>
+	void FireStops(uint32_t _book, F&& _match, G&& _cancelled);
+
+	// link a node at the back of a level, and unlink it
+	void LinkLevel(Book& _book, uint32_t _index);
+	void UnlinkLevel(Book& _book, uint32_t _index);
+
+	// after a level of a side emptied: move the best price to the next level and shrink the occupied range
+	void Emptied(Book& _book, int _side, int32_t _level);
+
+	uint32_t Allocate();
+	void Release(uint32_t _index);
+	OrderHandle Handle(uint32_t _index) const;
+
+	int window;
+	unordered_map<string, uint32_t> bookIndex;
+	vector<Book> books;
+	vector<Node> nodes;
+	uint32_t freeList;
+	size_t restingCount;
+	size_t stopCount;
+	long orderCount;
+	long matchCount;
+	long matchedQuantity;
+	long rejectedCount;
+	long cancelledQuantity;
+	long triggeredCount;
+};
+
+template<typename T>
+MatchingEngine<T>::MatchingEngine(int _window)
+{
+	if (_window <= 0) {
+		throw invalid_argument("book window must be positive");
+	}
+	window = 2;
+	while (window < _window) {
+		window *= 2;
+	}
+	freeList = NIL;
+	restingCount = 0;
+	stopCount = 0;
+	orderCount = 0;
+	matchCount = 0;
+	matchedQuantity = 0;
+	rejectedCount = 0;
+	cancelledQuantity = 0;
+	triggeredCount = 0;
+}
+
+template<typename T>
+uint32_t MatchingEngine<T>::FindBook(const string& _productId)
+{
+	auto _it = bookIndex.find(_productId);
+	if (_it != bookIndex.end()) {
+		return _it->second;
+	}
+	Book _book;
+	_book.window = window;
+	_book.levels[BIDS].assign(window, Level());
+	_book.levels[OFFERS].assign(window, Level());
+	_book.low = window;
+	books.push_back(move(_book));
+	bookIndex.emplace(_productId, (uint32_t)(books.size() - 1));
+	return (uint32_t)(books.size() - 1);
+}
+
+template<typename T>
+const typename MatchingEngine<T>::Book* MatchingEngine<T>::FindBook(const string& _productId) const
+{
+	auto _it = bookIndex.find(_productId);
+	return _it == bookIndex.end() ? nullptr : &books[_it->second];
+}
+
+template<typename T>
+int32_t MatchingEngine<T>::Index(const Book& _book, int32_t _ticks) const
+{
+	int64_t _index = (int64_t)_ticks - _book.base;
+	return (_index >= 0 && _index < _book.window) ? (int32_t)_index : NO_LEVEL;
+}
+
+// an empty book is simply rebased; otherwise the occupied levels keep half the window as room to move.
+// Orders hold their price, not their level, so moving the levels moves their queues with them.
+template<typename T>
+void MatchingEngine<T>::Recenter(Book& _book, int32_t _ticks)
+{
+	if (_book.low > _book.high)
+	{
+		_book.base = _ticks - _book.window / 2;
+		return;
+	}
+
+	int64_t _low = min<int64_t>(_book.base + _book.low, _ticks);
+	int64_t _high = max<int64_t>(_book.base + _book.high, _ticks);
+	int _window = _book.window;
+	while (2 * (_high - _low + 1) > _window) {
+		_window *= 2;
+	}
+	int32_t _base = (int32_t)((_low + _high) / 2 - _window / 2);
+	int32_t _shift = _book.base - _base;
+
+	for (int s = BIDS; s <= OFFERS; s++)
+	{
+		vector<Level> _levels(_window, Level());
+		copy(_book.levels[s].begin() + _book.low, _book.levels[s].begin() + _book.high + 1, _levels.begin() + _book.low + _shift);
+		_book.levels[s].swap(_levels);
+		if (_book.best[s] != NO_LEVEL) {
+			_book.best[s] += _shift;
+		}
+	}
+	_book.window = _window;
+	_book.base = _base;
+	_book.low += _shift;
+	_book.high += _shift;
+}
+
+template<typename T>
+bool MatchingEngine<T>::Reaches(int _side, int32_t _levelTicks, int32_t _limit) const
+{
+	return _side == BIDS ? _levelTicks <= _limit : _levelTicks >= _limit;
+}
+
+template<typename T>
+long MatchingEngine<T>::Available(const Book& _book, int _side, bool _limited, int32_t _limit, long _quantity) const
+{
+	int _other = 1 - _side;
+	int _step = _other == BIDS ? -1 : 1;
+	long _available = 0;
+	for (int32_t i = _book.best[_other]; i != NO_LEVEL && i >= _book.low && i <= _book.high && _available < _quantity; i += _step)
+	{
+		if (_limited && !Reaches(_side, _book.base + i, _limit)) {
+			break;
+		}
+		_available += _book.levels[_other][i].quantity;
+	}
+	return _available;
+}
+
+template<typename T>
+bool MatchingEngine<T>::Triggered(const Book& _book, int _side, int32_t _ticks) const
+{
+	return _book.traded && (_side == BIDS ? _book.lastTicks >= _ticks : _book.lastTicks <= _ticks);
+}
+
+template<typename T>
+template<typename F>
+OrderHandle MatchingEngine<T>::Submit(const ExecutionOrder<T>& _order, F&& _match)
+{
+	return Submit(_order, _match, [](const MatchedOrder&, long) {});
+}
+
+template<typename T>
+template<typename F, typename G>
+OrderHandle MatchingEngine<T>::Submit(const ExecutionOrder<T>& _order, F&& _match, G&& _cancelled)
+{
+	orderCount++;
+	long _quantity = _order.GetVisibleQuantity() + _order.GetHiddenQuantity();
+	if (_quantity <= 0) {
+		return INVALID_ORDER;
+	}
+
+	uint32_t _book = FindBook(_order.GetProduct().GetProductId());
+	int _side = _order.GetPricingSide() == OFFER ? BIDS : OFFERS;
+	int32_t _ticks = PriceToTicks(_order.GetPrice());
+	OrderType _type = _order.GetOrderType();
+	MatchedOrder _matched{ _order.GetOrderId(), _order.GetParentOrderId(), _type, _order.GetPricingSide(), _order.GetMarket(), _order.IsChildOrder(), _quantity };
+
+	if (_type == STOP)
+	{
+		if (!Triggered(books[_book], _side, _ticks)) {
+			return Park(_book, _side, _ticks, _quantity, _matched);
+		}
+		triggeredCount++;
+		_type = MARKET;
+	}
+
+	bool _limited = _type != MARKET;
+	if (_type == FOK && Available(books[_book], _side, true, _ticks, _quantity) < _quantity)
+	{
+		rejectedCount++;
+		_cancelled(_matched, _quantity);
+		return INVALID_ORDER;
+	}
+
+	long _matches = matchCount;
+	long _left = Take(_book, _side, _limited, _ticks, _quantity, _matched, _match);
+	OrderHandle _handle = INVALID_ORDER;
+	if (_left > 0 && _type == LIMIT)
+	{
+		long _display = _order.GetVisibleQuantity() > 0 ? _order.GetVisibleQuantity() : _quantity;
+		_handle = Rest(_book, _side, _ticks, _left, _display, _matched);
+	}
+	else if (_left > 0)
+	{
+		cancelledQuantity += _left;
+		_cancelled(_matched, _left);
+	}
+
+	// only a trade can trigger a stop
+	if (matchCount != _matches) {
+		FireStops(_book, _match, _cancelled);
+	}
+	return _handle;
+}
+
+// the callback may not touch the engine, so the node it is shown stays where it is until it returns
+template<typename T>
+template<typename F>
+long MatchingEngine<T>::Take(uint32_t _book, int _side, bool _limited, int32_t _limit, long _quantity, const MatchedOrder& _order, F&& _match)
+{
+	int _other = 1 - _side;
+	Book& _b = books[_book];
+	while (_quantity > 0 && _b.best[_other] != NO_LEVEL)
+	{
+		int32_t _level = _b.best[_other];
+		int32_t _levelTicks = _b.base + _level;
+		if (_limited && !Reaches(_side, _levelTicks, _limit)) {
+			break;
+		}
+
+		while (_quantity > 0 && _b.levels[_other][_level].head != NIL)
+		{
+			uint32_t _index = _b.levels[_other][_level].head;
+			Node& _node = nodes[_index];
+			long _take = min(_quantity, _node.visible);
+			_node.visible -= _take;
+			_b.levels[_other][_level].quantity -= _take;
+			_quantity -= _take;
+
+			bool _filled = _node.visible == 0 && _node.hidden == 0;
+			if (_filled) {
+				UnlinkLevel(_b, _index);
+			}
+			else if (_node.visible == 0)
+			{
+				// show as much again from the hidden quantity, behind the orders already there
+				_node.visible = min(_node.display, _node.hidden);
+				_node.hidden -= _node.visible;
+				UnlinkLevel(_b, _index);
+				LinkLevel(_b, _index);
+			}
+
+			matchCount++;
+			matchedQuantity += _take;
+			_b.lastTicks = _levelTicks;
+			_b.traded = true;
+			Match _m{ &_order, &_node.order, _side == BIDS ? OFFER : BID, _levelTicks, _take, _quantity, _node.visible + _node.hidden };
+			_match(_m);
+
+			if (_filled)
+			{
+				Release(_index);
+				restingCount--;
+			}
+		}
+
+		if (_b.levels[_other][_level].head == NIL) {
+			Emptied(_b, _other, _level);
+		}
+	}
+	return _quantity;
+}
+
+template<typename T>
+OrderHandle MatchingEngine<T>::Rest(uint32_t _book, int _side, int32_t _ticks, long _quantity, long _display, const MatchedOrder& _order)
+{
+	if (Index(books[_book], _ticks) == NO_LEVEL) {
+		Recenter(books[_book], _ticks);
+	}
+	uint32_t _index = Allocate();
+	Node& _node = nodes[_index];
+	_node.order = _order;
+	_node.visible = min(_display, _quantity);
+	_node.hidden = _quantity - _node.visible;
+	_node.display = _display;
+	_node.ticks = _ticks;
+	_node.book = _book;
+	_node.side = (uint8_t)_side;
+	_node.state = NODE_RESTING;
+
+	Book& _b = books[_book];
+	LinkLevel(_b, _index);
+	int32_t _level = Index(_b, _ticks);
+	_b.levels[_side][_level].quantity += _quantity;
+	if (_b.best[_side] == NO_LEVEL || (_side == BIDS ? _level > _b.best[_side] : _level < _b.best[_side])) {
+		_b.best[_side] = _level;
+	}
+	_b.low = min(_b.low, _level);
+	_b.high = max(_b.high, _level);
+	restingCount++;
+	return Handle(_index);
+}
+
+template<typename T>
+OrderHandle MatchingEngine<T>::Park(uint32_t _book, int _side, int32_t _ticks, long _quantity, const MatchedOrder& _order)
+{
+	uint32_t _index = Allocate();
+	Node& _node = nodes[_index];
+	_node.order = _order;
+	_node.visible = _quantity;
+	_node.hidden = 0;
+	_node.display = _quantity;
+	_node.ticks = _ticks;
+	_node.book = _book;
+	_node.side = (uint8_t)_side;
+	_node.state = NODE_STOP;
+
+	Book& _b = books[_book];
+	_node.next = NIL;
+	_node.prev = _b.stopTail;
+	if (_b.stopTail != NIL) {
+		nodes[_b.stopTail].next = _index;
+	}
+	else {
+		_b.stopHead = _index;
+	}
+	_b.stopTail = _index;
+	_b.stopTicks[_side] = _side == BIDS ? min(_b.stopTicks[_side], _ticks) : max(_b.stopTicks[_side], _ticks);
+	stopCount++;
+	return Handle(_index);
+}
+
+// the list is only walked when the last trade reaches the nearest stop price of a side. A triggered
+// stop can move the last trade and trigger others, so the list is walked again from the front after
+// each one; the walk finding none due sets the nearest stop prices again (cancelled stops leave them
+// nearer than they are until then).
+template<typename T>
+template<typename F, typename G>
+void MatchingEngine<T>::FireStops(uint32_t _book, F&& _match, G&& _cancelled)
+{
+	if (!Triggered(books[_book], BIDS, books[_book].stopTicks[BIDS]) && !Triggered(books[_book], OFFERS, books[_book].stopTicks[OFFERS])) {
+		return;
+	}
+
+	while (true)
+	{
+		Book& _b = books[_book];
+		int32_t _stopTicks[2] = { INT32_MAX, INT32_MIN };
+		uint32_t _index = _b.stopHead;
+		for (; _index != NIL && !Triggered(_b, nodes[_index].side, nodes[_index].ticks); _index = nodes[_index].next)
+		{
+			int _side = nodes[_index].side;
+			_stopTicks[_side] = _side == BIDS ? min(_stopTicks[_side], nodes[_index].ticks) : max(_stopTicks[_side], nodes[_index].ticks);
+		}
+		if (_index == NIL)
+		{
+			_b.stopTicks[BIDS] = _stopTicks[BIDS];
+			_b.stopTicks[OFFERS] = _stopTicks[OFFERS];
+			return;
+		}
+
+		Node& _node = nodes[_index];
+		(_node.prev != NIL ? nodes[_node.prev].next : _b.stopHead) = _node.next;
+		(_node.next != NIL ? nodes[_node.next].prev : _b.stopTail) = _node.prev;
+		stopCount--;
+		triggeredCount++;
+
+		// the node is released before matching, so the order is copied out of it
+		MatchedOrder _order = _node.order;
+		int _side = _node.side;
+		long _quantity = _node.visible;
+		Release(_index);
+		long _left = Take(_book, _side, false, 0, _quantity, _order, _match);
+		if (_left > 0)
+		{
+			cancelledQuantity += _left;
+			_cancelled(_order, _left);
+		}
+	}
+}
+
+template<typename T>
+void MatchingEngine<T>::LinkLevel(Book& _book, uint32_t _index)
+{
+	Node& _node = nodes[_index];
+	Level& _level = _book.levels[_node.side][Index(_book, _node.ticks)];
+	_node.next = NIL;
+	_node.prev = _level.tail;
+	if (_level.tail != NIL) {
+		nodes[_level.tail].next = _index;
+	}
+	else {
+		_level.head = _index;
+	}
+	_level.tail = _index;
+}
+
+template<typename T>
+void MatchingEngine<T>::UnlinkLevel(Book& _book, uint32_t _index)
+{
+	Node& _node = nodes[_index];
+	Level& _level = _book.levels[_node.side][Index(_book, _node.ticks)];
+	(_node.prev != NIL ? nodes[_node.prev].next : _level.head) = _node.next;
+	(_node.next != NIL ? nodes[_node.next].prev : _level.tail) = _node.prev;
+}
+
+template<typename T>
+void MatchingEngine<T>::Emptied(Book& _book, int _side, int32_t _level)
+{
+	if (_level == _book.best[_side])
+	{
+		int _step = _side == BIDS ? -1 : 1;
+		int32_t i = _level + _step;
+		while (i >= _book.low && i <= _book.high && _book.levels[_side][i].head == NIL) {
+			i += _step;
+		}
+		_book.best[_side] = (i >= _book.low && i <= _book.high) ? i : NO_LEVEL;
+	}
+	while (_book.low <= _book.high && _book.levels[BIDS][_book.low].head == NIL && _book.levels[OFFERS][_book.low].head == NIL) {
+		_book.low++;
+	}
+	while (_book.high >= _book.low && _book.levels[BIDS][_book.high].head == NIL && _book.levels[OFFERS][_book.high].head == NIL) {
+		_book.high--;
+	}
+	if (_book.low > _book.high)
+	{
+		_book.low = _book.window;
+		_book.high = -1;
+	}
+}
+
+template<typename T>
+bool MatchingEngine<T>::Cancel(OrderHandle _order)
+{
+	return Cancel(_order, [](const MatchedOrder&, long) {});
+}
+
+// the callback is shown the node before it is released
+template<typename T>
+template<typename G>
+bool MatchingEngine<T>::Cancel(OrderHandle _order, G&& _cancelled)
+{
+	uint32_t _index = (uint32_t)_order;
+	if (_index >= nodes.size() || nodes[_index].generation != (uint32_t)(_order >> 32) || nodes[_index].state == NODE_FREE) {
+		return false;
+	}
+
+	Node& _node = nodes[_index];
+	Book& _b = books[_node.book];
+	cancelledQuantity += _node.visible + _node.hidden;
+	if (_node.state == NODE_STOP)
+	{
+		(_node.prev != NIL ? nodes[_node.prev].next : _b.stopHead) = _node.next;
+		(_node.next != NIL ? nodes[_node.next].prev : _b.stopTail) = _node.prev;
+		stopCount--;
+	}
+	else
+	{
+		int32_t _level = Index(_b, _node.ticks);
+		_b.levels[_node.side][_level].quantity -= _node.visible + _node.hidden;
+		UnlinkLevel(_b, _index);
+		if (_b.levels[_node.side][_level].head == NIL) {
+			Emptied(_b, _node.side, _level);
+		}
+		restingCount--;
+	}
+	_cancelled(_node.order, _node.visible + _node.hidden);
+	Release(_index);
+	return true;
+}
+
+template<typename T>
+uint32_t MatchingEngine<T>::Allocate()
+{
+	if (freeList == NIL) {
+		if (nodes.size() >= NIL) {
+			throw length_error("matching engine is full");
+		}
+		nodes.emplace_back();
+		return (uint32_t)(nodes.size() - 1);
+	}
+	uint32_t _index = freeList;
+	freeList = nodes[_index].next;
+	return _index;
+}
+
+// the generation moves on, so the handles of the node's previous order go stale
+template<typename T>
+void MatchingEngine<T>::Release(uint32_t _index)
+{
+	Node& _node = nodes[_index];
+	_node.state = NODE_FREE;
+	_node.generation++;
+	_node.next = freeList;
+	freeList = _index;
+}
+
+template<typename T>
+OrderHandle MatchingEngine<T>::Handle(uint32_t _index) const
+{
+	return ((OrderHandle)nodes[_index].generation << 32) | _index;
+}
+
+template<typename T>
+bool MatchingEngine<T>::GetBestBid(const string& _productId, int32_t& _ticks, long& _quantity) const
+{
+	const Book* _book = FindBook(_productId);
+	if (!_book || _book->best[BIDS] == NO_LEVEL) {
+		return false;
+	}
+	_ticks = _book->base + _book->best[BIDS];
+	_quantity = _book->levels[BIDS][_book->best[BIDS]].quantity;
+	return true;
+}
+
+template<typename T>
+bool MatchingEngine<T>::GetBestOffer(const string& _productId, int32_t& _ticks, long& _quantity) const
+{
+	const Book* _book = FindBook(_productId);
+	if (!_book || _book->best[OFFERS] == NO_LEVEL) {
+		return false;
+	}
+	_ticks = _book->base + _book->best[OFFERS];
+	_quantity = _book->levels[OFFERS][_book->best[OFFERS]].quantity;
+	return true;
+}
+
+template<typename T>
+bool MatchingEngine<T>::GetLastTrade(const string& _productId, int32_t& _ticks) const
+{
+	const Book* _book = FindBook(_productId);
+	if (!_book || !_book->traded) {
+		return false;
+	}
+	_ticks = _book->lastTicks;
+	return true;
+}
+
+template<typename T>
+long MatchingEngine<T>::GetOrderCount() const
+{
+	return orderCount;
+}
+
+template<typename T>
+long MatchingEngine<T>::GetMatchCount() const
+{
+	return matchCount;
+}
+
+template<typename T>
+long MatchingEngine<T>::GetMatchedQuantity() const
+{
+	return matchedQuantity;
+}
+
+template<typename T>
+long MatchingEngine<T>::GetRejectedCount() const
+{
+	return rejectedCount;
+}
+
+template<typename T>
+long MatchingEngine<T>::GetCancelledQuantity() const
+{
+	return cancelledQuantity;
+}
+
+template<typename T>
+long MatchingEngine<T>::GetTriggeredCount() const
+{
+	return triggeredCount;
+}
+
+template<typename T>
+size_t MatchingEngine<T>::GetRestingCount() const
+{
+	return restingCount;
+}
+
+template<typename T>
+size_t MatchingEngine<T>::GetStopCount() const
+{
+	return stopCount;
+}
+
+#endif
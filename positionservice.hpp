@@ -10,13 +10,24 @@
 
 #include <string>
 #include <map>
+#include <array>
+#include <stdexcept>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
 #include "soa.hpp"
+#include "clock.hpp"
+#include "snapshottable.hpp"
 #include "tradebookingservice.hpp"
 
 using namespace std;
 
 /**
  * Position class in a particular book.
+ * Books are indexed by their interned book id (see FetchBookId), and the
+ * aggregate over books is maintained on every update.
  * Type T is the product type.
  */
 template<typename T>
@@ -28,21 +39,27 @@ public:
 	// ctor for a position
 	Position() = default;
 	Position(const T& _product);
+	Position(const T& _product, const array<long, BOOK_COUNT>& _positions, unsigned _bookMask);
 
 	// Get the product
 	const T& GetProduct() const;
 
 	// Get the position quantity
-	long GetPosition(string& book);
+	long GetPosition(const string& _book) const;
+	long GetPosition(int _bookId) const;
 
 	// Get the positions over books
-	map<string, long> GetPositions();
+	map<string, long> GetPositions() const;
 
 	// Set the position quantity
-	void AddPosition(string& _book, long _position);
+	void AddPosition(const string& _book, long _position);
+	void AddPosition(int _bookId, long _position);
 
 	// Get the aggregate position
-	long GetAggregatePosition();
+	long GetAggregatePosition() const;
+
+	// Get the books traded so far (bit i for book i)
+	unsigned GetBookMask() const;
 
 	// Save attributes as strings
 	vector<string> ToStrings() const;
@@ -50,7 +67,9 @@ public:
 private:
 
 	T product;
-	map<string, long> positions;
+	array<long, BOOK_COUNT> positions{};
+	long aggregatePosition = 0;
+	unsigned bookMask = 0;		// bit i set once book i has been traded
 
 };
 
@@ -58,6 +77,15 @@ template<typename T>
 Position<T>::Position(const T& _product) :
 	product(_product) {}
 
+template<typename T>
+Position<T>::Position(const T& _product, const array<long, BOOK_COUNT>& _positions, unsigned _bookMask) :
+	product(_product), positions(_positions), bookMask(_bookMask)
+{
+	for (long p : positions) {
+		aggregatePosition += p;
+	}
+}
+
 template<typename T>
 const T& Position<T>::GetProduct() const
 {
@@ -65,55 +93,177 @@ const T& Position<T>::GetProduct() const
 }
 
 template<typename T>
-long Position<T>::GetPosition(string& book)
+long Position<T>::GetPosition(const string& _book) const
 {
-	return positions[book];
+	return positions[FetchBookId(_book)];
 }
 
 template<typename T>
-map<string, long> Position<T>::GetPositions()
+long Position<T>::GetPosition(int _bookId) const
 {
-	return positions;
+	return positions[_bookId];
 }
 
 template<typename T>
-void Position<T>::AddPosition(string& _book, long _position)
+map<string, long> Position<T>::GetPositions() const
 {
-	positions[_book] += _position;
+	map<string, long> _positions;
+	for (int i = 0; i < BOOK_COUNT; i++) {
+		if (bookMask & (1u << i)) {
+			_positions[bookNames[i]] = positions[i];
+		}
+	}
+	return _positions;
 }
 
 template<typename T>
-long Position<T>::GetAggregatePosition()
+void Position<T>::AddPosition(const string& _book, long _position)
+{
+	AddPosition(FetchBookId(_book), _position);
+}
+
+template<typename T>
+void Position<T>::AddPosition(int _bookId, long _position)
+{
+	positions[_bookId] += _position;
+	aggregatePosition += _position;
+	bookMask |= 1u << _bookId;
+}
+
+template<typename T>
+long Position<T>::GetAggregatePosition() const
 {
-	long aggregatePosition = 0;
-	for (auto& p : positions) {
-		aggregatePosition += p.second;
-	}
 	return aggregatePosition;
 }
 
+template<typename T>
+unsigned Position<T>::GetBookMask() const
+{
+	return bookMask;
+}
+
 template<typename T>
 vector<string> Position<T>::ToStrings() const
 {
-	string _product = product.GetProductId();
-	vector<string> _positions;
+	vector<string> _strings;
+	_strings.push_back(product.GetProductId());
 
-	// storing the market and corresponding positions
-	for (auto& p : positions)
+	// storing the books traded so far and corresponding positions
+	for (int i = 0; i < BOOK_COUNT; i++)
 	{
-		string _book = p.first;
-		string _position = to_string(p.second);
-		_positions.push_back(_book);
-		_positions.push_back(_position);
+		if (bookMask & (1u << i)) {
+			_strings.push_back(bookNames[i]);
+			_strings.push_back(to_string(positions[i]));
+		}
 	}
-
-	vector<string> _strings;
-	_strings.push_back(_product);
-	_strings.insert(_strings.end(), _positions.begin(), _positions.end());
 	return _strings;
 }
 
 
+/**
+* Book positions of a product as kept by the PositionEngine (trivially copyable).
+* Type T is the product type.
+*/
+template<typename T>
+struct PositionState
+{
+	const T* product = nullptr;		// interned handle, see ProductRegistry
+	array<long, BOOK_COUNT> positions{};
+	unsigned bookMask = 0;
+};
+
+/**
+* Thread-safe position keeping: one seqlocked slot per product (see SnapshotTable).
+* Writers on the same product serialize on the slot; writers on different products never touch
+* the same cache line. Readers never block and always see the position right after some trade.
+* Type T is the product type.
+*/
+template<typename T>
+class PositionEngine
+{
+
+public:
+
+	// ctor, sized for _capacity products (the table grows past them)
+	PositionEngine(int _capacity = 64);
+
+	// Add a trade quantity to a book and return the position right after it
+	Position<T> Book(const T& _product, int _bookId, long _quantity);
+
+	// Replace the position of a product
+	void Store(const Position<T>& _position);
+
+	// Take a consistent snapshot of a product's position; false if the product was never traded
+	bool Snapshot(const string& _productId, Position<T>& _position) const;
+
+	// Get the number of products
+	int GetProductCount() const;
+
+	// Get the number of snapshot retries caused by concurrent writers
+	long GetRetryCount() const;
+
+private:
+
+	SnapshotTable<PositionState<T>> states;
+};
+
+template<typename T>
+PositionEngine<T>::PositionEngine(int _capacity) :
+	states(_capacity) {}
+
+// the product is interned on its first trade only
+template<typename T>
+Position<T> PositionEngine<T>::Book(const T& _product, int _bookId, long _quantity)
+{
+	PositionState<T> _state = states.Update(_product.GetProductId(), [&](PositionState<T>& _current) {
+		if (!_current.product) {
+			_current.product = ProductRegistry<T>::Intern(_product);
+		}
+		_current.positions[_bookId] += _quantity;
+		_current.bookMask |= 1u << _bookId;
+	});
+	return Position<T>(_product, _state.positions, _state.bookMask);
+}
+
+template<typename T>
+void PositionEngine<T>::Store(const Position<T>& _position)
+{
+	const T& _product = _position.GetProduct();
+	states.Update(_product.GetProductId(), [&](PositionState<T>& _current) {
+		if (!_current.product) {
+			_current.product = ProductRegistry<T>::Intern(_product);
+		}
+		for (int i = 0; i < BOOK_COUNT; i++) {
+			_current.positions[i] = _position.GetPosition(i);
+		}
+		_current.bookMask = _position.GetBookMask();
+	});
+}
+
+template<typename T>
+bool PositionEngine<T>::Snapshot(const string& _productId, Position<T>& _position) const
+{
+	PositionState<T> _state;
+	if (!states.Read(_productId, _state) || !_state.product) {
+		return false;
+	}
+	_position = Position<T>(*_state.product, _state.positions, _state.bookMask);
+	return true;
+}
+
+template<typename T>
+int PositionEngine<T>::GetProductCount() const
+{
+	return states.GetSize();
+}
+
+template<typename T>
+long PositionEngine<T>::GetRetryCount() const
+{
+	return states.GetRetryCount();
+}
+
+
 /**
 * Pre-declearations to avoid errors.
 */
@@ -123,6 +273,17 @@ class PositionToTradeBookingListener;
 /**
  * Position Service to manage positions across multiple books and secruties.
  * Keyed on product identifier.
+ * Positions are kept in a PositionEngine, so trades may be added from several threads, and
+ * GetSnapshot reads a consistent position without blocking them.
+ * The listeners (risk, historical writers) are not thread-safe, so they are called by one thread at a
+ * time: a trade marks its product ready, and the thread that gets to publish sends the latest position
+ * of every product ready, read from the engine as it publishes, before it lets go. A thread finding
+ * another publishing leaves its product to it. The listeners thus never run concurrently and always end
+ * on the latest position of a product, never an older one after a newer. Trades added from a single
+ * thread are published one by one, each with the position right after it.
+ * With coalescing on (see SetCoalescing), the trades of a batch only update the engine, and the
+ * listeners see one position per product traded in the batch, its latest, when the batch closes:
+ * a burst of trades then costs one risk recompute and one write per product instead of one per trade.
  * Type T is the product type.
  */
 template<typename T>
@@ -133,8 +294,15 @@ public:
 	// Ctor
 	PositionService();
 
-	// Get data on our service given a key
-	Position<T>& GetData(string _key);
+	// Get data on our service given a key (a copy refreshed from the engine, for a single reader);
+	// throws out_of_range for a product never traded
+	Position<T>& GetData(const string& _key);
+
+	// Take a consistent snapshot of a product's position, safe from any thread; false if never traded
+	bool GetSnapshot(const string& _productId, Position<T>& _position) const;
+
+	// Get the position engine
+	const PositionEngine<T>& GetEngine() const;
 
 	// The callback that a Connector should invoke for any new or updated data
 	void OnMessage(Position<T>& _data);
@@ -148,14 +316,57 @@ public:
 	// Get the listener of the service
 	PositionToTradeBookingListener<T>* GetListener();
 
-	// Add a trade to the service
+	// Add a trade to the service (thread-safe)
 	virtual void AddTrade(const Trade<T>& _trade);
 
+	// Coalesce the position updates: a batch closes after _trades trades (0 for no count limit) or once
+	// its first trade is _interval old on the process clock (zero for no time limit), checked as trades
+	// come in and on Poll. (1, zero) publishes every trade, the default. Set before trades flow.
+	void SetCoalescing(size_t _trades, chrono::nanoseconds _interval = chrono::nanoseconds::zero());
+
+	// Close the batch now, at the end of a tick; returns the number of positions published
+	int Flush();
+
+	// Close the batch if it is older than the coalescing interval, from a timer; returns the number of positions published
+	int Poll();
+
+	// Get the number of trades added
+	long GetTradeCount() const;
+
+	// Get the number of positions published to the listeners
+	long GetPublishCount() const;
+
 private:
 
+	// Mark a product ready to publish (under pendingMutex)
+	void Ready(const string& _productId);
+
+	// Publish the products ready, unless another thread is publishing (it will publish them) or, with
+	// _wait, once it is done; returns the number of positions published
+	int Drain(bool _wait);
+
+	// Publish a position to the listeners (under publishMutex)
+	void Publish(Position<T>& _position);
+
+	PositionEngine<T> engine;
 	map<string, Position<T>> positions;
 	vector<ServiceListener<Position<T>>*> listeners;
 	PositionToTradeBookingListener<T>* listener;
+
+	// coalescing
+	bool coalescing;
+	size_t coalesceTrades;
+	int64_t coalesceInterval;		// ns
+	Clock* clock;
+	mutex pendingMutex;
+	vector<string> pendingProducts;		// products traded in the open batch, in first-trade order
+	vector<string> readyProducts;		// products to publish, in the order they got ready
+	mutex publishMutex;
+	vector<string> publishingProducts;		// products being published (under publishMutex)
+	size_t pendingTrades;
+	int64_t pendingSince;		// steady time of the first trade of the batch
+	atomic<long> tradeCount;
+	atomic<long> publishCount;
 };
 
 template<typename T>
@@ -164,19 +375,42 @@ PositionService<T>::PositionService()
 	positions = map<string, Position<T>>();
 	listeners = vector<ServiceListener<Position<T>>*>();
 	listener = new PositionToTradeBookingListener<T>(this);
+	coalescing = false;
+	coalesceTrades = 1;
+	coalesceInterval = 0;
+	clock = &CurrentClock();
+	pendingTrades = 0;
+	pendingSince = 0;
+	tradeCount = 0;
+	publishCount = 0;
 }
 
 template<typename T>
-Position<T>& PositionService<T>::GetData(string _key)
+Position<T>& PositionService<T>::GetData(const string& _key)
 {
-	return positions[_key];
+	Position<T> _position;
+	if (!engine.Snapshot(_key, _position)) {
+		throw out_of_range("no position in " + _key);
+	}
+	return positions.insert_or_assign(_key, _position).first->second;
+}
+
+template<typename T>
+bool PositionService<T>::GetSnapshot(const string& _productId, Position<T>& _position) const
+{
+	return engine.Snapshot(_productId, _position);
+}
+
+template<typename T>
+const PositionEngine<T>& PositionService<T>::GetEngine() const
+{
+	return engine;
 }
 
 template<typename T>
 void PositionService<T>::OnMessage(Position<T>& _data)
 {
-	string _id = _data.GetProduct().GetProductId();
-	positions[_id] = _data;
+	engine.Store(_data);
 }
 
 template<typename T>
@@ -199,38 +433,156 @@ const vector<ServiceListener<Position<T>>*>& PositionService<T>::GetListeners()
 
 // core function
 // add a trade into the system
+// the engine updates the product's position under its seqlock; the product is then published, or joins
+// the open batch when coalescing, and the batch is published once it closes.
 template<typename T>
 void PositionService<T>::AddTrade(const Trade<T>& _trade)
 {
-	T _product = _trade.GetProduct();
-	string _productId = _product.GetProductId();
-	double _price = _trade.GetPrice();
-	string _book = _trade.GetBook();
-	long _quantity = _trade.GetQuantity();
-	Side _side = _trade.GetSide();
-
-	Position<T> _positionTo(_product);
-	if (_side == BUY) {
-		_positionTo.AddPosition(_book, _quantity);
-	}else if (_side == SELL) {
-		_positionTo.AddPosition(_book, -_quantity);
-	}
-	
-	// update the book
-	Position<T> _positionFrom = positions[_productId];
-	map <string, long> _positionMap = _positionFrom.GetPositions();
-	for (auto& p : _positionMap)
+	long _quantity = _trade.GetSide() == BUY ? _trade.GetQuantity() : -_trade.GetQuantity();
+	engine.Book(_trade.GetProduct(), FetchBookId(_trade.GetBook()), _quantity);
+	tradeCount.fetch_add(1, memory_order_relaxed);
+
+	const string& _productId = _trade.GetProduct().GetProductId();
 	{
-		_book = p.first;
-		_quantity = p.second;
-		_positionTo.AddPosition(_book, _quantity);
+		lock_guard<mutex> _lock(pendingMutex);
+		if (coalescing)
+		{
+			int64_t _now = coalesceInterval > 0 ? clock->Steady() : 0;
+			if (pendingTrades++ == 0) {
+				pendingSince = _now;
+			}
+			// the product universe is small: a scan is cheaper than hashing the id
+			if (find(pendingProducts.begin(), pendingProducts.end(), _productId) == pendingProducts.end()) {
+				pendingProducts.push_back(_productId);
+			}
+			if ((coalesceTrades == 0 || pendingTrades < coalesceTrades) && (coalesceInterval <= 0 || _now - pendingSince < coalesceInterval)) {
+				return;
+			}
+			for (auto& _pending : pendingProducts) {
+				Ready(_pending);
+			}
+			pendingProducts.clear();
+			pendingTrades = 0;
+		}
+		else {
+			Ready(_productId);
+		}
 	}
-	positions[_productId] = _positionTo;
 
 	// add back into the system.
+	Drain(false);
+}
+
+template<typename T>
+void PositionService<T>::SetCoalescing(size_t _trades, chrono::nanoseconds _interval)
+{
+	coalesceTrades = _trades;
+	coalesceInterval = max<int64_t>(_interval.count(), 0);
+	coalescing = coalesceTrades != 1 || coalesceInterval > 0;
+	clock = &CurrentClock();
+}
+
+template<typename T>
+int PositionService<T>::Flush()
+{
+	{
+		lock_guard<mutex> _lock(pendingMutex);
+		for (auto& _pending : pendingProducts) {
+			Ready(_pending);
+		}
+		pendingProducts.clear();
+		pendingTrades = 0;
+	}
+	return Drain(true);
+}
+
+template<typename T>
+int PositionService<T>::Poll()
+{
+	{
+		lock_guard<mutex> _lock(pendingMutex);
+		if (pendingTrades == 0 || coalesceInterval <= 0 || clock->Steady() - pendingSince < coalesceInterval) {
+			return 0;
+		}
+		for (auto& _pending : pendingProducts) {
+			Ready(_pending);
+		}
+		pendingProducts.clear();
+		pendingTrades = 0;
+	}
+	return Drain(true);
+}
+
+template<typename T>
+long PositionService<T>::GetTradeCount() const
+{
+	return tradeCount.load(memory_order_relaxed);
+}
+
+template<typename T>
+long PositionService<T>::GetPublishCount() const
+{
+	return publishCount.load(memory_order_relaxed);
+}
+
+template<typename T>
+void PositionService<T>::Ready(const string& _productId)
+{
+	if (find(readyProducts.begin(), readyProducts.end(), _productId) == readyProducts.end()) {
+		readyProducts.push_back(_productId);
+	}
+}
+
+// the positions are read from the engine under the publishing lock, so none can be older than one
+// published before. A thread failing to take the lock leaves its products to the one holding it, which
+// looks for products ready again once it has let go: they were either taken in its last round or are
+// still there.
+template<typename T>
+int PositionService<T>::Drain(bool _wait)
+{
+	int _published = 0;
+	while (true)
+	{
+		{
+			unique_lock<mutex> _publishing(publishMutex, defer_lock);
+			if (_wait) {
+				_publishing.lock();
+			}
+			else if (!_publishing.try_lock()) {
+				return _published;
+			}
+
+			{
+				lock_guard<mutex> _lock(pendingMutex);
+				publishingProducts.swap(readyProducts);
+			}
+			Position<T> _position;
+			for (const string& _productId : publishingProducts)
+			{
+				if (engine.Snapshot(_productId, _position))
+				{
+					Publish(_position);
+					_published++;
+				}
+			}
+			publishingProducts.clear();
+		}
+
+		lock_guard<mutex> _lock(pendingMutex);
+		if (readyProducts.empty()) {
+			return _published;
+		}
+		_wait = false;
+	}
+}
+
+template<typename T>
+void PositionService<T>::Publish(Position<T>& _position)
+{
+	publishCount.fetch_add(1, memory_order_relaxed);
 	for (auto& l : listeners)
 	{
-		l->ProcessAdd(_positionTo);
+		l->ProcessAdd(_position);
 	}
 }
 
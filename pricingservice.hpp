@@ -11,9 +11,12 @@
 #include "utilityfunctions.hpp"
 #include <string>
 #include "soa.hpp"
+#include "snapshottable.hpp"
 
  /**
   * A price object consisting of mid and bid/offer spread.
+  * The product is held as a handle to its interned copy (see ProductRegistry),
+  * so a price is 24 bytes and trivially copyable.
   * Type T is the product type.
   */
 template<typename T>
@@ -24,10 +27,14 @@ public:
 	// ctor for a price
 	Price() = default;
 	Price(const T & _product, double _mid, double _bidOfferSpread);
+	Price(const T* _product, double _mid, double _bidOfferSpread);
 
 	// Get the product
 	const T& GetProduct() const;
 
+	// Get the handle of the (interned) product
+	const T* GetProductHandle() const;
+
 	// Get the mid price
 	double GetMid() const;
 
@@ -38,7 +45,7 @@ public:
 	vector<string> ToStrings() const;
 private:
 
-	T product;
+	const T* product = ProductRegistry<T>::Default();
 	double mid;
 	double bidOfferSpread;
 
@@ -46,6 +53,12 @@ private:
 
 template<typename T>
 Price<T>::Price(const T& _product, double _mid, double _bidOfferSpread) :
+	Price(ProductRegistry<T>::Intern(_product), _mid, _bidOfferSpread)
+{
+}
+
+template<typename T>
+Price<T>::Price(const T* _product, double _mid, double _bidOfferSpread) :
 	product(_product)
 {
 	mid = _mid;
@@ -54,6 +67,12 @@ Price<T>::Price(const T& _product, double _mid, double _bidOfferSpread) :
 
 template<typename T>
 const T& Price<T>::GetProduct() const
+{
+	return *product;
+}
+
+template<typename T>
+const T* Price<T>::GetProductHandle() const
 {
 	return product;
 }
@@ -73,7 +92,7 @@ double Price<T>::GetBidOfferSpread() const
 template<typename T>
 vector<string> Price<T>::ToStrings() const
 {
-	string _product = product.GetProductId();
+	string _product = product->GetProductId();
 	string _mid = PriceToString(mid);
 	string _bidOfferSpread = PriceToString(bidOfferSpread);
 
@@ -93,6 +112,8 @@ class PricingConnector;
 /**
  * Pricing Service managing mid prices and bid/offers.
  * Keyed on product identifier.
+ * The latest price of each product is also published to a SnapshotTable, which other threads
+ * (GUI, monitoring) read through GetSnapshot without blocking the service.
  * Type T is the product type.
  */
 template<typename T>
@@ -100,14 +121,18 @@ class PricingService : public Service<string, Price <T> >
 {
 private:
 	map<string, Price<T>> prices;
+	SnapshotTable<Price<T>> snapshots;
 	vector<ServiceListener<Price<T>>*> listeners;
 	PricingConnector<T>* connector;
 public:
 	PricingService();
 	~PricingService();
 
-	// fetch orderbook with given product id
-	Price<T>& GetData(string _key);
+	// fetch price with given product id (throws out_of_range for a product never priced)
+	Price<T>& GetData(const string& _key);
+
+	// copy the latest price of a product, safe from any thread; false if never priced
+	bool GetSnapshot(const string& _productId, Price<T>& _price) const;
 
 	// call back function for the connector
 	void OnMessage(Price<T>& _data);
@@ -136,15 +161,23 @@ template<typename T>
 PricingService<T>::~PricingService() {}
 
 template<typename T>
-Price<T>& PricingService<T>::GetData(string _key)
+Price<T>& PricingService<T>::GetData(const string& _key)
 {
-	return prices[_key];
+	return prices.at(_key);
+}
+
+template<typename T>
+bool PricingService<T>::GetSnapshot(const string& _productId, Price<T>& _price) const
+{
+	return snapshots.Read(_productId, _price);
 }
 
 template<typename T>
 void PricingService<T>::OnMessage(Price<T>& _data)
 {
-	prices[_data.GetProduct().GetProductId()] = _data;
+	const string& _productId = _data.GetProduct().GetProductId();
+	prices.insert_or_assign(_productId, _data);
+	snapshots.Publish(_productId, _data);
 
 	for (auto& listener : listeners) {
 		listener->ProcessAdd(_data);
@@ -207,19 +240,18 @@ template<typename T>
 void PricingConnector<T>::Subscribe(ifstream& _data)
 {
 	string line;
+	vector<string> cells;
 	while (getline(_data, line))
 	{
-		auto cells = LineToCells(line);
+		LineToCells(line, cells);
 		
 		// fetch the corresponding data features
-		string _productId = cells[0];
+		const string& _productId = cells[0];
 		double bid_price = StringToPrice(cells[1]);
 		double offer_price = StringToPrice(cells[2]);
 		double mid_price = (bid_price + offer_price) / 2.0;
 		double spread = offer_price - bid_price;
-		T _product = FetchBond(_productId);
-
-		Price<T> _price(_product, mid_price, spread);
+		Price<T> _price(InternBond(_productId), mid_price, spread);
 
 		// update the generated price Data to the service.
 		service->OnMessage(_price);
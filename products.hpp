@@ -10,6 +10,9 @@
 
 #include <iostream>
 #include <string>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 #include "boost/date_time/gregorian/gregorian.hpp"
 
@@ -161,9 +164,9 @@ private:
 
 };
 
-Product::Product(string _productId, ProductType _productType)
+Product::Product(string _productId, ProductType _productType) :
+	productId(move(_productId))
 {
-	productId = _productId;
 	productType = _productType;
 }
 
@@ -177,10 +180,10 @@ ProductType Product::GetProductType() const
 	return productType;
 }
 
-Bond::Bond(string _productId, BondIdType _bondIdType, string _ticker, double _coupon, date _maturityDate) : Product(_productId, BOND)
+Bond::Bond(string _productId, BondIdType _bondIdType, string _ticker, double _coupon, date _maturityDate) : Product(move(_productId), BOND),
+	ticker(move(_ticker))
 {
 	bondIdType = _bondIdType;
-	ticker = _ticker;
 	coupon = _coupon;
 	maturityDate = _maturityDate;
 }
@@ -361,4 +364,70 @@ string IRSwap::ToString(SwapLegType swapLegType) const
 	}
 }
 
+/**
+* Registry of interned products: one immutable copy of each product (by product id) kept for
+* the whole run, so that messages can hold a product handle (a pointer) instead of a copy.
+* Type T is the product type.
+*/
+template<typename T>
+class ProductRegistry
+{
+
+public:
+
+	// Get the handle of a product, interning it on first use
+	static const T* Intern(const T& _product);
+
+	// Get the handle of the product with the given id, nullptr if it was never interned
+	static const T* Find(const string& _productId);
+
+	// Handle of a default-constructed product, held by default-constructed messages
+	static const T* Default();
+
+private:
+
+	static mutex& Lock();
+	static unordered_map<string, unique_ptr<T>>& Products();
+};
+
+template<typename T>
+const T* ProductRegistry<T>::Intern(const T& _product)
+{
+	lock_guard<mutex> _guard(Lock());
+	auto& _handle = Products()[_product.GetProductId()];
+	if (!_handle) {
+		_handle = make_unique<T>(_product);
+	}
+	return _handle.get();
+}
+
+template<typename T>
+const T* ProductRegistry<T>::Find(const string& _productId)
+{
+	lock_guard<mutex> _guard(Lock());
+	auto _it = Products().find(_productId);
+	return _it == Products().end() ? nullptr : _it->second.get();
+}
+
+template<typename T>
+const T* ProductRegistry<T>::Default()
+{
+	static const T _product{};
+	return &_product;
+}
+
+template<typename T>
+mutex& ProductRegistry<T>::Lock()
+{
+	static mutex _lock;
+	return _lock;
+}
+
+template<typename T>
+unordered_map<string, unique_ptr<T>>& ProductRegistry<T>::Products()
+{
+	static unordered_map<string, unique_ptr<T>> _products;
+	return _products;
+}
+
 #endif
@@ -0,0 +1,338 @@
+/**
+* riskkernel.hpp
+* Structure-of-arrays store of PV01 and book quantities, and the batch kernel that
+* aggregates portfolio, per-book and per-bucket DV01 in a single pass over it.
+* The kernel uses AVX (4 doubles) or SSE2 (2 doubles) when the compiler targets them
+* (e.g. with -march=native, see BTS_NATIVE) and a scalar loop otherwise.
+*
+* @author James Wu
+*/
+#ifndef RISK_KERNEL_HPP
+#define RISK_KERNEL_HPP
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include "utilityfunctions.hpp"
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// the kernel keeps one accumulator per book and per bucket in registers
+const int MAX_RISK_BOOKS = 8;
+const int MAX_RISK_BUCKETS = 8;
+
+/**
+* Aggregated DV01 of a portfolio.
+*/
+struct PortfolioRisk
+{
+	double total = 0.0;
+	vector<double> books;
+	vector<double> buckets;
+};
+
+// scalar kernel: risk_i,k = pv01_i * quantity_k,i
+// bucket weights are 1 for the products in a bucket and 0 otherwise (a product may be in several buckets).
+void AggregatePortfolioRiskScalar(int _count, const double* _pv01s, const double* const* _quantities, int _books,
+	const double* const* _bucketWeights, int _buckets, double* _bookRisk, double* _bucketRisk, double& _total)
+{
+	for (int k = 0; k < _books; k++) {
+		_bookRisk[k] = 0.0;
+	}
+	for (int b = 0; b < _buckets; b++) {
+		_bucketRisk[b] = 0.0;
+	}
+	_total = 0.0;
+
+	for (int i = 0; i < _count; i++)
+	{
+		double _productRisk = 0.0;
+		for (int k = 0; k < _books; k++) {
+			double _risk = _pv01s[i] * _quantities[k][i];
+			_bookRisk[k] += _risk;
+			_productRisk += _risk;
+		}
+		_total += _productRisk;
+		for (int b = 0; b < _buckets; b++) {
+			_bucketRisk[b] += _bucketWeights[b][i] * _productRisk;
+		}
+	}
+}
+
+#if defined(__AVX__) || defined(__SSE2__)
+
+// vector kernel, same contract as the scalar one.
+// RISK_LANES products are processed per step; the tail is finished with scalar code.
+#if defined(__AVX__)
+#define RISK_LANES 4
+#define RISK_VECTOR __m256d
+#define RISK_ZERO() _mm256_setzero_pd()
+#define RISK_LOAD(p) _mm256_loadu_pd(p)
+#define RISK_ADD(a, b) _mm256_add_pd(a, b)
+#define RISK_MUL(a, b) _mm256_mul_pd(a, b)
+#define RISK_STORE(p, a) _mm256_storeu_pd(p, a)
+#else
+#define RISK_LANES 2
+#define RISK_VECTOR __m128d
+#define RISK_ZERO() _mm_setzero_pd()
+#define RISK_LOAD(p) _mm_loadu_pd(p)
+#define RISK_ADD(a, b) _mm_add_pd(a, b)
+#define RISK_MUL(a, b) _mm_mul_pd(a, b)
+#define RISK_STORE(p, a) _mm_storeu_pd(p, a)
+#endif
+
+// horizontal sum of a vector register
+inline double SumLanes(RISK_VECTOR _v)
+{
+	double _lanes[RISK_LANES];
+	RISK_STORE(_lanes, _v);
+	double _sum = 0.0;
+	for (int j = 0; j < RISK_LANES; j++) {
+		_sum += _lanes[j];
+	}
+	return _sum;
+}
+
+void AggregatePortfolioRisk(int _count, const double* _pv01s, const double* const* _quantities, int _books,
+	const double* const* _bucketWeights, int _buckets, double* _bookRisk, double* _bucketRisk, double& _total)
+{
+	if (_books > MAX_RISK_BOOKS || _buckets > MAX_RISK_BUCKETS) {
+		AggregatePortfolioRiskScalar(_count, _pv01s, _quantities, _books, _bucketWeights, _buckets, _bookRisk, _bucketRisk, _total);
+		return;
+	}
+
+	RISK_VECTOR _bookAcc[MAX_RISK_BOOKS];
+	RISK_VECTOR _bucketAcc[MAX_RISK_BUCKETS];
+	RISK_VECTOR _totalAcc = RISK_ZERO();
+	for (int k = 0; k < _books; k++) {
+		_bookAcc[k] = RISK_ZERO();
+	}
+	for (int b = 0; b < _buckets; b++) {
+		_bucketAcc[b] = RISK_ZERO();
+	}
+
+	int i = 0;
+	for (; i + RISK_LANES <= _count; i += RISK_LANES)
+	{
+		RISK_VECTOR _pv01 = RISK_LOAD(_pv01s + i);
+		RISK_VECTOR _productRisk = RISK_ZERO();
+		for (int k = 0; k < _books; k++) {
+			RISK_VECTOR _risk = RISK_MUL(_pv01, RISK_LOAD(_quantities[k] + i));
+			_bookAcc[k] = RISK_ADD(_bookAcc[k], _risk);
+			_productRisk = RISK_ADD(_productRisk, _risk);
+		}
+		_totalAcc = RISK_ADD(_totalAcc, _productRisk);
+		for (int b = 0; b < _buckets; b++) {
+			_bucketAcc[b] = RISK_ADD(_bucketAcc[b], RISK_MUL(RISK_LOAD(_bucketWeights[b] + i), _productRisk));
+		}
+	}
+
+	for (int k = 0; k < _books; k++) {
+		_bookRisk[k] = SumLanes(_bookAcc[k]);
+	}
+	for (int b = 0; b < _buckets; b++) {
+		_bucketRisk[b] = SumLanes(_bucketAcc[b]);
+	}
+	_total = SumLanes(_totalAcc);
+
+	// tail
+	for (; i < _count; i++)
+	{
+		double _productRisk = 0.0;
+		for (int k = 0; k < _books; k++) {
+			double _risk = _pv01s[i] * _quantities[k][i];
+			_bookRisk[k] += _risk;
+			_productRisk += _risk;
+		}
+		_total += _productRisk;
+		for (int b = 0; b < _buckets; b++) {
+			_bucketRisk[b] += _bucketWeights[b][i] * _productRisk;
+		}
+	}
+}
+
+#undef RISK_LANES
+#undef RISK_VECTOR
+#undef RISK_ZERO
+#undef RISK_LOAD
+#undef RISK_ADD
+#undef RISK_MUL
+#undef RISK_STORE
+
+#else
+
+void AggregatePortfolioRisk(int _count, const double* _pv01s, const double* const* _quantities, int _books,
+	const double* const* _bucketWeights, int _buckets, double* _bookRisk, double* _bucketRisk, double& _total)
+{
+	AggregatePortfolioRiskScalar(_count, _pv01s, _quantities, _books, _bucketWeights, _buckets, _bookRisk, _bucketRisk, _total);
+}
+
+#endif
+
+/**
+* Risk store in structure-of-arrays layout: one PV01 array, one quantity array per book,
+* and one 0/1 weight array per bucket, all indexed by the product index.
+*/
+class PortfolioRiskStore
+{
+
+public:
+
+	// ctor
+	PortfolioRiskStore(int _books = BOOK_COUNT);
+
+	// Add a product, returning its index (existing products keep their index)
+	int AddProduct(const string& _productId);
+
+	// Get the index of a product, -1 if it was never added
+	int GetIndex(const string& _productId) const;
+
+	// Get the number of products
+	int GetSize() const;
+
+	// Get the number of books and buckets
+	int GetBookCount() const;
+	int GetBucketCount() const;
+
+	// Set the PV01 of a product
+	void SetPV01(int _index, double _pv01);
+
+	// Set the quantity of a product in a book
+	void SetQuantity(int _index, int _bookId, long _quantity);
+
+	// Add a bucket (initially empty), returning its id
+	int AddBucket();
+
+	// Remove all the products from a bucket
+	void ClearBucket(int _bucket);
+
+	// Put a product in a bucket
+	void SetBucketMember(int _index, int _bucket);
+
+	// Aggregate portfolio, per-book and per-bucket DV01 in one pass
+	PortfolioRisk Aggregate() const;
+
+	// Same, with the scalar kernel
+	PortfolioRisk AggregateScalar() const;
+
+private:
+
+	// the per-array pointers handed to the kernels
+	void Pointers(vector<const double*>& _quantities, vector<const double*>& _weights) const;
+
+	int books;
+	unordered_map<string, int> indices;
+	vector<double> pv01s;
+	vector<vector<double>> quantities;
+	vector<vector<double>> bucketWeights;
+};
+
+PortfolioRiskStore::PortfolioRiskStore(int _books) :
+	books(_books), quantities(_books) {}
+
+int PortfolioRiskStore::AddProduct(const string& _productId)
+{
+	auto _it = indices.find(_productId);
+	if (_it != indices.end()) {
+		return _it->second;
+	}
+
+	int _index = (int)pv01s.size();
+	indices.emplace(_productId, _index);
+	pv01s.push_back(0.0);
+	for (auto& q : quantities) {
+		q.push_back(0.0);
+	}
+	for (auto& w : bucketWeights) {
+		w.push_back(0.0);
+	}
+	return _index;
+}
+
+int PortfolioRiskStore::GetIndex(const string& _productId) const
+{
+	auto _it = indices.find(_productId);
+	return _it == indices.end() ? -1 : _it->second;
+}
+
+int PortfolioRiskStore::GetSize() const
+{
+	return (int)pv01s.size();
+}
+
+int PortfolioRiskStore::GetBookCount() const
+{
+	return books;
+}
+
+int PortfolioRiskStore::GetBucketCount() const
+{
+	return (int)bucketWeights.size();
+}
+
+void PortfolioRiskStore::SetPV01(int _index, double _pv01)
+{
+	pv01s[_index] = _pv01;
+}
+
+void PortfolioRiskStore::SetQuantity(int _index, int _bookId, long _quantity)
+{
+	quantities[_bookId][_index] = (double)_quantity;
+}
+
+int PortfolioRiskStore::AddBucket()
+{
+	bucketWeights.emplace_back(pv01s.size(), 0.0);
+	return (int)bucketWeights.size() - 1;
+}
+
+void PortfolioRiskStore::ClearBucket(int _bucket)
+{
+	fill(bucketWeights[_bucket].begin(), bucketWeights[_bucket].end(), 0.0);
+}
+
+void PortfolioRiskStore::SetBucketMember(int _index, int _bucket)
+{
+	bucketWeights[_bucket][_index] = 1.0;
+}
+
+void PortfolioRiskStore::Pointers(vector<const double*>& _quantities, vector<const double*>& _weights) const
+{
+	for (auto& q : quantities) {
+		_quantities.push_back(q.data());
+	}
+	for (auto& w : bucketWeights) {
+		_weights.push_back(w.data());
+	}
+}
+
+PortfolioRisk PortfolioRiskStore::Aggregate() const
+{
+	vector<const double*> _quantities, _weights;
+	Pointers(_quantities, _weights);
+	PortfolioRisk _risk;
+	_risk.books.resize(books);
+	_risk.buckets.resize(bucketWeights.size());
+	AggregatePortfolioRisk(GetSize(), pv01s.data(), _quantities.data(), books, _weights.data(), GetBucketCount(),
+		_risk.books.data(), _risk.buckets.data(), _risk.total);
+	return _risk;
+}
+
+PortfolioRisk PortfolioRiskStore::AggregateScalar() const
+{
+	vector<const double*> _quantities, _weights;
+	Pointers(_quantities, _weights);
+	PortfolioRisk _risk;
+	_risk.books.resize(books);
+	_risk.buckets.resize(bucketWeights.size());
+	AggregatePortfolioRiskScalar(GetSize(), pv01s.data(), _quantities.data(), books, _weights.data(), GetBucketCount(),
+		_risk.books.data(), _risk.buckets.data(), _risk.total);
+	return _risk;
+}
+
+#endif
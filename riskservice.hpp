@@ -8,8 +8,13 @@
 #ifndef RISK_SERVICE_HPP
 #define RISK_SERVICE_HPP
 
+#include <algorithm>
 #include "soa.hpp"
 #include "positionservice.hpp"
+#include "pricingservice.hpp"
+#include "bondanalytics.hpp"
+#include "riskkernel.hpp"
+#include "snapshottable.hpp"
 
  /**
   * PV01 risk.
@@ -37,6 +42,9 @@ public:
 	// Set the quantity that this risk value is associated with
 	void SetQuantity(long _q);
 
+	// Set the PV01 value
+	void SetPV01(double _pv01);
+
 	// To string, easier to output and store
 	vector<string> ToStrings() const;
 
@@ -79,6 +87,12 @@ void PV01<T>::SetQuantity(long _q)
 	quantity = _q;
 }
 
+template<typename T>
+void PV01<T>::SetPV01(double _pv01)
+{
+	pv01 = _pv01;
+}
+
 template<typename T>
 vector<string> PV01<T>::ToStrings() const
 {
@@ -90,6 +104,18 @@ vector<string> PV01<T>::ToStrings() const
 	return _strings;
 }
 
+/**
+* Latest risk of a product as published for readers on other threads (trivially copyable).
+* Type T is the product type.
+*/
+template<typename T>
+struct RiskState
+{
+	const T* product = nullptr;		// interned handle, see ProductRegistry
+	double pv01 = 0.0;
+	long quantity = 0;
+};
+
 /**
  * A bucket sector to bucket a group of securities.
  * We can then aggregate bucketed risk to this bucket.
@@ -110,6 +136,9 @@ public:
 	// Get the name of the bucket
 	const string& GetName() const;
 
+	// Get the identifier of the bucket (its name), so bucketed risk can be keyed like product risk
+	const string& GetProductId() const;
+
 private:
 	vector<T> products;
 	string name;
@@ -118,9 +147,8 @@ private:
 
 template<typename T>
 BucketedSector<T>::BucketedSector(const vector<T>& _products, string _name) :
-	products(_products)
+	products(_products), name(move(_name))
 {
-	name = _name;
 }
 
 template<typename T>
@@ -135,17 +163,35 @@ const string& BucketedSector<T>::GetName() const
 	return name;
 }
 
+template<typename T>
+const string& BucketedSector<T>::GetProductId() const
+{
+	return name;
+}
+
 // Implementing the RiskService
 /**
 * Pre-declearations to avoid errors.
 */
 template<typename T>
 class RiskToPositionListener;		// the listener connecting risk and position service(s)
+template<typename T>
+class RiskToPricingListener;		// the listener connecting risk and pricing service(s)
 
 
 /**
  * Risk Service to vend out risk for a particular security and across a risk bucketed sector.
  * Keyed on product identifier.
+ * PV01 is computed analytically from the bond cash flows once a price has been seen for the
+ * product (see bondanalytics.hpp), and taken from the reference table until then. A bond matured by
+ * the settlement date of the analytics engine has no cash flows left, and no risk.
+ * A price move re-risks the product at once if a position is held in it, and otherwise when its
+ * first position comes, so the product, bucketed and portfolio risk always use the latest price.
+ * Bucketed sectors are registered up front and their risk is kept as a running total,
+ * adjusted by the change in risk whenever a product position or PV01 changes.
+ * PV01 and book quantities are also mirrored in a PortfolioRiskStore for portfolio-level DV01.
+ * The latest risk of each product is published to a SnapshotTable, read through GetSnapshot
+ * from any thread without blocking the service.
  * Type T is the product type.
  */
 template<typename T>
@@ -160,11 +206,32 @@ public:
 	// Add a position that the service will risk
 	void AddPosition(Position<T>& position);
 
-	// Get the bucketed risk for the bucket sector
+	// Record a price move, re-risking the product if a position is held in it
+	void UpdatePrice(const Price<T>& _price);
+
+	// Re-risk, in one batch, every product whose price moved and update the risk of the positions held
+	void Rerisk();
+
+	// Get the analytics engine (settlement date, yields, durations)
+	BondRiskEngine& GetRiskEngine();
+
+	// Register a bucket sector so that its risk is aggregated as positions change
+	void AddBucketedSector(const BucketedSector<T>& _sector);
+
+	// Get the bucketed risk for a registered bucket sector (throws out_of_range otherwise)
 	const PV01< BucketedSector<T> >& GetBucketedRisk(const BucketedSector<T>& sector) const;
 
-	// Get data via a key
-	PV01<T>& GetData(string _key);
+	// Add a listener to changes in the bucketed risk of the registered sectors
+	void AddBucketedRiskListener(ServiceListener<PV01<BucketedSector<T>>>* _listener);
+
+	// Get the portfolio, per-book and per-bucket DV01 (buckets in registration order), aggregated in one pass
+	PortfolioRisk GetPortfolioRisk() const;
+
+	// Get data via a key (throws out_of_range for a product never risked)
+	PV01<T>& GetData(const string& _key);
+
+	// Copy the latest risk of a product, safe from any thread; false if never risked
+	bool GetSnapshot(const string& _productId, PV01<T>& _pv01) const;
 
 	// The callback function upon receiving new data
 	void OnMessage(PV01<T>& _data);
@@ -178,10 +245,30 @@ public:
 	// Fetch the (risk-position specific) listener of the service
 	RiskToPositionListener<T>* GetListener();
 
+	// Fetch the listener to price moves
+	RiskToPricingListener<T>* GetPricingListener();
+
 private:
+	// Store the risk of a product and move the bucketed risk by the change
+	PV01<T>& UpdateRisk(const T& _product, double _pv01, long _quantity);
+
+	// The PV01 of a product: 0 once matured, analytic once priced, from the reference table otherwise
+	double FetchPV01(const T& _product) const;
+
 	map<string, PV01<T>> pv01s;
+	SnapshotTable<RiskState<T>> snapshots;
 	vector<ServiceListener<PV01<T>>*> listeners;
 	RiskToPositionListener<T>* listener;
+	RiskToPricingListener<T>* pricingListener;
+	BondRiskEngine riskEngine;
+	PortfolioRiskStore portfolioRisk;
+
+	// registered sectors: their running risk, the index by sector name,
+	// and the sectors each product belongs to
+	vector<PV01<BucketedSector<T>>> bucketedRisks;
+	map<string, int> bucketIds;
+	map<string, vector<int>> productBuckets;
+	vector<ServiceListener<PV01<BucketedSector<T>>>*> bucketedRiskListeners;
 };
 
 template<typename T>
@@ -190,19 +277,30 @@ RiskService<T>::RiskService()
 	pv01s = map<string, PV01<T>>();
 	listeners = vector<ServiceListener<PV01<T>>*>();
 	listener = new RiskToPositionListener<T>(this);
+	pricingListener = new RiskToPricingListener<T>(this);
+}
+
+template<typename T>
+PV01<T>& RiskService<T>::GetData(const string& _key)
+{
+	return pv01s.at(_key);
 }
 
 template<typename T>
-PV01<T>& RiskService<T>::GetData(string _key)
+bool RiskService<T>::GetSnapshot(const string& _productId, PV01<T>& _pv01) const
 {
-	return pv01s[_key];
+	RiskState<T> _state;
+	if (!snapshots.Read(_productId, _state) || !_state.product) {
+		return false;
+	}
+	_pv01 = PV01<T>(*_state.product, _state.pv01, _state.quantity);
+	return true;
 }
 
 template<typename T>
 void RiskService<T>::OnMessage(PV01<T>& _data)
 {
-	string id = _data.GetProduct().GetProductId();
-	pv01s[id] = _data;
+	UpdateRisk(_data.GetProduct(), _data.GetPV01(), _data.GetQuantity());
 }
 
 template<typename T>
@@ -223,17 +321,35 @@ RiskToPositionListener<T>* RiskService<T>::GetListener()
 	return listener;
 }
 
+template<typename T>
+RiskToPricingListener<T>* RiskService<T>::GetPricingListener()
+{
+	return pricingListener;
+}
+
+template<typename T>
+BondRiskEngine& RiskService<T>::GetRiskEngine()
+{
+	return riskEngine;
+}
+
 // important, add position function
 // connection with the Position class
 template<typename T>
 void RiskService<T>::AddPosition(Position<T>& _position)
 {
-	T _product = _position.GetProduct();
-	string _id = _product.GetProductId();
-	double _pv01Value = GetPV01(_id);		// call the utility function to fetch the PV
+	Rerisk();		// bring the PV01 values up to date with the latest prices
+
+	const T& _product = _position.GetProduct();
+	riskEngine.AddBond(_product);		// known to the engine, so that its maturity is, before any price
+	double _pv01Value = FetchPV01(_product);
 	long _quantity = _position.GetAggregatePosition();
-	PV01<T> _pv01(_product, _pv01Value, _quantity);
-	pv01s[_id] = _pv01;
+	PV01<T>& _pv01 = UpdateRisk(_product, _pv01Value, _quantity);
+
+	int _index = portfolioRisk.AddProduct(_product.GetProductId());
+	for (int k = 0; k < BOOK_COUNT; k++) {
+		portfolioRisk.SetQuantity(_index, k, _position.GetPosition(k));
+	}
 
 	for (auto& l : listeners)
 	{
@@ -242,24 +358,147 @@ void RiskService<T>::AddPosition(Position<T>& _position)
 }
 
 template<typename T>
-const PV01<BucketedSector<T>>& RiskService<T>::GetBucketedRisk(const BucketedSector<T>& _sector) const
+void RiskService<T>::UpdatePrice(const Price<T>& _price)
+{
+	int _index = riskEngine.AddBond(_price.GetProduct());
+	riskEngine.SetPrice(_index, _price.GetMid());
+	if (pv01s.count(_price.GetProduct().GetProductId())) {
+		Rerisk();
+	}
+}
+
+// only products already held are re-notified, and only when their PV01 changed
+template<typename T>
+void RiskService<T>::Rerisk()
+{
+	if (riskEngine.Rerisk() == 0) {
+		return;
+	}
+
+	for (auto& [_id, _pv01] : pv01s)
+	{
+		double _pv01Value = FetchPV01(_pv01.GetProduct());
+		if (_pv01Value != _pv01.GetPV01())
+		{
+			PV01<T>& _updated = UpdateRisk(_pv01.GetProduct(), _pv01Value, _pv01.GetQuantity());
+			for (auto& l : listeners)
+			{
+				l->ProcessAdd(_updated);
+			}
+		}
+	}
+}
+
+template<typename T>
+double RiskService<T>::FetchPV01(const T& _product) const
+{
+	const string& _id = _product.GetProductId();
+	int _index = riskEngine.GetIndex(_id);
+	if (_index >= 0 && riskEngine.IsMatured(_index)) {
+		return 0.0;
+	}
+	if (_index >= 0 && riskEngine.HasPrice(_index)) {
+		return riskEngine.GetPV01(_index);
+	}
+	return GetPV01(_id);		// no price yet: call the utility function to fetch the PV
+}
+
+// the stored risk is updated in place; every sector holding the product
+// moves by the difference between the new and the old risk.
+template<typename T>
+PV01<T>& RiskService<T>::UpdateRisk(const T& _product, double _pv01, long _quantity)
 {
-	BucketedSector<T> _product = _sector;
-	double _pv01 = 0.0;
-	long _quantity = 1;
+	const string& _id = _product.GetProductId();
+	double _oldRisk = 0.0;
+
+	auto _it = pv01s.find(_id);
+	if (_it == pv01s.end()) {
+		_it = pv01s.emplace(_id, PV01<T>(_product, _pv01, _quantity)).first;
+	}
+	else {
+		_oldRisk = _it->second.GetPV01() * (double)_it->second.GetQuantity();
+		_it->second.SetPV01(_pv01);
+		_it->second.SetQuantity(_quantity);
+	}
+	portfolioRisk.SetPV01(portfolioRisk.AddProduct(_id), _pv01);
+	snapshots.Update(_id, [&](RiskState<T>& _state) {
+		if (!_state.product) {
+			_state.product = ProductRegistry<T>::Intern(_product);
+		}
+		_state.pv01 = _pv01;
+		_state.quantity = _quantity;
+	});
+
+	auto _buckets = productBuckets.find(_id);
+	if (_buckets != productBuckets.end())
+	{
+		double _delta = _pv01 * (double)_quantity - _oldRisk;
+		for (int b : _buckets->second)
+		{
+			PV01<BucketedSector<T>>& _bucketedRisk = bucketedRisks[b];
+			_bucketedRisk.SetPV01(_bucketedRisk.GetPV01() + _delta);
+			for (auto& l : bucketedRiskListeners)
+			{
+				l->ProcessAdd(_bucketedRisk);
+			}
+		}
+	}
+	return _it->second;
+}
 
-	vector<T>& _products = _sector.GetProducts();
+// registering a sector computes its risk from the positions held so far;
+// re-registering a name replaces the products of that sector.
+template<typename T>
+void RiskService<T>::AddBucketedSector(const BucketedSector<T>& _sector)
+{
+	const string& _name = _sector.GetName();
+	auto _existing = bucketIds.find(_name);
+	int _bucketId;
+	if (_existing == bucketIds.end()) {
+		_bucketId = (int)bucketedRisks.size();
+		bucketIds.emplace(_name, _bucketId);
+		bucketedRisks.emplace_back(_sector, 0.0, 1);
+		portfolioRisk.AddBucket();
+	}
+	else {
+		_bucketId = _existing->second;
+		for (auto& [_id, _bucketList] : productBuckets) {
+			_bucketList.erase(remove(_bucketList.begin(), _bucketList.end(), _bucketId), _bucketList.end());
+		}
+		bucketedRisks[_bucketId] = PV01<BucketedSector<T>>(_sector, 0.0, 1);
+		portfolioRisk.ClearBucket(_bucketId);
+	}
 
-	// summing all the risks.
-	for (auto& p : _products)
+	double _risk = 0.0;
+	for (auto& p : _sector.GetProducts())
 	{
-		string _pId = p.GetProductId();
-		long _q = pv01s[_pId].GetQuantity();
-		double _val = pv01s[_pId].GetPV01();
-		_pv01 += _val * (double)_q;
+		const string& _id = p.GetProductId();
+		productBuckets[_id].push_back(_bucketId);
+		portfolioRisk.SetBucketMember(portfolioRisk.AddProduct(_id), _bucketId);
+		auto _it = pv01s.find(_id);
+		if (_it != pv01s.end()) {
+			_risk += _it->second.GetPV01() * (double)_it->second.GetQuantity();
+		}
 	}
+	bucketedRisks[_bucketId].SetPV01(_risk);
+}
 
-	return PV01<BucketedSector<T>>(_product, _pv01, _quantity);
+template<typename T>
+const PV01<BucketedSector<T>>& RiskService<T>::GetBucketedRisk(const BucketedSector<T>& _sector) const
+{
+	return bucketedRisks[bucketIds.at(_sector.GetName())];
+}
+
+template<typename T>
+PortfolioRisk RiskService<T>::GetPortfolioRisk() const
+{
+	return portfolioRisk.Aggregate();
+}
+
+template<typename T>
+void RiskService<T>::AddBucketedRiskListener(ServiceListener<PV01<BucketedSector<T>>>* _listener)
+{
+	bucketedRiskListeners.push_back(_listener);
 }
 
 /**
@@ -309,4 +548,51 @@ void RiskToPositionListener<T>::ProcessRemove(Position<T>& _data) {}
 template<typename T>
 void RiskToPositionListener<T>::ProcessUpdate(Position<T>& _data) {}
 
+/**
+* Risk Service Listener subscribing prices from Pricing Service to Risk Service.
+* Type T is the product type.
+*/
+template<typename T>
+class RiskToPricingListener : public ServiceListener<Price<T>>
+{
+
+private:
+
+	RiskService<T>* service;
+
+public:
+
+	// Ctor
+	RiskToPricingListener(RiskService<T>* _service);
+
+	// Listener callback to process an add event to the Service
+	void ProcessAdd(Price<T>& _data);
+
+	// Listener callback to process a remove event to the Service
+	void ProcessRemove(Price<T>& _data);
+
+	// Listener callback to process an update event to the Service
+	void ProcessUpdate(Price<T>& _data);
+
+};
+
+template<typename T>
+RiskToPricingListener<T>::RiskToPricingListener(RiskService<T>* _service)
+{
+	service = _service;
+}
+
+template<typename T>
+void RiskToPricingListener<T>::ProcessAdd(Price<T>& _data)
+{
+	service->UpdatePrice(_data);
+}
+
+// do nothing for these methods (not required)
+template<typename T>
+void RiskToPricingListener<T>::ProcessRemove(Price<T>& _data) {}
+
+template<typename T>
+void RiskToPricingListener<T>::ProcessUpdate(Price<T>& _data) {}
+
 #endif
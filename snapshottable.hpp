@@ -0,0 +1,310 @@
+/**
+* snapshottable.hpp
+* Read-optimized table of the latest value per key, for readers on other threads (monitoring, GUI).
+* Each key has its own slot guarded by a seqlock: writers serialize on the slot's sequence (odd while
+* a write is in progress) and readers copy the slot without blocking them, retrying if the sequence
+* moved meanwhile, so a read is always one consistent value. Values are trivially copyable and kept
+* as atomic words (relaxed, ordered by the sequence), so the table is TSan clean.
+* Slots are added on the first write of a key (under a mutex) and never removed. They are allocated in
+* segments that never move, and found through an open-addressing index of slot pointers; when the index
+* gets half full, a twice larger one replaces it, and the old one is kept for the readers still probing
+* it. The table therefore takes any number of keys, and readers never wait on one being added.
+*
+* @author James Wu
+*/
+#ifndef SNAPSHOT_TABLE_HPP
+#define SNAPSHOT_TABLE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
+
+using namespace std;
+
+/**
+* Seqlocked latest-value slots keyed by string.
+* Type S is the value type, trivially copyable.
+*/
+template<typename S>
+class SnapshotTable
+{
+
+	static_assert(is_trivially_copyable<S>::value, "snapshots are copied word by word");
+
+public:
+
+	// ctor, sized for _capacity keys before it grows
+	SnapshotTable(int _capacity = 64);
+
+	// Replace the value of a key
+	void Publish(const string& _key, const S& _value);
+
+	// Update the value of a key in place (value-initialized on the first write), returning the new value
+	template<typename F>
+	S Update(const string& _key, F&& _update);
+
+	// Copy the latest value of a key; false if the key was never written
+	bool Read(const string& _key, S& _value) const;
+
+	// Get the number of keys
+	int GetSize() const;
+
+	// Get the number of reads retried because of a concurrent write
+	long GetRetryCount() const;
+
+private:
+
+	static constexpr int WORDS = (sizeof(S) + 7) / 8;
+
+	struct alignas(64) Slot
+	{
+		string key;
+		atomic<uint64_t> sequence{ 0 };
+		atomic<uint64_t> words[WORDS] = {};
+	};
+
+	// slot pointers by hash, linear probing; an entry is published once its slot holds the key
+	struct Index
+	{
+		size_t mask;
+		unique_ptr<atomic<Slot*>[]> entries;
+	};
+
+	// link a slot into an index (under the mutex)
+	void Insert(Index& _index, Slot* _slot);
+
+	// replace the index by one twice as large (under the mutex)
+	void Grow();
+
+	// the key's slot, nullptr if it has none yet
+	Slot* Find(const string& _key) const;
+
+	// the key's slot, created on first use
+	Slot* FindOrAdd(const string& _key);
+
+	// start and finish a write on a slot
+	void Lock(Slot& _slot);
+	void Unlock(Slot& _slot);
+
+	// copy a value out of and into the slot's words
+	S Load(const Slot& _slot, memory_order _order) const;
+	void Store(Slot& _slot, const S& _value);
+
+	atomic<Index*> index{ nullptr };
+	vector<unique_ptr<Index>> indexes;		// every index built, the current one last
+	vector<unique_ptr<Slot[]>> segments;
+	int segmentSize;
+	int segmentUsed;
+	atomic<int> size{ 0 };
+	mutable atomic<long> retries{ 0 };
+	mutex addLock;
+};
+
+template<typename S>
+SnapshotTable<S>::SnapshotTable(int _capacity)
+{
+	// a power of two at least twice the capacity, to keep the probes short
+	size_t _entries = 2;
+	while (_entries < 2 * (size_t)max(_capacity, 1)) {
+		_entries *= 2;
+	}
+	indexes.push_back(unique_ptr<Index>(new Index{ _entries - 1, unique_ptr<atomic<Slot*>[]>(new atomic<Slot*>[_entries]) }));
+	for (size_t i = 0; i < _entries; i++) {
+		indexes.back()->entries[i].store(nullptr, memory_order_relaxed);
+	}
+	index.store(indexes.back().get(), memory_order_release);
+
+	segmentSize = max(_capacity, 1);
+	segments.emplace_back(new Slot[segmentSize]);
+	segmentUsed = 0;
+}
+
+template<typename S>
+typename SnapshotTable<S>::Slot* SnapshotTable<S>::Find(const string& _key) const
+{
+	const Index& _index = *index.load(memory_order_acquire);
+	size_t i = hash<string>()(_key) & _index.mask;
+	while (Slot* _slot = _index.entries[i].load(memory_order_acquire))
+	{
+		if (_slot->key == _key) {
+			return _slot;
+		}
+		i = (i + 1) & _index.mask;
+	}
+	return nullptr;
+}
+
+template<typename S>
+void SnapshotTable<S>::Insert(Index& _index, Slot* _slot)
+{
+	size_t i = hash<string>()(_slot->key) & _index.mask;
+	while (_index.entries[i].load(memory_order_relaxed)) {
+		i = (i + 1) & _index.mask;
+	}
+	_index.entries[i].store(_slot, memory_order_release);
+}
+
+// the new index is filled before it is published, so a reader sees either index whole
+template<typename S>
+void SnapshotTable<S>::Grow()
+{
+	const Index& _old = *indexes.back();
+	size_t _entries = 2 * (_old.mask + 1);
+	unique_ptr<Index> _index(new Index{ _entries - 1, unique_ptr<atomic<Slot*>[]>(new atomic<Slot*>[_entries]) });
+	for (size_t i = 0; i < _entries; i++) {
+		_index->entries[i].store(nullptr, memory_order_relaxed);
+	}
+	for (size_t i = 0; i <= _old.mask; i++)
+	{
+		if (Slot* _slot = _old.entries[i].load(memory_order_relaxed)) {
+			Insert(*_index, _slot);
+		}
+	}
+	index.store(_index.get(), memory_order_release);
+	indexes.push_back(move(_index));
+}
+
+template<typename S>
+typename SnapshotTable<S>::Slot* SnapshotTable<S>::FindOrAdd(const string& _key)
+{
+	if (Slot* _slot = Find(_key)) {
+		return _slot;
+	}
+
+	lock_guard<mutex> _guard(addLock);
+	if (Slot* _slot = Find(_key)) {
+		return _slot;
+	}
+	if (2 * (size_t)(size.load(memory_order_relaxed) + 1) > indexes.back()->mask + 1) {
+		Grow();
+	}
+	if (segmentUsed == segmentSize)
+	{
+		// each segment doubles the slots, which stay where they are
+		segmentSize = size.load(memory_order_relaxed);
+		segments.emplace_back(new Slot[segmentSize]);
+		segmentUsed = 0;
+	}
+
+	// the key and a value-initialized value are written before the slot is published
+	Slot* _slot = &segments.back()[segmentUsed++];
+	_slot->key = _key;
+	Store(*_slot, S{});
+	Insert(*indexes.back(), _slot);
+	size.fetch_add(1, memory_order_relaxed);
+	return _slot;
+}
+
+template<typename S>
+void SnapshotTable<S>::Lock(Slot& _slot)
+{
+	uint64_t _sequence = _slot.sequence.load(memory_order_relaxed);
+	while ((_sequence & 1) || !_slot.sequence.compare_exchange_weak(_sequence, _sequence + 1, memory_order_acquire, memory_order_relaxed)) {
+		// another writer holds the slot; it may have been preempted
+		if (_sequence & 1) {
+			this_thread::yield();
+		}
+		_sequence = _slot.sequence.load(memory_order_relaxed);
+	}
+}
+
+template<typename S>
+void SnapshotTable<S>::Unlock(Slot& _slot)
+{
+	_slot.sequence.fetch_add(1, memory_order_release);
+}
+
+template<typename S>
+S SnapshotTable<S>::Load(const Slot& _slot, memory_order _order) const
+{
+	uint64_t _words[WORDS];
+	for (int i = 0; i < WORDS; i++) {
+		_words[i] = _slot.words[i].load(_order);
+	}
+	S _value;
+	memcpy(&_value, _words, sizeof(S));
+	return _value;
+}
+
+// the words are stored with release so that none of them is seen before the odd sequence
+template<typename S>
+void SnapshotTable<S>::Store(Slot& _slot, const S& _value)
+{
+	uint64_t _words[WORDS] = {};
+	memcpy(_words, &_value, sizeof(S));
+	for (int i = 0; i < WORDS; i++) {
+		_slot.words[i].store(_words[i], memory_order_release);
+	}
+}
+
+template<typename S>
+void SnapshotTable<S>::Publish(const string& _key, const S& _value)
+{
+	Slot& _slot = *FindOrAdd(_key);
+	Lock(_slot);
+	Store(_slot, _value);
+	Unlock(_slot);
+}
+
+template<typename S>
+template<typename F>
+S SnapshotTable<S>::Update(const string& _key, F&& _update)
+{
+	Slot& _slot = *FindOrAdd(_key);
+	Lock(_slot);
+	S _value = Load(_slot, memory_order_relaxed);
+	_update(_value);
+	Store(_slot, _value);
+	Unlock(_slot);
+	return _value;
+}
+
+// the words are loaded with acquire so that the second read of the sequence cannot move before them
+template<typename S>
+bool SnapshotTable<S>::Read(const string& _key, S& _value) const
+{
+	const Slot* _slot = Find(_key);
+	if (!_slot) {
+		return false;
+	}
+
+	while (true)
+	{
+		uint64_t _sequence = _slot->sequence.load(memory_order_acquire);
+		if (!(_sequence & 1))
+		{
+			S _copy = Load(*_slot, memory_order_acquire);
+			if (_slot->sequence.load(memory_order_relaxed) == _sequence) {
+				_value = _copy;
+				return true;
+			}
+		}
+		else {
+			this_thread::yield();
+		}
+		retries.fetch_add(1, memory_order_relaxed);
+	}
+}
+
+template<typename S>
+int SnapshotTable<S>::GetSize() const
+{
+	return size.load(memory_order_relaxed);
+}
+
+template<typename S>
+long SnapshotTable<S>::GetRetryCount() const
+{
+	return retries.load(memory_order_relaxed);
+}
+
+#endif
@@ -50,8 +50,8 @@ class Service
 
 public:
 
-	// Get data on our service given a key
-	virtual V& GetData(K _key) = 0;
+	// Get data on our service given a key; never adds an entry (throws out_of_range for an unknown key)
+	virtual V& GetData(const K& _key) = 0;
 
 	// The callback that a Connector should invoke for any new or updated data
 	virtual void OnMessage(V& _data) = 0;
@@ -85,4 +85,52 @@ public:
 	virtual void Subscribe(ifstream& _data) = 0;
 };
 
+/**
+* Listener pacing a replay: every record a service receives moves the simulated clock forward by a step,
+* so recorded inputs without times get evenly spaced event times. Added first on the service it paces.
+* Type V is the data type of the service.
+*/
+template<typename V>
+class ReplayPacer final : public ServiceListener<V>
+{
+
+public:
+
+	// ctor
+	ReplayPacer(SimulatedClock* _clock, chrono::nanoseconds _step);
+
+	// Listener callback to process an add event to the Service: the clock moves on
+	void ProcessAdd(V& _data);
+
+	// Listener callback to process a remove event to the Service
+	void ProcessRemove(V& _data);
+
+	// Listener callback to process an update event to the Service
+	void ProcessUpdate(V& _data);
+
+private:
+	SimulatedClock* clock;
+	chrono::nanoseconds step;
+};
+
+template<typename V>
+ReplayPacer<V>::ReplayPacer(SimulatedClock* _clock, chrono::nanoseconds _step) :
+	step(_step)
+{
+	clock = _clock;
+}
+
+template<typename V>
+void ReplayPacer<V>::ProcessAdd(V& _data)
+{
+	clock->Advance(step);
+}
+
+// do nothing for these methods (not required)
+template<typename V>
+void ReplayPacer<V>::ProcessRemove(V& _data) {}
+
+template<typename V>
+void ReplayPacer<V>::ProcessUpdate(V& _data) {}
+
 #endif
@@ -39,7 +39,7 @@ public:
 	StreamingService();
 
 	// Get data on our service given a key
-	PriceStream<T>& GetData(string _key);
+	PriceStream<T>& GetData(const string& _key);
 
 	// The callback that a Connector should invoke for any new or updated data
 	void OnMessage(PriceStream<T>& _data);
@@ -67,16 +67,15 @@ StreamingService<T>::StreamingService()
 }
 
 template<typename T>
-PriceStream<T>& StreamingService<T>::GetData(string _key)
+PriceStream<T>& StreamingService<T>::GetData(const string& _key)
 {
-	return priceStreams[_key];
+	return priceStreams.at(_key);
 }
 
 template<typename T>
 void StreamingService<T>::OnMessage(PriceStream<T>& _data)
 {
-	string _id = _data.GetProduct().GetProductId();
-	priceStreams[_id] = _data;
+	priceStreams.insert_or_assign(_data.GetProduct().GetProductId(), _data);
 }
 
 template<typename T>
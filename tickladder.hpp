@@ -0,0 +1,437 @@
+/**
+* tickladder.hpp
+* Order book depth as a ladder of price levels indexed by tick offset.
+* Treasuries trade in a narrow band of 1/256 ticks, so the quantity at each tick is kept in a
+* contiguous array around a center that moves with the market, with the best bid and offer held as
+* indexes into it. Adding to, cancelling from and reading the best level are array operations on a
+* few cache lines, instead of scans of the unsorted order stacks of OrderBook.
+*
+* @author James Wu
+*/
+#ifndef TICK_LADDER_HPP
+#define TICK_LADDER_HPP
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "marketdataservice.hpp"
+
+using namespace std;
+
+/**
+* Aggregated quantity per tick on each side of a product's book.
+* The ladder covers _window ticks starting at its base; a price outside it moves the center (and
+* doubles the window if the occupied levels no longer fit in half of it), which shifts the levels
+* in place. Quantities are aggregated per price: the ladder keeps depth, not individual orders.
+* Type T is the product type.
+*/
+template<typename T>
+class TickLadderBook
+{
+
+public:
+
+	// ctor, for a window of _window ticks (rounded up to a power of two)
+	TickLadderBook(const T* _product = ProductRegistry<T>::Default(), int _window = 512);
+
+	// Get the product
+	const T& GetProduct() const;
+
+	// Get the handle of the (interned) product
+	const T* GetProductHandle() const;
+
+	// Add quantity at a price (in ticks)
+	void Add(PricingSide _side, int32_t _ticks, int64_t _quantity);
+
+	// Take quantity off a price (in ticks), at most what the level holds; returns the quantity taken off
+	int64_t Cancel(PricingSide _side, int32_t _ticks, int64_t _quantity);
+
+	// Get the quantity at a price (in ticks)
+	int64_t GetQuantity(PricingSide _side, int32_t _ticks) const;
+
+	// Is there any quantity on the bid/offer side?
+	bool HasBid() const;
+	bool HasOffer() const;
+
+	// Get the best bid/offer price (in ticks) and its quantity; the side must not be empty
+	int32_t GetBestBidTicks() const;
+	int32_t GetBestOfferTicks() const;
+	int64_t GetBestBidQuantity() const;
+	int64_t GetBestOfferQuantity() const;
+
+	// Get the best bid/offer order, an empty side giving a zero order
+	const BidOffer GetBidOffer() const;
+
+	// Get the top of the book
+	TopOfBook<T> GetTopOfBook(int64_t _timestamp = 0) const;
+
+	// Visit up to _levels non-empty levels of a side from the best price, calling _visit(ticks, quantity);
+	// returns the number of levels visited
+	template<typename F>
+	int ForEachLevel(PricingSide _side, int _levels, F&& _visit) const;
+
+	// Replace the ladder with the depth of an order book
+	void Load(const OrderBook<T>& _orderBook);
+
+	// Remove every level, keeping the window
+	void Clear();
+
+	// Get the number of ticks covered and the price (in ticks) of the first one
+	int GetWindow() const;
+	int32_t GetBaseTicks() const;
+
+	// Get the number of times the center moved
+	long GetRecenterCount() const;
+
+private:
+
+	static constexpr int32_t NO_LEVEL = -1;
+
+	// index of a price in the ladder, or NO_LEVEL if it is outside the window
+	int32_t Index(int32_t _ticks) const;
+
+	// move the center (and grow the window if needed) so that _ticks and the occupied levels fit
+	void Recenter(int32_t _ticks);
+
+	// shift the occupied levels of one side by _shift indexes, in place
+	void Shift(vector<int64_t>& _levels, int32_t _shift);
+
+	const T* product;
+	int window;
+	int32_t base;
+	vector<int64_t> bids;
+	vector<int64_t> offers;
+	int32_t bestBid;
+	int32_t bestOffer;
+	// bounds of the occupied indexes over both sides (low > high when the ladder is empty)
+	int32_t low;
+	int32_t high;
+	long recenters;
+};
+
+template<typename T>
+TickLadderBook<T>::TickLadderBook(const T* _product, int _window) :
+	product(_product)
+{
+	if (_window <= 0) {
+		throw invalid_argument("ladder window must be positive");
+	}
+	window = 2;
+	while (window < _window) {
+		window *= 2;
+	}
+	bids.assign(window, 0);
+	offers.assign(window, 0);
+	base = 0;
+	bestBid = NO_LEVEL;
+	bestOffer = NO_LEVEL;
+	low = window;
+	high = -1;
+	recenters = 0;
+}
+
+template<typename T>
+const T& TickLadderBook<T>::GetProduct() const
+{
+	return *product;
+}
+
+template<typename T>
+const T* TickLadderBook<T>::GetProductHandle() const
+{
+	return product;
+}
+
+template<typename T>
+int32_t TickLadderBook<T>::Index(int32_t _ticks) const
+{
+	int64_t _index = (int64_t)_ticks - base;
+	return (_index >= 0 && _index < window) ? (int32_t)_index : NO_LEVEL;
+}
+
+template<typename T>
+void TickLadderBook<T>::Add(PricingSide _side, int32_t _ticks, int64_t _quantity)
+{
+	if (_quantity <= 0) {
+		return;
+	}
+	int32_t _index = Index(_ticks);
+	if (_index == NO_LEVEL) {
+		Recenter(_ticks);
+		_index = Index(_ticks);
+	}
+
+	if (_side == BID)
+	{
+		bids[_index] += _quantity;
+		if (bestBid == NO_LEVEL || _index > bestBid) {
+			bestBid = _index;
+		}
+	}
+	else
+	{
+		offers[_index] += _quantity;
+		if (bestOffer == NO_LEVEL || _index < bestOffer) {
+			bestOffer = _index;
+		}
+	}
+	low = min(low, _index);
+	high = max(high, _index);
+}
+
+// an emptied best level moves the best price to the next occupied level, which is at most the
+// occupied range away
+template<typename T>
+int64_t TickLadderBook<T>::Cancel(PricingSide _side, int32_t _ticks, int64_t _quantity)
+{
+	int32_t _index = Index(_ticks);
+	if (_index == NO_LEVEL || _quantity <= 0) {
+		return 0;
+	}
+
+	vector<int64_t>& _levels = _side == BID ? bids : offers;
+	int64_t _taken = min(_quantity, _levels[_index]);
+	_levels[_index] -= _taken;
+	if (_taken > 0 && _levels[_index] == 0)
+	{
+		if (_side == BID && _index == bestBid)
+		{
+			while (bestBid > low && bids[bestBid] == 0) {
+				bestBid--;
+			}
+			if (bids[bestBid] == 0) {
+				bestBid = NO_LEVEL;
+			}
+		}
+		else if (_side == OFFER && _index == bestOffer)
+		{
+			while (bestOffer < high && offers[bestOffer] == 0) {
+				bestOffer++;
+			}
+			if (offers[bestOffer] == 0) {
+				bestOffer = NO_LEVEL;
+			}
+		}
+		// the occupied range shrinks from its ends as they empty, so that the ladder follows the market
+		while (low <= high && bids[low] == 0 && offers[low] == 0) {
+			low++;
+		}
+		while (high >= low && bids[high] == 0 && offers[high] == 0) {
+			high--;
+		}
+		if (low > high) {
+			low = window;
+			high = -1;
+		}
+	}
+	return _taken;
+}
+
+template<typename T>
+int64_t TickLadderBook<T>::GetQuantity(PricingSide _side, int32_t _ticks) const
+{
+	int32_t _index = Index(_ticks);
+	if (_index == NO_LEVEL) {
+		return 0;
+	}
+	return _side == BID ? bids[_index] : offers[_index];
+}
+
+template<typename T>
+bool TickLadderBook<T>::HasBid() const
+{
+	return bestBid != NO_LEVEL;
+}
+
+template<typename T>
+bool TickLadderBook<T>::HasOffer() const
+{
+	return bestOffer != NO_LEVEL;
+}
+
+template<typename T>
+int32_t TickLadderBook<T>::GetBestBidTicks() const
+{
+	return base + bestBid;
+}
+
+template<typename T>
+int32_t TickLadderBook<T>::GetBestOfferTicks() const
+{
+	return base + bestOffer;
+}
+
+template<typename T>
+int64_t TickLadderBook<T>::GetBestBidQuantity() const
+{
+	return bids[bestBid];
+}
+
+template<typename T>
+int64_t TickLadderBook<T>::GetBestOfferQuantity() const
+{
+	return offers[bestOffer];
+}
+
+template<typename T>
+const BidOffer TickLadderBook<T>::GetBidOffer() const
+{
+	Order _bid = HasBid() ? Order(TicksToPrice(GetBestBidTicks()), (long)GetBestBidQuantity(), BID) : Order(0.0, 0, BID);
+	Order _offer = HasOffer() ? Order(TicksToPrice(GetBestOfferTicks()), (long)GetBestOfferQuantity(), OFFER) : Order(0.0, 0, OFFER);
+	return BidOffer(_bid, _offer);
+}
+
+template<typename T>
+TopOfBook<T> TickLadderBook<T>::GetTopOfBook(int64_t _timestamp) const
+{
+	TopOfBook<T> _top;
+	_top.product = product;
+	_top.timestamp = _timestamp;
+	_top.bidQuantity = HasBid() ? GetBestBidQuantity() : 0;
+	_top.offerQuantity = HasOffer() ? GetBestOfferQuantity() : 0;
+	_top.bidTicks = HasBid() ? GetBestBidTicks() : 0;
+	_top.offerTicks = HasOffer() ? GetBestOfferTicks() : 0;
+	return _top;
+}
+
+template<typename T>
+template<typename F>
+int TickLadderBook<T>::ForEachLevel(PricingSide _side, int _levels, F&& _visit) const
+{
+	int _visited = 0;
+	if (_side == BID)
+	{
+		for (int32_t i = bestBid; i >= low && i != NO_LEVEL && _visited < _levels; i--)
+		{
+			if (bids[i] > 0) {
+				_visit(base + i, bids[i]);
+				_visited++;
+			}
+		}
+	}
+	else
+	{
+		for (int32_t i = bestOffer; i <= high && i != NO_LEVEL && _visited < _levels; i++)
+		{
+			if (offers[i] > 0) {
+				_visit(base + i, offers[i]);
+				_visited++;
+			}
+		}
+	}
+	return _visited;
+}
+
+template<typename T>
+void TickLadderBook<T>::Load(const OrderBook<T>& _orderBook)
+{
+	product = _orderBook.GetProductHandle();
+	Clear();
+	for (auto& _order : _orderBook.GetBidStack()) {
+		Add(BID, PriceToTicks(_order.GetPrice()), _order.GetQuantity());
+	}
+	for (auto& _order : _orderBook.GetOfferStack()) {
+		Add(OFFER, PriceToTicks(_order.GetPrice()), _order.GetQuantity());
+	}
+}
+
+template<typename T>
+void TickLadderBook<T>::Clear()
+{
+	if (low <= high)
+	{
+		fill(bids.begin() + low, bids.begin() + high + 1, 0);
+		fill(offers.begin() + low, offers.begin() + high + 1, 0);
+	}
+	bestBid = NO_LEVEL;
+	bestOffer = NO_LEVEL;
+	low = window;
+	high = -1;
+}
+
+template<typename T>
+int TickLadderBook<T>::GetWindow() const
+{
+	return window;
+}
+
+template<typename T>
+int32_t TickLadderBook<T>::GetBaseTicks() const
+{
+	return base;
+}
+
+template<typename T>
+long TickLadderBook<T>::GetRecenterCount() const
+{
+	return recenters;
+}
+
+// an empty ladder is simply rebased; otherwise the occupied levels keep half the window as room to move
+template<typename T>
+void TickLadderBook<T>::Recenter(int32_t _ticks)
+{
+	recenters++;
+	if (low > high)
+	{
+		base = _ticks - window / 2;
+		return;
+	}
+
+	int64_t _low = min<int64_t>(base + low, _ticks);
+	int64_t _high = max<int64_t>(base + high, _ticks);
+	int _window = window;
+	while (2 * (_high - _low + 1) > _window) {
+		_window *= 2;
+	}
+	int32_t _base = (int32_t)((_low + _high) / 2 - _window / 2);
+	int32_t _shift = base - _base;
+
+	if (_window != window)
+	{
+		// a wider window: copy the occupied levels into new arrays
+		vector<int64_t> _bids(_window, 0);
+		vector<int64_t> _offers(_window, 0);
+		copy(bids.begin() + low, bids.begin() + high + 1, _bids.begin() + low + _shift);
+		copy(offers.begin() + low, offers.begin() + high + 1, _offers.begin() + low + _shift);
+		bids.swap(_bids);
+		offers.swap(_offers);
+		window = _window;
+	}
+	else
+	{
+		Shift(bids, _shift);
+		Shift(offers, _shift);
+	}
+
+	base = _base;
+	low += _shift;
+	high += _shift;
+	if (bestBid != NO_LEVEL) {
+		bestBid += _shift;
+	}
+	if (bestOffer != NO_LEVEL) {
+		bestOffer += _shift;
+	}
+}
+
+// the occupied range [low, high] moves to [low + _shift, high + _shift] and the cells it leaves are cleared
+template<typename T>
+void TickLadderBook<T>::Shift(vector<int64_t>& _levels, int32_t _shift)
+{
+	auto _first = _levels.begin() + low;
+	auto _last = _levels.begin() + high + 1;
+	if (_shift > 0)
+	{
+		copy_backward(_first, _last, _last + _shift);
+		fill(_first, min(_last, _first + _shift), 0);
+	}
+	else if (_shift < 0)
+	{
+		copy(_first, _last, _first + _shift);
+		fill(max(_first, _last + _shift), _last, 0);
+	}
+}
+
+#endif
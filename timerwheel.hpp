@@ -0,0 +1,437 @@
+/**
+* timerwheel.hpp
+* Hierarchical timer wheel, and the timer service built on it that services share.
+* The wheel has four levels of 256 slots: a timer goes to the lowest level whose ring reaches its
+* deadline, and moves down a level each time the level below comes round to it, until it fires
+* from level 0. Timers live in a pool and are linked into their slot, so scheduling and cancelling
+* are O(1). Advancing the time visits only the ticks that have something to do: stretches with no
+* timer due are skipped, so a simulated clock can jump hours ahead cheaply.
+*
+* @author James Wu
+*/
+#ifndef TIMER_WHEEL_HPP
+#define TIMER_WHEEL_HPP
+
+#include <cstdint>
+#include <vector>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+#include "clock.hpp"
+
+using namespace std;
+
+// handle of a scheduled timer: pool index and generation, so a stale handle is recognized
+typedef uint64_t TimerId;
+
+const TimerId INVALID_TIMER = 0;
+
+/**
+* Timer wheel of payloads P, handed back when their deadline is reached.
+* Time is in ns and only moves when the wheel is advanced.
+* Type P is the payload type, default constructible and movable.
+*/
+template<typename P>
+class TimerWheel
+{
+
+public:
+
+	// ctor, with the tick (ns) and the start time (ns); the wheel reaches 2^32 ticks ahead
+	TimerWheel(int64_t _tick = 1000000, int64_t _start = 0);
+
+	// Schedule a payload at _deadline (ns); a deadline already passed fires on the next Advance
+	TimerId Schedule(int64_t _deadline, P _payload);
+
+	// Cancel a timer; false if it already fired or was cancelled
+	bool Cancel(TimerId _timer);
+
+	// Advance the time to _now (ns), calling _fire(P&) on every timer due, in deadline order (then in the
+	// order they were scheduled); timers scheduled by _fire fire in the same call if they are due by _now.
+	// Returns how many fired.
+	template<typename F>
+	int Advance(int64_t _now, F&& _fire);
+
+	// Get the time advanced to (ns)
+	int64_t GetTime() const;
+
+	// Get the tick (ns)
+	int64_t GetTick() const;
+
+	// Get the number of pending timers
+	size_t GetSize() const;
+
+private:
+
+	static constexpr int LEVELS = 4;
+	static constexpr int BITS = 8;
+	static constexpr int SLOTS = 1 << BITS;
+	// the timers whose deadline tick had come when they were scheduled, checked at every visit
+	static constexpr int OVERDUE = LEVELS * SLOTS;
+	static constexpr uint32_t NIL = UINT32_MAX;
+
+	struct Node
+	{
+		P payload;
+		int64_t deadline = 0;
+		uint64_t order = 0;
+		uint32_t next = NIL;
+		uint32_t prev = NIL;
+		uint32_t generation = 1;
+		int32_t slot = -1;		// -1 while the node is free
+	};
+
+	struct Expired
+	{
+		int64_t deadline;
+		uint64_t order;
+		P payload;
+	};
+
+	uint32_t Allocate();
+	void Place(uint32_t _index);
+	void Link(uint32_t _index, int _slot);
+	void Unlink(uint32_t _index);
+	void Release(uint32_t _index);
+	void Cascade();
+	void Collect(int _slot, int64_t _now);
+
+	int64_t tick;
+	int64_t time;
+	int64_t currentTick;	// the tick of the time advanced to, whose timers may not all be due yet
+	array<uint32_t, OVERDUE + 1> slots;
+	array<size_t, LEVELS + 1> counts;
+	vector<Node> nodes;
+	uint32_t freeList;
+	size_t size;
+	uint64_t scheduled;
+	vector<Expired> expired;
+};
+
+template<typename P>
+TimerWheel<P>::TimerWheel(int64_t _tick, int64_t _start)
+{
+	if (_tick <= 0) {
+		throw invalid_argument("timer wheel tick must be positive");
+	}
+	tick = _tick;
+	time = _start;
+	currentTick = _start / _tick;
+	slots.fill(NIL);
+	counts.fill(0);
+	freeList = NIL;
+	size = 0;
+	scheduled = 0;
+}
+
+template<typename P>
+uint32_t TimerWheel<P>::Allocate()
+{
+	if (freeList == NIL) {
+		if (nodes.size() >= NIL) {
+			throw length_error("timer wheel is full");
+		}
+		nodes.emplace_back();
+		return (uint32_t)(nodes.size() - 1);
+	}
+	uint32_t _index = freeList;
+	freeList = nodes[_index].next;
+	return _index;
+}
+
+// the lowest level where the deadline is less than a ring ahead, in the units of the level;
+// deadlines beyond the top ring wait in its last slot and are placed again when it comes round
+template<typename P>
+void TimerWheel<P>::Place(uint32_t _index)
+{
+	int64_t _deadlineTick = nodes[_index].deadline / tick;
+	if (_deadlineTick <= currentTick) {
+		Link(_index, OVERDUE);
+		return;
+	}
+	for (int l = 0; l < LEVELS; l++)
+	{
+		int64_t _distance = (_deadlineTick >> (BITS * l)) - (currentTick >> (BITS * l));
+		if (_distance < SLOTS) {
+			Link(_index, l * SLOTS + (int)((_deadlineTick >> (BITS * l)) & (SLOTS - 1)));
+			return;
+		}
+	}
+	int64_t _top = (currentTick >> (BITS * (LEVELS - 1))) + SLOTS - 1;
+	Link(_index, (LEVELS - 1) * SLOTS + (int)(_top & (SLOTS - 1)));
+}
+
+template<typename P>
+void TimerWheel<P>::Link(uint32_t _index, int _slot)
+{
+	Node& _node = nodes[_index];
+	_node.slot = _slot;
+	_node.prev = NIL;
+	_node.next = slots[_slot];
+	if (_node.next != NIL) {
+		nodes[_node.next].prev = _index;
+	}
+	slots[_slot] = _index;
+	counts[_slot / SLOTS]++;
+}
+
+template<typename P>
+void TimerWheel<P>::Unlink(uint32_t _index)
+{
+	Node& _node = nodes[_index];
+	if (_node.prev != NIL) {
+		nodes[_node.prev].next = _node.next;
+	}
+	else {
+		slots[_node.slot] = _node.next;
+	}
+	if (_node.next != NIL) {
+		nodes[_node.next].prev = _node.prev;
+	}
+	counts[_node.slot / SLOTS]--;
+}
+
+// the generation moves on, so the handles of the node's previous timer go stale
+template<typename P>
+void TimerWheel<P>::Release(uint32_t _index)
+{
+	Node& _node = nodes[_index];
+	_node.slot = -1;
+	_node.generation++;
+	_node.next = freeList;
+	freeList = _index;
+	size--;
+}
+
+template<typename P>
+TimerId TimerWheel<P>::Schedule(int64_t _deadline, P _payload)
+{
+	uint32_t _index = Allocate();
+	Node& _node = nodes[_index];
+	_node.payload = move(_payload);
+	_node.deadline = _deadline;
+	_node.order = scheduled++;
+	Place(_index);
+	size++;
+	return ((TimerId)_node.generation << 32) | _index;
+}
+
+template<typename P>
+bool TimerWheel<P>::Cancel(TimerId _timer)
+{
+	uint32_t _index = (uint32_t)_timer;
+	if (_index >= nodes.size() || nodes[_index].generation != (uint32_t)(_timer >> 32) || nodes[_index].slot < 0) {
+		return false;
+	}
+	Unlink(_index);
+	Release(_index);
+	return true;
+}
+
+// on a tick where a level comes round, the slot of each higher level reached is placed again,
+// the highest first, so its timers drop to the level (or the slot) they belong to now
+template<typename P>
+void TimerWheel<P>::Cascade()
+{
+	int _levels = 0;
+	while (_levels + 1 < LEVELS && (currentTick & (((int64_t)1 << (BITS * (_levels + 1))) - 1)) == 0) {
+		_levels++;
+	}
+	for (int l = _levels; l >= 1; l--)
+	{
+		int _slot = l * SLOTS + (int)((currentTick >> (BITS * l)) & (SLOTS - 1));
+		uint32_t _index = slots[_slot];
+		while (_index != NIL)
+		{
+			uint32_t _next = nodes[_index].next;
+			Unlink(_index);
+			Place(_index);
+			_index = _next;
+		}
+	}
+}
+
+template<typename P>
+void TimerWheel<P>::Collect(int _slot, int64_t _now)
+{
+	uint32_t _index = slots[_slot];
+	while (_index != NIL)
+	{
+		uint32_t _next = nodes[_index].next;
+		if (nodes[_index].deadline <= _now) {
+			expired.push_back({ nodes[_index].deadline, nodes[_index].order, move(nodes[_index].payload) });
+			Unlink(_index);
+			Release(_index);
+		}
+		_index = _next;
+	}
+}
+
+// the due timers of a tick are taken off the wheel before any fires, so that a callback may schedule
+// or cancel timers freely
+template<typename P>
+template<typename F>
+int TimerWheel<P>::Advance(int64_t _now, F&& _fire)
+{
+	if (_now < time) {
+		return 0;
+	}
+	time = _now;
+	int64_t _nowTick = _now / tick;
+	int _fired = 0;
+	bool _visit = true;
+	while (_visit)
+	{
+		Collect(OVERDUE, _now);
+		Collect((int)(currentTick & (SLOTS - 1)), _now);
+		if (!expired.empty())
+		{
+			// a callback may advance the wheel again, so the timers are fired from a copy
+			vector<Expired> _due;
+			_due.swap(expired);
+			sort(_due.begin(), _due.end(), [](const Expired& _a, const Expired& _b) {
+				return _a.deadline != _b.deadline ? _a.deadline < _b.deadline : _a.order < _b.order; });
+			for (auto& _timer : _due)
+			{
+				_fire(_timer.payload);
+				_fired++;
+			}
+			_due.clear();
+			if (expired.empty()) {
+				_due.swap(expired);
+			}
+			// timers scheduled by the callbacks may be due already
+			continue;
+		}
+		if (currentTick >= _nowTick) {
+			break;
+		}
+
+		// the next tick with something to do: the next one if level 0 has timers, otherwise the next
+		// time the lowest level holding timers comes round (or now if the wheel is empty)
+		int64_t _next = _nowTick;
+		for (int l = 0; l < LEVELS; l++)
+		{
+			if (counts[l] > 0) {
+				_next = min(_nowTick, ((currentTick >> (BITS * l)) + 1) << (BITS * l));
+				break;
+			}
+		}
+		currentTick = _next;
+		if ((currentTick & (SLOTS - 1)) == 0) {
+			Cascade();
+		}
+	}
+	return _fired;
+}
+
+template<typename P>
+int64_t TimerWheel<P>::GetTime() const
+{
+	return time;
+}
+
+template<typename P>
+int64_t TimerWheel<P>::GetTick() const
+{
+	return tick;
+}
+
+template<typename P>
+size_t TimerWheel<P>::GetSize() const
+{
+	return size;
+}
+
+/**
+* Timer service shared by the time-driven components (flushes, order slices, quote expiries).
+* Callbacks are registered at a time or after a delay, and cancelled by their handle. The time is
+* its clock's steady time: Poll() runs what is due as of the clock, and on a simulated clock the
+* replay runs as fast as it is driven and always the same way. Advance() drives it to a given time.
+* Callbacks run on the thread advancing the time.
+*/
+class TimerService
+{
+
+public:
+
+	// ctor, with the clock (the process clock by default) and the tick
+	TimerService(Clock* _clock = nullptr, chrono::nanoseconds _tick = chrono::milliseconds(1));
+
+	// Register a callback at _time (ns)
+	TimerId ScheduleAt(int64_t _time, function<void()> _callback);
+
+	// Register a callback _delay after the current time
+	TimerId ScheduleAfter(chrono::nanoseconds _delay, function<void()> _callback);
+
+	// Cancel a callback; false if it already ran or was cancelled
+	bool Cancel(TimerId _timer);
+
+	// Advance the time to _now (ns), running the callbacks due; returns how many ran
+	int Advance(int64_t _now);
+
+	// Advance the time to the clock's
+	int Poll();
+
+	// Get the current time (ns)
+	int64_t GetTime() const;
+
+	// Get the clock
+	Clock* GetClock() const;
+
+	// Get the number of pending callbacks
+	size_t GetSize() const;
+
+private:
+	Clock* clock;
+	TimerWheel<function<void()>> wheel;
+};
+
+TimerService::TimerService(Clock* _clock, chrono::nanoseconds _tick) :
+	clock(_clock ? _clock : &CurrentClock()), wheel(_tick.count(), clock->Steady())
+{
+}
+
+TimerId TimerService::ScheduleAt(int64_t _time, function<void()> _callback)
+{
+	return wheel.Schedule(_time, move(_callback));
+}
+
+TimerId TimerService::ScheduleAfter(chrono::nanoseconds _delay, function<void()> _callback)
+{
+	return wheel.Schedule(wheel.GetTime() + _delay.count(), move(_callback));
+}
+
+bool TimerService::Cancel(TimerId _timer)
+{
+	return wheel.Cancel(_timer);
+}
+
+int TimerService::Advance(int64_t _now)
+{
+	return wheel.Advance(_now, [](function<void()>& _callback) { _callback(); });
+}
+
+int TimerService::Poll()
+{
+	return Advance(clock->Steady());
+}
+
+int64_t TimerService::GetTime() const
+{
+	return wheel.GetTime();
+}
+
+Clock* TimerService::GetClock() const
+{
+	return clock;
+}
+
+size_t TimerService::GetSize() const
+{
+	return wheel.GetSize();
+}
+
+#endif
@@ -10,7 +10,11 @@
 
 #include <string>
 #include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
 #include "executionservice.hpp"
+#include "tradestore.hpp"
 #include "soa.hpp"
 
  // Trade sides
@@ -28,13 +32,13 @@ public:
 
 	// ctor for a trade
 	Trade() = default;
-	Trade(const T& _product, string _tradeId, double _price, string _book, long _quantity, Side _side);
+	Trade(const T& _product, TradingId _tradeId, double _price, string _book, long _quantity, Side _side);
 
 	// Get the product
 	const T& GetProduct() const;
 
 	// Get the trade ID
-	const string& GetTradeId() const;
+	const TradingId& GetTradeId() const;
 
 	// Get the mid price
 	double GetPrice() const;
@@ -48,9 +52,12 @@ public:
 	// Get the side
 	Side GetSide() const;
 
+	// Change attributes to strings
+	vector<string> ToStrings() const;
+
 private:
 	T product;
-	string tradeId;
+	TradingId tradeId;
 	double price;
 	string book;
 	long quantity;
@@ -59,12 +66,10 @@ private:
 };
 
 template<typename T>
-Trade<T>::Trade(const T& _product, string _tradeId, double _price, string _book, long _quantity, Side _side) :
-	product(_product)
+Trade<T>::Trade(const T& _product, TradingId _tradeId, double _price, string _book, long _quantity, Side _side) :
+	product(_product), tradeId(_tradeId), book(move(_book))
 {
-	tradeId = _tradeId;
 	price = _price;
-	book = _book;
 	quantity = _quantity;
 	side = _side;
 }
@@ -76,7 +81,7 @@ const T& Trade<T>::GetProduct() const
 }
 
 template<typename T>
-const string& Trade<T>::GetTradeId() const
+const TradingId& Trade<T>::GetTradeId() const
 {
 	return tradeId;
 }
@@ -105,6 +110,19 @@ Side Trade<T>::GetSide() const
 	return side;
 }
 
+template<typename T>
+vector<string> Trade<T>::ToStrings() const
+{
+	vector<string> _strings;
+	_strings.push_back(product.GetProductId());
+	_strings.push_back(tradeId.ToString());
+	_strings.push_back(PriceToString(price));
+	_strings.push_back(book);
+	_strings.push_back(to_string(quantity));
+	_strings.push_back(side == BUY ? "BUY" : "SELL");
+	return _strings;
+}
+
 /**
 * Pre-declearations to avoid errors.
 */
@@ -116,19 +134,22 @@ class TradeBookingToExecutionListener;
 /**
  * Trade Booking Service to book trades to a particular book.
  * Keyed on trade id.
+ * Trades are kept in a TradeStore under a retention policy (everything by default). Trades beyond
+ * the retention are removed from the service (ProcessRemove on its listeners) and handed to the
+ * eviction listener, e.g. a historical data service, with ProcessAdd.
  * Type T is the product type.
  */
 template<typename T>
-class TradeBookingService : public Service<string, Trade <T> >
+class TradeBookingService : public Service<TradingId, Trade <T> >
 {
 
 public:
 
 	// Ctor
-	TradeBookingService();
+	TradeBookingService(const TradeRetention& _retention = TradeRetention());
 
-	// Get data on our service given a key
-	Trade<T>& GetData(string _key);
+	// Get data on our service given a key; throws out_of_range if the trade is not (or no longer) held
+	Trade<T>& GetData(const TradingId& _key);
 
 	// The callback that a Connector should invoke for any new or updated data
 	void OnMessage(Trade<T>& _data);
@@ -148,39 +169,60 @@ public:
 	// Book the trade
 	void BookTrade(Trade<T>& _trade);
 
+	// Set the listener receiving the evicted trades
+	void SetEvictionListener(ServiceListener<Trade<T>>* _listener);
+
+	// Get the trade store
+	const TradeStore<Trade<T>>& GetStore() const;
 
 private:
-	map<string, Trade<T>> trades;
+	TradeStore<Trade<T>> trades;
 	vector<ServiceListener<Trade<T>>*> listeners;
 	TradeBookingConnector<T>* connector;
 	TradeBookingToExecutionListener<T>* listener;
+	ServiceListener<Trade<T>>* evictionListener;
 };
 
 template<typename T>
-TradeBookingService<T>::TradeBookingService()
+TradeBookingService<T>::TradeBookingService(const TradeRetention& _retention) :
+	trades(_retention)
 {
-	trades = map<string, Trade<T>>();
 	listeners = vector<ServiceListener<Trade<T>>*>();
 	connector = new TradeBookingConnector<T>(this);
 	listener = new TradeBookingToExecutionListener<T>(this);
+	evictionListener = nullptr;
 }
 
 template<typename T>
-Trade<T>& TradeBookingService<T>::GetData(string _key)
+Trade<T>& TradeBookingService<T>::GetData(const TradingId& _key)
 {
-	return trades[_key];
+	Trade<T>* _trade = trades.Find(_key);
+	if (!_trade) {
+		throw out_of_range("trade not booked or already evicted: " + _key.ToString());
+	}
+	return *_trade;
 }
 
 template<typename T>
 void TradeBookingService<T>::OnMessage(Trade<T>& _data)
 {
-	string _id = _data.GetTradeId();
-	trades[_id] = _data;
+	int64_t _now = CurrentClock().Steady();
+	trades.InsertOrAssign(_data.GetTradeId(), _data, _now);
 
 	for (auto& l : listeners)
 	{
 		l->ProcessAdd(_data);
 	}
+
+	trades.Evict(_now, [this](Trade<T>& _trade) {
+		for (auto& l : listeners)
+		{
+			l->ProcessRemove(_trade);
+		}
+		if (evictionListener) {
+			evictionListener->ProcessAdd(_trade);
+		}
+	});
 }
 
 template<typename T>
@@ -216,6 +258,18 @@ void TradeBookingService<T>::BookTrade(Trade<T>& _trade)
 	}
 }
 
+template<typename T>
+void TradeBookingService<T>::SetEvictionListener(ServiceListener<Trade<T>>* _listener)
+{
+	evictionListener = _listener;
+}
+
+template<typename T>
+const TradeStore<Trade<T>>& TradeBookingService<T>::GetStore() const
+{
+	return trades;
+}
+
 /**
 * Trade Booking Connector subscribing data to Trading Booking Service.
 * Type T is the product type.
@@ -254,28 +308,31 @@ template<typename T>
 void TradeBookingConnector<T>::Subscribe(ifstream& _data)
 {
 	string _line;
+	vector<string> _cells;
 	while (getline(_data, _line))
 	{
-		auto _cells = LineToCells(_line);
+		LineToCells(_line, _cells);
 
-		string _productId = _cells[0];
-		string _tradeId = _cells[1];
+		const string& _productId = _cells[0];
 		double _price = StringToPrice(_cells[2]);
-		string _book = _cells[3];
 		long _quantity = stol(_cells[4]);
 		Side _side = _cells[5] == "BUY" ? BUY : SELL;
-		T _product = FetchBond(_productId);
-		Trade<T> _trade(_product, _tradeId, _price, _book, _quantity, _side);
+		Trade<T> _trade(FetchBond(_productId), _cells[1], _price, move(_cells[3]), _quantity, _side);
 		service->OnMessage(_trade);
 	}
 }
 
 /**
-* Trade Booking Service Listener subscribing data from Execution Service to Trading Booking Service.
+* Trade Booking Service Listener subscribing the fills of the Execution Service to Trading Booking Service.
+* The fills of each order are aggregated, and every _batch fills (1 by default) the listener books
+* one trade per order with fills not booked yet, for their total quantity at their average price,
+* in the order of their first fill. An order's first trade carries its order ID, any later one a
+* new ID. The books are taken in turn, one per trade. Each trade is booked once, through OnMessage,
+* which stores it and notifies the listeners of the service.
 * Type T is the product type.
 */
 template<typename T>
-class TradeBookingToExecutionListener : public ServiceListener<ExecutionOrder<T>>
+class TradeBookingToExecutionListener : public ServiceListener<Fill<T>>
 {
 
 public:
@@ -284,17 +341,48 @@ public:
 	TradeBookingToExecutionListener(TradeBookingService<T>* _service);
 
 	// Listener callback to process an add event to the Service
-	void ProcessAdd(ExecutionOrder<T>& _data);
+	void ProcessAdd(Fill<T>& _data);
 
 	// Listener callback to process a remove event to the Service
-	void ProcessRemove(ExecutionOrder<T>& _data);
+	void ProcessRemove(Fill<T>& _data);
 
 	// Listener callback to process an update event to the Service
-	void ProcessUpdate(ExecutionOrder<T>& _data);
+	void ProcessUpdate(Fill<T>& _data);
+
+	// Book the fills every _fills fills
+	void SetBatch(size_t _fills);
+
+	// Book the fills not booked yet
+	void Flush();
+
+	// Get the number of fills received and of trades booked
+	long GetFillCount() const;
+	long GetTradeCount() const;
+
+	// Get the number of orders with fills not booked yet or not done
+	size_t GetOpenOrderCount() const;
 
 private:
 
+	// fills of an order not booked yet
+	struct OpenOrder
+	{
+		const T* product = nullptr;
+		PricingSide side = BID;
+		long quantity = 0;
+		double notional = 0.0;
+		double price = 0.0;
+		long fills = 0;
+		bool booked = false;
+		bool done = false;
+	};
+
 	TradeBookingService<T>* service;
+	unordered_map<TradingId, OpenOrder> openOrders;
+	vector<TradingId> pendingOrders;
+	size_t batch;
+	size_t pendingFills;
+	long fillCount;
 	long tradeBookCount;
 
 };
@@ -303,44 +391,98 @@ template<typename T>
 TradeBookingToExecutionListener<T>::TradeBookingToExecutionListener(TradeBookingService<T>* _service)
 {
 	service = _service;
+	batch = 1;
+	pendingFills = 0;
+	fillCount = 0;
 	tradeBookCount = 0;
 }
 
 template<typename T>
-void TradeBookingToExecutionListener<T>::ProcessAdd(ExecutionOrder<T>& _data)
+void TradeBookingToExecutionListener<T>::ProcessAdd(Fill<T>& _data)
 {
-	std::vector<string> marketVec{ "TRSY1","TRSY2","TRSY3" };
-	tradeBookCount++;
-
-	T _product = _data.GetProduct();
-	PricingSide _pricingSide = _data.GetPricingSide();
-	string _orderId = _data.GetOrderId();
-	double _price = _data.GetPrice();
-	long _visibleQuantity = _data.GetVisibleQuantity();
-	long _hiddenQuantity = _data.GetHiddenQuantity();
-
-	Side _side;
-	if (_pricingSide == BID) {
-		_side = SELL;
+	fillCount++;
+	OpenOrder& _order = openOrders[_data.GetOrderId()];
+	_order.product = _data.GetProductHandle();
+	_order.side = _data.GetPricingSide();
+	_order.done = _data.GetLeavesQuantity() == 0;
+	if (_data.GetQuantity() > 0)
+	{
+		if (_order.fills == 0) {
+			pendingOrders.push_back(_data.GetOrderId());
+		}
+		_order.quantity += _data.GetQuantity();
+		_order.notional += _data.GetPrice() * _data.GetQuantity();
+		_order.price = _data.GetPrice();
+		_order.fills++;
 	}
-	if (_pricingSide == OFFER) {
-		_side = BUY;
+	if (_order.done && _order.fills == 0) {
+		openOrders.erase(_data.GetOrderId());
 	}
 
-	string _book = marketVec[tradeBookCount % 3];
-	long _quantity = _visibleQuantity + _hiddenQuantity;
-
-	Trade<T> _trade(_product, _orderId, _price, _book, _quantity, _side);
-	service->OnMessage(_trade);
-	service->BookTrade(_trade);
+	if (++pendingFills >= batch) {
+		Flush();
+	}
 }
 
 // do nothing for these methods (not required)
 template<typename T>
-void TradeBookingToExecutionListener<T>::ProcessRemove(ExecutionOrder<T>& _data) {}
+void TradeBookingToExecutionListener<T>::ProcessRemove(Fill<T>& _data) {}
 
 template<typename T>
-void TradeBookingToExecutionListener<T>::ProcessUpdate(ExecutionOrder<T>& _data) {}
+void TradeBookingToExecutionListener<T>::ProcessUpdate(Fill<T>& _data) {}
 
+template<typename T>
+void TradeBookingToExecutionListener<T>::SetBatch(size_t _fills)
+{
+	batch = max<size_t>(_fills, 1);
+	if (pendingFills >= batch) {
+		Flush();
+	}
+}
+
+// a single fill is booked at its own price, so that it is not rounded through the average
+template<typename T>
+void TradeBookingToExecutionListener<T>::Flush()
+{
+	for (auto& _orderId : pendingOrders)
+	{
+		OpenOrder& _order = openOrders.at(_orderId);
+		tradeBookCount++;
+
+		Side _side = _order.side == BID ? SELL : BUY;
+		const string& _book = bookNames[tradeBookCount % BOOK_COUNT];
+		double _price = _order.fills == 1 ? _order.price : _order.notional / _order.quantity;
+		Trade<T> _trade(*_order.product, _order.booked ? GenerateTradingId() : _orderId, _price, _book, _order.quantity, _side);
+
+		if (_order.done) {
+			openOrders.erase(_orderId);
+		}
+		else {
+			_order = OpenOrder{ _order.product, _order.side, 0, 0.0, 0.0, 0, true, false };
+		}
+
+		service->OnMessage(_trade);
+	}
+	pendingOrders.clear();
+	pendingFills = 0;
+}
+
+template<typename T>
+long TradeBookingToExecutionListener<T>::GetFillCount() const
+{
+	return fillCount;
+}
+
+template<typename T>
+long TradeBookingToExecutionListener<T>::GetTradeCount() const
+{
+	return tradeBookCount;
+}
+
+template<typename T>
+size_t TradeBookingToExecutionListener<T>::GetOpenOrderCount() const
+{
+	return openOrders.size();
+}
 
 #endif
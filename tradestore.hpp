@@ -0,0 +1,316 @@
+/**
+* tradestore.hpp
+* Open-addressing hash store keyed by TradingId, with a retention policy.
+* Slots are probed linearly in a power-of-two table kept at most half full, and removals shift
+* the following slots back (no tombstones), so lookups stay O(1) however many entries went through.
+* The entries are kept in a ring in booking order, which drives the retention: only the last N entries, or only the entries
+* booked within a time window, are kept, and the older ones are handed back to the caller on eviction.
+*
+* @author James Wu
+*/
+#ifndef TRADE_STORE_HPP
+#define TRADE_STORE_HPP
+
+#include <cstdint>
+#include <vector>
+#include <chrono>
+#include <stdexcept>
+#include "tradingid.hpp"
+
+using namespace std;
+
+enum RetentionType { RETAIN_ALL, RETAIN_LAST, RETAIN_WINDOW };
+
+/**
+* Retention policy of a store: everything, the last N entries, or a time window.
+*/
+struct TradeRetention
+{
+	RetentionType type = RETAIN_ALL;
+	size_t count = 0;
+	int64_t window = 0;
+
+	// keep every entry (the store grows with the day)
+	static TradeRetention All();
+
+	// keep the last _count entries
+	static TradeRetention Last(size_t _count);
+
+	// keep the entries booked within _window of the latest one
+	static TradeRetention Window(chrono::nanoseconds _window);
+};
+
+TradeRetention TradeRetention::All()
+{
+	return TradeRetention();
+}
+
+TradeRetention TradeRetention::Last(size_t _count)
+{
+	if (_count == 0) {
+		throw invalid_argument("retention count must be positive");
+	}
+	TradeRetention _retention;
+	_retention.type = RETAIN_LAST;
+	_retention.count = _count;
+	return _retention;
+}
+
+TradeRetention TradeRetention::Window(chrono::nanoseconds _window)
+{
+	TradeRetention _retention;
+	_retention.type = RETAIN_WINDOW;
+	_retention.window = _window.count();
+	return _retention;
+}
+
+/**
+* Hash store of V keyed on TradingId.
+* The values live in the booking ring, written and evicted in order; the hash slots only map a key
+* to the booking sequence number of its value, so the table stays small and probes stay in cache.
+* Type V is the stored type, default constructible and copy assignable.
+*/
+template<typename V>
+class TradeStore
+{
+
+public:
+
+	// ctor
+	TradeStore(const TradeRetention& _retention = TradeRetention());
+
+	// Get the value of a key, nullptr if it is not (or no longer) stored
+	V* Find(const TradingId& _key);
+	const V* Find(const TradingId& _key) const;
+
+	// Store a value booked at _time (ns); an existing key is updated in place and keeps its booking time
+	V& InsertOrAssign(const TradingId& _key, const V& _value, int64_t _time);
+
+	// Evict the entries beyond the retention as of _time (ns), oldest first, calling _evicted(V&) on each
+	template<typename F>
+	void Evict(int64_t _time, F&& _evicted);
+
+	// Get the number of stored entries
+	size_t GetSize() const;
+
+	// Get the number of slots of the hash table
+	size_t GetCapacity() const;
+
+	// Get the number of entries evicted so far
+	long GetEvictedCount() const;
+
+	// Get the retention policy
+	const TradeRetention& GetRetention() const;
+
+private:
+
+	// sequence 0 marks an empty slot, bookings are numbered from 1
+	struct Slot
+	{
+		TradingId key;
+		uint64_t sequence = 0;
+	};
+
+	struct Booking
+	{
+		TradingId key;
+		int64_t time = 0;
+		V value;
+	};
+
+	size_t Home(const TradingId& _key) const;
+	size_t Probe(const TradingId& _key) const;
+	Booking& BookingOf(uint64_t _sequence);
+	const Booking& BookingOf(uint64_t _sequence) const;
+	void GrowSlots();
+	void GrowBookings();
+	void Erase(size_t _index);
+
+	TradeRetention retention;
+	vector<Slot> slots;
+	size_t slotMask;
+	vector<Booking> bookings;
+	size_t bookingMask;
+	uint64_t first;
+	uint64_t next;
+	long evicted;
+};
+
+template<typename V>
+TradeStore<V>::TradeStore(const TradeRetention& _retention) :
+	retention(_retention)
+{
+	// a bounded store is sized once for its retention (one entry over it before eviction)
+	size_t _bookings = 16;
+	while (retention.type == RETAIN_LAST && _bookings < retention.count + 1) {
+		_bookings *= 2;
+	}
+	bookings.resize(_bookings);
+	bookingMask = _bookings - 1;
+	slots.resize(2 * _bookings);
+	slotMask = slots.size() - 1;
+	first = 1;
+	next = 1;
+	evicted = 0;
+}
+
+template<typename V>
+size_t TradeStore<V>::Home(const TradingId& _key) const
+{
+	return _key.Hash() & slotMask;
+}
+
+// index of the key's slot, or of the empty slot where it would go
+template<typename V>
+size_t TradeStore<V>::Probe(const TradingId& _key) const
+{
+	size_t _index = Home(_key);
+	while (slots[_index].sequence != 0 && slots[_index].key != _key) {
+		_index = (_index + 1) & slotMask;
+	}
+	return _index;
+}
+
+template<typename V>
+typename TradeStore<V>::Booking& TradeStore<V>::BookingOf(uint64_t _sequence)
+{
+	return bookings[_sequence & bookingMask];
+}
+
+template<typename V>
+const typename TradeStore<V>::Booking& TradeStore<V>::BookingOf(uint64_t _sequence) const
+{
+	return bookings[_sequence & bookingMask];
+}
+
+template<typename V>
+V* TradeStore<V>::Find(const TradingId& _key)
+{
+	const Slot& _slot = slots[Probe(_key)];
+	return _slot.sequence != 0 ? &BookingOf(_slot.sequence).value : nullptr;
+}
+
+template<typename V>
+const V* TradeStore<V>::Find(const TradingId& _key) const
+{
+	const Slot& _slot = slots[Probe(_key)];
+	return _slot.sequence != 0 ? &BookingOf(_slot.sequence).value : nullptr;
+}
+
+template<typename V>
+V& TradeStore<V>::InsertOrAssign(const TradingId& _key, const V& _value, int64_t _time)
+{
+	size_t _index = Probe(_key);
+	if (slots[_index].sequence != 0) {
+		V& _stored = BookingOf(slots[_index].sequence).value;
+		_stored = _value;
+		return _stored;
+	}
+
+	if (next - first == bookings.size()) {
+		GrowBookings();
+	}
+	if (2 * (next - first + 1) > slots.size()) {
+		GrowSlots();
+		_index = Probe(_key);
+	}
+	slots[_index].key = _key;
+	slots[_index].sequence = next;
+	Booking& _booking = BookingOf(next++);
+	_booking.key = _key;
+	_booking.time = _time;
+	_booking.value = _value;
+	return _booking.value;
+}
+
+template<typename V>
+template<typename F>
+void TradeStore<V>::Evict(int64_t _time, F&& _evicted)
+{
+	while (first != next)
+	{
+		Booking& _oldest = BookingOf(first);
+		bool _expired = (retention.type == RETAIN_LAST && next - first > retention.count) ||
+			(retention.type == RETAIN_WINDOW && _time - _oldest.time > retention.window);
+		if (!_expired) {
+			break;
+		}
+
+		Erase(Probe(_oldest.key));
+		first++;
+		evicted++;
+		// the value stays in its ring entry until the entry is reused
+		_evicted(_oldest.value);
+	}
+}
+
+template<typename V>
+size_t TradeStore<V>::GetSize() const
+{
+	return next - first;
+}
+
+template<typename V>
+size_t TradeStore<V>::GetCapacity() const
+{
+	return slots.size();
+}
+
+template<typename V>
+long TradeStore<V>::GetEvictedCount() const
+{
+	return evicted;
+}
+
+template<typename V>
+const TradeRetention& TradeStore<V>::GetRetention() const
+{
+	return retention;
+}
+
+template<typename V>
+void TradeStore<V>::GrowSlots()
+{
+	vector<Slot> _old(slots.size() * 2);
+	_old.swap(slots);
+	slotMask = slots.size() - 1;
+	for (auto& _slot : _old)
+	{
+		if (_slot.sequence != 0) {
+			slots[Probe(_slot.key)] = _slot;
+		}
+	}
+}
+
+// the live sequences are contiguous, so they keep distinct entries in a ring twice as long
+template<typename V>
+void TradeStore<V>::GrowBookings()
+{
+	vector<Booking> _old(bookings.size() * 2);
+	_old.swap(bookings);
+	size_t _oldMask = bookingMask;
+	bookingMask = bookings.size() - 1;
+	for (uint64_t s = first; s != next; s++) {
+		bookings[s & bookingMask] = move(_old[s & _oldMask]);
+	}
+}
+
+// backward-shift deletion: pull back every following entry that may sit in the freed slot
+template<typename V>
+void TradeStore<V>::Erase(size_t _index)
+{
+	size_t _next = (_index + 1) & slotMask;
+	while (slots[_next].sequence != 0)
+	{
+		// the entry can move back if its home is not after the hole
+		size_t _home = Home(slots[_next].key);
+		if (((_next - _home) & slotMask) >= ((_next - _index) & slotMask)) {
+			slots[_index] = slots[_next];
+			_index = _next;
+		}
+		_next = (_next + 1) & slotMask;
+	}
+	slots[_index].sequence = 0;
+}
+
+#endif
@@ -0,0 +1,155 @@
+/**
+* tradingid.hpp
+* Fixed-capacity identifier for trades, orders and inquiries.
+* The characters are stored inline (up to 16, zero padded), so an id never touches the heap,
+* is trivially copyable, and compares and hashes as two 64-bit words.
+*
+* @author James Wu
+*/
+#ifndef TRADING_ID_HPP
+#define TRADING_ID_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#include <functional>
+
+using namespace std;
+
+class TradingId
+{
+
+public:
+
+	// maximum number of characters
+	static constexpr int CAPACITY = 16;
+
+	// ctor for an empty id
+	TradingId() = default;
+
+	// ctor from characters; throws invalid_argument beyond CAPACITY characters
+	TradingId(const char* _chars, size_t _length);
+	TradingId(string_view _id);
+	TradingId(const string& _id);
+	TradingId(const char* _id);
+
+	// Get the number of characters
+	size_t GetLength() const;
+
+	// Is the id empty?
+	bool IsEmpty() const;
+
+	// Get the characters (not null terminated at full capacity)
+	string_view View() const;
+
+	// Copy the characters into a string
+	string ToString() const;
+
+	// Hash of the id
+	size_t Hash() const;
+
+	bool operator==(const TradingId& _other) const;
+	bool operator!=(const TradingId& _other) const;
+
+	// same order as the strings
+	bool operator<(const TradingId& _other) const;
+
+private:
+	char chars[CAPACITY] = {};
+};
+
+static_assert(sizeof(TradingId) == TradingId::CAPACITY, "TradingId must stay 16 bytes");
+static_assert(is_trivially_copyable<TradingId>::value, "TradingId must be trivially copyable");
+
+TradingId::TradingId(const char* _chars, size_t _length)
+{
+	if (_length > CAPACITY) {
+		throw invalid_argument("id longer than " + to_string(CAPACITY) + " characters: " + string(_chars, _length));
+	}
+	memcpy(chars, _chars, _length);
+}
+
+TradingId::TradingId(string_view _id) :
+	TradingId(_id.data(), _id.size()) {}
+
+TradingId::TradingId(const string& _id) :
+	TradingId(_id.data(), _id.size()) {}
+
+TradingId::TradingId(const char* _id) :
+	TradingId(_id, strlen(_id)) {}
+
+size_t TradingId::GetLength() const
+{
+	const void* _end = memchr(chars, '\0', CAPACITY);
+	return _end ? (const char*)_end - chars : CAPACITY;
+}
+
+bool TradingId::IsEmpty() const
+{
+	return chars[0] == '\0';
+}
+
+string_view TradingId::View() const
+{
+	return string_view(chars, GetLength());
+}
+
+string TradingId::ToString() const
+{
+	return string(View());
+}
+
+size_t TradingId::Hash() const
+{
+	uint64_t _low, _high;
+	memcpy(&_low, chars, 8);
+	memcpy(&_high, chars + 8, 8);
+	// ids often differ only in their last characters (the high bytes of _high), so the words are
+	// combined and fully mixed (murmur3 finalizer): open-addressing tables use the low bits
+	uint64_t _h = (_low * 0x9E3779B97F4A7C15ULL) ^ _high;
+	_h ^= _h >> 33;
+	_h *= 0xFF51AFD7ED558CCDULL;
+	_h ^= _h >> 33;
+	_h *= 0xC4CEB9FE1A85EC53ULL;
+	_h ^= _h >> 33;
+	return (size_t)_h;
+}
+
+bool TradingId::operator==(const TradingId& _other) const
+{
+	return memcmp(chars, _other.chars, CAPACITY) == 0;
+}
+
+bool TradingId::operator!=(const TradingId& _other) const
+{
+	return !(*this == _other);
+}
+
+// zero padding sorts before any character, so this matches the string order
+bool TradingId::operator<(const TradingId& _other) const
+{
+	return memcmp(chars, _other.chars, CAPACITY) < 0;
+}
+
+ostream& operator<<(ostream& _output, const TradingId& _id)
+{
+	return _output << _id.View();
+}
+
+namespace std
+{
+	template<>
+	struct hash<TradingId>
+	{
+		size_t operator()(const TradingId& _id) const
+		{
+			return _id.Hash();
+		}
+	};
+}
+
+#endif
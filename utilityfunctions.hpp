@@ -8,11 +8,15 @@
 #include <chrono>
 #include <ctime>
 #include <map>
+#include <array>
+#include <stdexcept>
 #include <random>
 #include <cstdlib>
 #include <time.h>
 #include <fstream>
 #include "products.hpp"
+#include "tradingid.hpp"
+#include "clock.hpp"
 #include <boost/date_time/gregorian/gregorian.hpp>
 
 using namespace std;
@@ -61,22 +65,6 @@ string PriceToString(double price) {
 	return res;
 }
 
-// the function to fetch the PV01 value.
-// data calculated at December 19th, 2022
-// although not very accurate, but the scales make sense
-// data source (yield and bond price, etc): https://www.cnbc.com/quotes
-double GetPV01(string _id) {
-	map<string, double> PV01Map({
-		{"91282CFX4", 0.01967211},
-		{"91282CFW6", 0.028849852},
-		{"91282CFZ9", 0.048555605 },
-		{"91282CFY2", 0.068303332 },
-		{"91282CFV8", 0.08071955 },
-		{"912810TM0", 0.118325668 },
-		{"912810TL2", 0.185319634 } });
-	return PV01Map[_id];
-}
-
 // create the maps: <maturity, <name, maturity_date>>
 const map<int, pair<string, date>> bondMap({
 	{2, {"91282CFX4", {2024, Nov, 30}}},
@@ -107,6 +95,40 @@ const map<string, double> bondIdCouponMap({
 	{"912810TM0", 0.04000},
 	{"912810TL2", 0.04000}});
 
+// the map between bond id and their PV01 values, built once with the rest of the reference data.
+// data calculated at December 19th, 2022
+// although not very accurate, but the scales make sense
+// data source (yield and bond price, etc): https://www.cnbc.com/quotes
+const map<string, double> bondIdPV01Map({
+	{"91282CFX4", 0.01967211},
+	{"91282CFW6", 0.028849852},
+	{"91282CFZ9", 0.048555605 },
+	{"91282CFY2", 0.068303332 },
+	{"91282CFV8", 0.08071955 },
+	{"912810TM0", 0.118325668 },
+	{"912810TL2", 0.185319634 } });
+
+// the function to fetch the PV01 value (0 for unknown products).
+double GetPV01(const string& _id) {
+	auto _it = bondIdPV01Map.find(_id);
+	return _it == bondIdPV01Map.end() ? 0.0 : _it->second;
+}
+
+// the trading books positions are kept in.
+// books are interned as small integer ids (their index here) so that positions can be stored in fixed arrays.
+const int BOOK_COUNT = 3;
+const array<string, BOOK_COUNT> bookNames{ "TRSY1", "TRSY2", "TRSY3" };
+
+// fetch the interned id of a book
+int FetchBookId(const string& _book) {
+	for (int i = 0; i < BOOK_COUNT; i++) {
+		if (_book == bookNames[i]) {
+			return i;
+		}
+	}
+	throw invalid_argument("unknown book: " + _book);
+}
+
 // fetch contract names by maturity
 string FetchCusipId(int mat) {
 	string id = bondMap.at(mat).first;
@@ -124,9 +146,17 @@ Bond FetchBond(string _id) {
 	return FetchBond(_mat);
 }
 
-// utility function that fetches time
-string GetTimeStamp() {
-	auto curr_time = chrono::system_clock::now();
+// handle of the interned bond with the given id (built with FetchBond on first use)
+const Bond* InternBond(const string& _id) {
+	if (const Bond* _bond = ProductRegistry<Bond>::Find(_id)) {
+		return _bond;
+	}
+	return ProductRegistry<Bond>::Intern(FetchBond(_id));
+}
+
+// utility function that formats a time (ns since the epoch)
+string GetTimeStamp(int64_t _time) {
+	auto curr_time = chrono::system_clock::time_point(chrono::duration_cast<chrono::system_clock::duration>(chrono::nanoseconds(_time)));
 	auto curr_time_t = chrono::system_clock::to_time_t(curr_time);
 
 	// milliseconed precision?
@@ -144,47 +174,87 @@ string GetTimeStamp() {
 		m_seconds = to_string(milliseconds);
 	}
 
+	// localtime() shares one static buffer across threads (the GUI publishes from its own thread)
+	tm local_time;
+#ifdef _WIN32
+	localtime_s(&local_time, &curr_time_t);
+#else
+	localtime_r(&curr_time_t, &local_time);
+#endif
 	char time_string[24];
-	strftime(time_string, 24, "%F %T", localtime(&curr_time_t));
+	strftime(time_string, 24, "%F %T", &local_time);
 	return static_cast<string>(time_string) + "." + m_seconds;
 }
 
-// utility function that fetches current millisecond
+// utility function that fetches time, on the process clock
+string GetTimeStamp() {
+	return GetTimeStamp(CurrentClock().Now());
+}
+
+// utility function that fetches current millisecond, on the process clock
 long GetMillisecond()
 {
-	auto timePoint = chrono::system_clock::now();
-	auto sec = chrono::time_point_cast<chrono::seconds>(timePoint);
-	auto millisec = chrono::duration_cast<chrono::milliseconds>(timePoint - sec);
-	long _millisecCount = static_cast<long>(millisec.count());
-	return _millisecCount;
+	return static_cast<long>(CurrentClock().Now() % 1000000000 / 1000000);
 }
 
-// utility function to generate random trading Ids
-string GenerateTradingId(int length = 12)
+// utility function giving the next value of a splitmix64 generator
+inline uint64_t SplitMix64(uint64_t& _state)
 {
-	thread_local random_device rd;
-	thread_local mt19937_64 gen(rd());
-	thread_local uniform_real_distribution<double> d(0.0, 1.0);
+	uint64_t _z = (_state += 0x9E3779B97F4A7C15ULL);
+	_z = (_z ^ (_z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	_z = (_z ^ (_z >> 27)) * 0x94D049BB133111EBULL;
+	return _z ^ (_z >> 31);
+}
 
-	string _base = "ZAQWSXCDERFVBGTYHNMJUIKLOP1472583690";
-	string ID = "";
+// utility function to generate random trading Ids (at most TradingId::CAPACITY characters)
+// one 64-bit draw gives 12 base-36 characters, since 36^12 < 2^64
+TradingId GenerateTradingId(int length = 12)
+{
+	thread_local uint64_t state = ((uint64_t)random_device{}() << 32) ^ random_device{}();
+	static const char _base[] = "ZAQWSXCDERFVBGTYHNMJUIKLOP1472583690";
+
+	length = min(length, TradingId::CAPACITY);
+	char ID[TradingId::CAPACITY];
+	uint64_t _bits = 0;
 	for (int i = 0; i < length; i++) {
-		double _r = d(gen);
-		ID.push_back(_base[(int)(_r * 36)]);
+		if (i % 12 == 0) {
+			_bits = SplitMix64(state);
+		}
+		ID[i] = _base[_bits % 36];
+		_bits /= 36;
 	}
-	return ID;
+	return TradingId(ID, length);
 }
 
-// utility function to separate the line
-// deliminator is ","
-std::vector<string> LineToCells(string line) {
-	stringstream lineStream(line);
-	string cell;
-	vector<string> cells;
-	while (getline(lineStream, cell, ','))
+// utility function to separate the line into the given cells, reusing their storage (no allocation once the cells have grown)
+// deliminator is ","; a trailing empty cell is dropped, as getline() would.
+// a trailing '\r' is dropped so that files recorded on Windows replay on other platforms
+void LineToCells(const string& line, vector<string>& cells) {
+	size_t end = line.size();
+	if (end > 0 && line[end - 1] == '\r') {
+		end--;
+	}
+	size_t count = 0;
+	size_t begin = 0;
+	while (begin < end)
 	{
-		cells.push_back(cell);
+		size_t comma = line.find(',', begin);
+		if (comma == string::npos || comma > end) {
+			comma = end;
+		}
+		if (count == cells.size()) {
+			cells.emplace_back();
+		}
+		cells[count++].assign(line, begin, comma - begin);
+		begin = comma + 1;
 	}
+	cells.resize(count);
+}
+
+// utility function to separate the line into new cells
+std::vector<string> LineToCells(const string& line) {
+	vector<string> cells;
+	LineToCells(line, cells);
 	return cells;
 }
 